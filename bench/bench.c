@@ -0,0 +1,210 @@
+#include "raylib.h"
+#include "raymath.h"
+#include "sph.h"
+#include "timing.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define WORLD_WIDTH 8.0f
+#define WORLD_HEIGHT 6.0f
+#define PARTICLE_MASS 0.1f
+#define SMOOTHING_LENGTH 2.0f
+#define TIME_STEP (1.0f / 60.0f)
+#define MAX_SIZES 16
+
+struct bench_config {
+        const char *output;
+        int sizes[MAX_SIZES];
+        int size_count;
+        int samples;
+        double min_sample_time; // Minimum duration of a sample (in seconds)
+};
+
+static const char *kernel_names[] = {
+    [GAUSSIAN_KERNEL] = "gaussian",
+    [CUBIC_KERNEL] = "cubic",
+    [LINEAR_KERNEL] = "linear",
+};
+
+static const char *pressure_names[] = {
+    [COLE_PRESSURE] = "cole",
+    [GAS_PRESSURE] = "gas",
+};
+
+// A single step of the simulation on one thread, same phases as main.c
+static void bench_step(struct particle_array *particles,
+                       enum kernel_type kernel_type,
+                       enum pressure_type pressure_type, void *pressure_params) {
+    for (int i = 0; i < particles->count; i++) {
+        particles->items[i].density = particle_density(
+            particles, i, SMOOTHING_LENGTH, PARTICLE_MASS, kernel_type);
+        particles->items[i].pressure = pressure_value(
+            particles->items[i].density, pressure_params, pressure_type);
+    }
+
+    for (int i = 0; i < particles->count; i++) {
+        Vector2 gradient = particle_pressure_gradient(
+            particles, i, SMOOTHING_LENGTH, PARTICLE_MASS, kernel_type);
+        Vector2 acceleration =
+            Vector2Scale(gradient, 1.0f / particles->items[i].density);
+        particles->items[i].velocity = Vector2Add(
+            particles->items[i].velocity, Vector2Scale(acceleration, TIME_STEP));
+    }
+
+    for (int i = 0; i < particles->count; i++) {
+        struct particle *p = &particles->items[i];
+        p->position = Vector2Add(p->position, Vector2Scale(p->velocity, TIME_STEP));
+        p->position.x = Clamp(p->position.x, 0.0f, WORLD_WIDTH);
+        p->position.y = Clamp(p->position.y, 0.0f, WORLD_HEIGHT);
+    }
+}
+
+// Measures one sample of a combination
+//
+// Returns the time per particle per step (in nanoseconds)
+static double bench_sample(struct particle_array *particles,
+                           enum kernel_type kernel_type,
+                           enum pressure_type pressure_type,
+                           void *pressure_params, double min_sample_time) {
+    int steps = 0;
+    double start = timing_now();
+    double elapsed = 0.0;
+    do {
+        bench_step(particles, kernel_type, pressure_type, pressure_params);
+        steps++;
+        elapsed = timing_now() - start;
+    } while (elapsed < min_sample_time);
+
+    return elapsed * 1e9 / ((double)steps * particles->count);
+}
+
+static void bench_usage(const char *program) {
+    fprintf(stderr,
+            "Usage: %s [-o results.json] [-n 256,1024] [-s samples] "
+            "[-t min_sample_seconds]\n",
+            program);
+}
+
+static int bench_parse_sizes(struct bench_config *config, char *list) {
+    config->size_count = 0;
+    for (char *token = strtok(list, ","); token != NULL;
+         token = strtok(NULL, ",")) {
+        if (config->size_count == MAX_SIZES) {
+            return -1;
+        }
+
+        int n = atoi(token);
+        if (n <= 1) {
+            return -1;
+        }
+        config->sizes[config->size_count++] = n;
+    }
+
+    return config->size_count > 0 ? 0 : -1;
+}
+
+int main(int argc, char **argv) {
+    struct bench_config config = {
+        .output = "bench.json",
+        .sizes = {256, 1024},
+        .size_count = 2,
+        .samples = 7,
+        .min_sample_time = 0.05,
+    };
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            config.output = argv[++i];
+        } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            if (bench_parse_sizes(&config, argv[++i]) != 0) {
+                SPH_LOG_ERROR("Invalid particle counts");
+                return 2;
+            }
+        } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            config.samples = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            config.min_sample_time = atof(argv[++i]);
+        } else {
+            bench_usage(argv[0]);
+            return 2;
+        }
+    }
+
+    if (config.samples < 1) {
+        SPH_LOG_ERROR("At least one sample is required");
+        return 2;
+    }
+
+    FILE *file = fopen(config.output, "w");
+    if (file == NULL) {
+        SPH_LOG_ERROR("Could not open %s", config.output);
+        return 2;
+    }
+
+    struct pressure_cole_params cole = {
+        .rest_density = 0.8f,
+        .speed_of_sound = 1.0f,
+        .adiabatic_index = 7.0f,
+        .background_pressure = 100000.0f,
+    };
+    struct pressure_gas_params gas = {
+        .rest_density = 0.8f,
+        .pressure_multiplier = 100.0f,
+    };
+    void *pressure_params[] = {
+        [COLE_PRESSURE] = &cole,
+        [GAS_PRESSURE] = &gas,
+    };
+
+    fprintf(file, "{\n  \"version\": 1,\n  \"results\": [");
+    int first = 1;
+    for (int s = 0; s < config.size_count; s++) {
+        int n = config.sizes[s];
+        struct particle_array particles = {
+            .items = calloc(n, sizeof(struct particle)),
+            .count = n,
+            .capacity = n,
+        };
+        if (particles.items == NULL) {
+            SPH_LOG_ERROR("Could not allocate %d particles", n);
+            return 2;
+        }
+
+        for (int k = GAUSSIAN_KERNEL; k <= LINEAR_KERNEL; k++) {
+            for (int e = COLE_PRESSURE; e <= GAS_PRESSURE; e++) {
+                // Every combination starts from the same particles
+                SetRandomSeed(42);
+                particles_init_rand(&particles, WORLD_WIDTH, WORLD_HEIGHT);
+
+                // Warm up the caches and the branch predictors
+                bench_step(&particles, k, e, pressure_params[e]);
+
+                fprintf(file,
+                        "%s\n    {\"kernel\": \"%s\", \"pressure\": \"%s\", "
+                        "\"particles\": %d, \"metric\": "
+                        "\"ns_per_particle_step\", \"samples\": [",
+                        first ? "" : ",", kernel_names[k], pressure_names[e],
+                        n);
+                first = 0;
+
+                for (int i = 0; i < config.samples; i++) {
+                    double ns = bench_sample(&particles, k, e,
+                                             pressure_params[e],
+                                             config.min_sample_time);
+                    fprintf(file, "%s%.3f", i == 0 ? "" : ", ", ns);
+                }
+                fprintf(file, "]}");
+
+                SPH_LOG_INFO("%s/%s/%d done", kernel_names[k],
+                             pressure_names[e], n);
+            }
+        }
+
+        free(particles.items);
+    }
+    fprintf(file, "\n  ]\n}\n");
+    fclose(file);
+
+    return 0;
+}
@@ -0,0 +1,468 @@
+#include <ctype.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Compares two result files written by the bench executable
+//
+// For every kernel/pressure/particles combination the medians of the two
+// runs are compared. A combination regresses when the current median is
+// slower than the baseline by more than the metric threshold AND the
+// difference is larger than the noise of both medians, estimated with the
+// median absolute deviation of the samples scaled to the standard error of
+// a median. A combination of the baseline missing from the current run
+// fails the comparison too, it could be hiding a regression.
+//
+// Exit codes: 0 no regression, 1 regression or missing combination,
+// 2 invalid input
+
+#define MAX_SAMPLES 256
+#define MAX_THRESHOLDS 16
+#define MAD_TO_SIGMA 1.4826
+// Standard error of the median of n normal samples is sqrt(pi/2)*sigma/sqrt(n)
+#define MEDIAN_STANDARD_ERROR 1.2533
+
+struct bench_result {
+        char kernel[32];
+        char pressure[32];
+        char metric[64];
+        int particles;
+        double samples[MAX_SAMPLES];
+        int sample_count;
+};
+
+struct bench_results {
+        struct bench_result *items;
+        int count;
+        int capacity;
+};
+
+struct metric_threshold {
+        char metric[64];
+        double ratio; // Allowed slowdown, 0.05 means 5%
+};
+
+struct compare_config {
+        struct metric_threshold thresholds[MAX_THRESHOLDS];
+        int threshold_count;
+        double default_ratio;
+        double sigmas; // Number of noise sigmas a change must exceed
+};
+
+// Minimal JSON reader, only what is needed for the bench result files
+
+struct json_reader {
+        const char *text;
+        const char *at;
+        const char *filename;
+};
+
+static void json_error(struct json_reader *r, const char *what) {
+    int line = 1;
+    for (const char *c = r->text; c < r->at; c++) {
+        line += *c == '\n';
+    }
+    fprintf(stderr, "%s:%d: %s\n", r->filename, line, what);
+}
+
+static void json_skip_ws(struct json_reader *r) {
+    while (isspace((unsigned char)*r->at)) {
+        r->at++;
+    }
+}
+
+static int json_expect(struct json_reader *r, char c) {
+    json_skip_ws(r);
+    if (*r->at != c) {
+        char message[32];
+        snprintf(message, sizeof(message), "expected '%c'", c);
+        json_error(r, message);
+        return -1;
+    }
+    r->at++;
+    return 0;
+}
+
+static int json_peek(struct json_reader *r, char c) {
+    json_skip_ws(r);
+    return *r->at == c;
+}
+
+static int json_string(struct json_reader *r, char *out, size_t size) {
+    if (json_expect(r, '"') != 0) {
+        return -1;
+    }
+
+    size_t n = 0;
+    while (*r->at != '"') {
+        if (*r->at == '\0') {
+            json_error(r, "unterminated string");
+            return -1;
+        }
+        if (*r->at == '\\' && r->at[1] != '\0') {
+            r->at++;
+        }
+        if (n + 1 < size) {
+            out[n++] = *r->at;
+        }
+        r->at++;
+    }
+    out[n] = '\0';
+    r->at++;
+    return 0;
+}
+
+static int json_number(struct json_reader *r, double *out) {
+    json_skip_ws(r);
+    char *end = NULL;
+    *out = strtod(r->at, &end);
+    if (end == r->at) {
+        json_error(r, "expected a number");
+        return -1;
+    }
+    r->at = end;
+    return 0;
+}
+
+// Skips any value, used for the keys the comparison does not know about
+static int json_skip_value(struct json_reader *r) {
+    json_skip_ws(r);
+    if (*r->at == '"') {
+        char dummy[2];
+        return json_string(r, dummy, sizeof(dummy));
+    }
+
+    if (*r->at == '{' || *r->at == '[') {
+        char close = *r->at == '{' ? '}' : ']';
+        r->at++;
+        if (json_peek(r, close)) {
+            r->at++;
+            return 0;
+        }
+        do {
+            if (close == '}') {
+                char key[2];
+                if (json_string(r, key, sizeof(key)) != 0 ||
+                    json_expect(r, ':') != 0) {
+                    return -1;
+                }
+            }
+            if (json_skip_value(r) != 0) {
+                return -1;
+            }
+        } while (json_peek(r, ',') && r->at++);
+        return json_expect(r, close);
+    }
+
+    if (strncmp(r->at, "true", 4) == 0 || strncmp(r->at, "null", 4) == 0) {
+        r->at += 4;
+        return 0;
+    }
+    if (strncmp(r->at, "false", 5) == 0) {
+        r->at += 5;
+        return 0;
+    }
+
+    double number;
+    return json_number(r, &number);
+}
+
+static int json_result(struct json_reader *r, struct bench_result *result) {
+    memset(result, 0, sizeof(*result));
+    strcpy(result->metric, "ns_per_particle_step");
+
+    if (json_expect(r, '{') != 0) {
+        return -1;
+    }
+    if (json_peek(r, '}')) {
+        r->at++;
+        return 0;
+    }
+
+    do {
+        char key[64];
+        if (json_string(r, key, sizeof(key)) != 0 || json_expect(r, ':') != 0) {
+            return -1;
+        }
+
+        int error = 0;
+        if (strcmp(key, "kernel") == 0) {
+            error = json_string(r, result->kernel, sizeof(result->kernel));
+        } else if (strcmp(key, "pressure") == 0) {
+            error = json_string(r, result->pressure, sizeof(result->pressure));
+        } else if (strcmp(key, "metric") == 0) {
+            error = json_string(r, result->metric, sizeof(result->metric));
+        } else if (strcmp(key, "particles") == 0) {
+            double n;
+            error = json_number(r, &n);
+            result->particles = (int)n;
+        } else if (strcmp(key, "samples") == 0) {
+            error = json_expect(r, '[');
+            if (!error && !json_peek(r, ']')) {
+                do {
+                    double sample;
+                    if (json_number(r, &sample) != 0) {
+                        return -1;
+                    }
+                    if (result->sample_count < MAX_SAMPLES) {
+                        result->samples[result->sample_count++] = sample;
+                    }
+                } while (json_peek(r, ',') && r->at++);
+            }
+            error = error || json_expect(r, ']');
+        } else {
+            error = json_skip_value(r);
+        }
+
+        if (error) {
+            return -1;
+        }
+    } while (json_peek(r, ',') && r->at++);
+
+    return json_expect(r, '}');
+}
+
+static int results_append(struct bench_results *results,
+                          struct bench_result *result) {
+    if (results->count == results->capacity) {
+        int capacity = results->capacity * 2 + 16;
+        void *items = realloc(results->items, capacity * sizeof(*result));
+        if (items == NULL) {
+            return -1;
+        }
+        results->items = items;
+        results->capacity = capacity;
+    }
+
+    results->items[results->count++] = *result;
+    return 0;
+}
+
+static char *read_file(const char *filename) {
+    FILE *file = fopen(filename, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "Could not open %s\n", filename);
+        return NULL;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    char *text = malloc(size + 1);
+    if (text != NULL && fread(text, 1, size, file) != (size_t)size) {
+        free(text);
+        text = NULL;
+    }
+    if (text != NULL) {
+        text[size] = '\0';
+    }
+    fclose(file);
+
+    return text;
+}
+
+static int results_load(const char *filename, struct bench_results *results) {
+    char *text = read_file(filename);
+    if (text == NULL) {
+        return -1;
+    }
+
+    struct json_reader r = {.text = text, .at = text, .filename = filename};
+    int error = json_expect(&r, '{');
+    while (!error && !json_peek(&r, '}')) {
+        char key[64];
+        error = json_string(&r, key, sizeof(key)) || json_expect(&r, ':');
+        if (error) {
+            break;
+        }
+
+        if (strcmp(key, "results") == 0) {
+            error = json_expect(&r, '[');
+            if (!error && !json_peek(&r, ']')) {
+                do {
+                    struct bench_result result;
+                    error = json_result(&r, &result) ||
+                            results_append(results, &result);
+                } while (!error && json_peek(&r, ',') && r.at++);
+            }
+            error = error || json_expect(&r, ']');
+        } else {
+            error = json_skip_value(&r);
+        }
+
+        if (!error && json_peek(&r, ',')) {
+            r.at++;
+        }
+    }
+
+    free(text);
+    return error ? -1 : 0;
+}
+
+// Statistics
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double median(const double *values, int count) {
+    double sorted[MAX_SAMPLES];
+    memcpy(sorted, values, count * sizeof(double));
+    qsort(sorted, count, sizeof(double), compare_doubles);
+    if (count % 2 == 1) {
+        return sorted[count / 2];
+    }
+    return (sorted[count / 2 - 1] + sorted[count / 2]) / 2.0;
+}
+
+// Median absolute deviation, a noise estimate robust to outliers
+static double mad(const double *values, int count, double center) {
+    double deviations[MAX_SAMPLES];
+    for (int i = 0; i < count; i++) {
+        deviations[i] = fabs(values[i] - center);
+    }
+    return median(deviations, count);
+}
+
+static double threshold_for(struct compare_config *config, const char *metric) {
+    for (int i = 0; i < config->threshold_count; i++) {
+        if (strcmp(config->thresholds[i].metric, metric) == 0) {
+            return config->thresholds[i].ratio;
+        }
+    }
+    return config->default_ratio;
+}
+
+static struct bench_result *results_find(struct bench_results *results,
+                                         struct bench_result *key) {
+    for (int i = 0; i < results->count; i++) {
+        struct bench_result *r = &results->items[i];
+        if (r->particles == key->particles &&
+            strcmp(r->kernel, key->kernel) == 0 &&
+            strcmp(r->pressure, key->pressure) == 0 &&
+            strcmp(r->metric, key->metric) == 0) {
+            return r;
+        }
+    }
+    return NULL;
+}
+
+static void usage(const char *program) {
+    fprintf(stderr,
+            "Usage: %s baseline.json current.json [-t metric=percent]... "
+            "[-d default_percent] [-k sigmas]\n",
+            program);
+}
+
+int main(int argc, char **argv) {
+    struct compare_config config = {
+        .threshold_count = 0,
+        .default_ratio = 0.05,
+        .sigmas = 3.0,
+    };
+    const char *files[2] = {NULL, NULL};
+    int file_count = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            char *spec = argv[++i];
+            char *eq = strchr(spec, '=');
+            if (eq == NULL || config.threshold_count == MAX_THRESHOLDS) {
+                usage(argv[0]);
+                return 2;
+            }
+            struct metric_threshold *t =
+                &config.thresholds[config.threshold_count++];
+            snprintf(t->metric, sizeof(t->metric), "%.*s", (int)(eq - spec),
+                     spec);
+            t->ratio = atof(eq + 1) / 100.0;
+        } else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+            config.default_ratio = atof(argv[++i]) / 100.0;
+        } else if (strcmp(argv[i], "-k") == 0 && i + 1 < argc) {
+            config.sigmas = atof(argv[++i]);
+        } else if (argv[i][0] != '-' && file_count < 2) {
+            files[file_count++] = argv[i];
+        } else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    if (file_count != 2) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    struct bench_results baseline = {0};
+    struct bench_results current = {0};
+    if (results_load(files[0], &baseline) != 0 ||
+        results_load(files[1], &current) != 0) {
+        return 2;
+    }
+
+    printf("%-10s %-8s %8s %12s %12s %8s %10s  %s\n", "kernel", "pressure",
+           "n", "baseline", "current", "change", "noise", "status");
+
+    int regressions = 0;
+    int compared = 0;
+    for (int i = 0; i < current.count; i++) {
+        struct bench_result *c = &current.items[i];
+        struct bench_result *b = results_find(&baseline, c);
+        if (b == NULL || b->sample_count == 0 || c->sample_count == 0) {
+            printf("%-10s %-8s %8d %12s %12s %8s %10s  new\n", c->kernel,
+                   c->pressure, c->particles, "-", "-", "-", "-");
+            continue;
+        }
+
+        double base_median = median(b->samples, b->sample_count);
+        double curr_median = median(c->samples, c->sample_count);
+        double base_sigma = MAD_TO_SIGMA * MEDIAN_STANDARD_ERROR *
+                            mad(b->samples, b->sample_count, base_median) /
+                            sqrt(b->sample_count);
+        double curr_sigma = MAD_TO_SIGMA * MEDIAN_STANDARD_ERROR *
+                            mad(c->samples, c->sample_count, curr_median) /
+                            sqrt(c->sample_count);
+        double noise = config.sigmas * sqrt(base_sigma * base_sigma +
+                                            curr_sigma * curr_sigma);
+        double delta = curr_median - base_median;
+        double change = base_median > 0.0 ? delta / base_median : 0.0;
+        double ratio = threshold_for(&config, c->metric);
+
+        const char *status = "ok";
+        if (change > ratio && delta > noise) {
+            status = "REGRESSION";
+            regressions++;
+        } else if (change < -ratio && -delta > noise) {
+            status = "improved";
+        } else if (fabs(change) > ratio) {
+            status = "noisy";
+        }
+        compared++;
+
+        printf("%-10s %-8s %8d %12.3f %12.3f %+7.1f%% %10.3f  %s\n",
+               c->kernel, c->pressure, c->particles, base_median, curr_median,
+               change * 100.0, noise, status);
+    }
+
+    int missing = 0;
+    for (int i = 0; i < baseline.count; i++) {
+        if (results_find(&current, &baseline.items[i]) == NULL) {
+            struct bench_result *b = &baseline.items[i];
+            missing++;
+            printf("%-10s %-8s %8d %12s %12s %8s %10s  missing\n", b->kernel,
+                   b->pressure, b->particles, "-", "-", "-", "-");
+        }
+    }
+
+    printf("%d combinations compared, %d regressions, %d missing\n",
+           compared, regressions, missing);
+
+    free(baseline.items);
+    free(current.items);
+
+    return regressions > 0 || missing > 0 ? 1 : 0;
+}
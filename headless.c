@@ -0,0 +1,199 @@
+#include "raster.h"
+#include "raylib.h"
+#include "simulation.h"
+#include "sph.h"
+#include "timing.h"
+#include "trace.h"
+#include "trajectory.h"
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Runs the simulation without a window
+//
+// Usage: headless [params.ini]
+//
+// The number of steps and the time step come from the [headless] section of
+// the parameters file. A run restarts from [checkpoint] restart when it is
+// set and writes a checkpoint every [checkpoint] every steps. Frames are
+// streamed to [trajectory] file when it is set and exported for ParaView with
+// [export] prefix. Frames are rendered on the CPU to the PNG files of the
+// [render] output pattern (e.g. frames/%05d.png), or as raw RGBA to stdout
+// when it is "-", in which case the log and the results go to stderr:
+//
+//   headless render.ini |
+//       ffmpeg -f rawvideo -pix_fmt rgba -s 800x600 -i - run.mp4
+int main(int argc, char **argv) {
+    const char *filename = argc > 1 ? argv[1] : "params.ini";
+
+    struct simulation_parameters params;
+    simulation_parameters_parse(filename, &params);
+
+    SetRandomSeed(params.seed != 0 ? params.seed : (unsigned int)time(NULL));
+
+    struct simulation sim;
+    if (simulation_init(&sim, &params) != 0) {
+        return 1;
+    }
+
+    if (params.checkpoint_restart != NULL &&
+        simulation_restore(&sim, params.checkpoint_restart) != 0) {
+        simulation_free(&sim);
+        return 1;
+    }
+
+    struct timing_table timing;
+    timing_init(&timing, sim.threads + 1, params.timing_csv);
+    sim.timing = &timing;
+
+    // The main thread records its phases in the slot past the workers
+    int main_slot = sim.threads;
+    struct perf_table perf_table = {0};
+    if (params.perf_counters && perf_init(&perf_table, sim.threads + 1) == 0) {
+        sim.perf = &perf_table;
+        perf_thread_open(sim.perf, main_slot);
+    }
+
+    if (params.trace != NULL) {
+#ifdef SPH_TRACE
+        trace_init(sim.threads + 1, TRACE_DEFAULT_CAPACITY);
+#else
+        SPH_LOG_WARN("Tracing requested but sphlib was built without "
+                     "SPH_TRACE");
+#endif
+    }
+
+    struct trajectory_writer trajectory = {0};
+    if (params.trajectory_file != NULL &&
+        trajectory_writer_open(&trajectory, params.trajectory_file, &params) !=
+            0) {
+        simulation_free(&sim);
+        return 1;
+    }
+
+    struct export_series series = {0};
+    if (params.export_prefix != NULL &&
+        export_series_init(&series, params.export_prefix, params.export_format,
+                           sim.threads) != 0) {
+        trajectory_writer_close(&trajectory);
+        simulation_free(&sim);
+        return 1;
+    }
+    if (series.prefix != NULL && params.export_every > 0) {
+        export_series_write(&series, &sim.particles, sim.time);
+    }
+
+    // Raw frames keep the real stdout, everything else printed moves to
+    // stderr so that it does not end up in the frames
+    struct raster raster = {0};
+    struct raster_output render = {0};
+    struct pressure_field field = {0};
+    if (params.render_output != NULL) {
+        int raw = strcmp(params.render_output, "-") == 0;
+        FILE *frames = NULL;
+        if (raw) {
+            fflush(stdout);
+            frames = fdopen(dup(STDOUT_FILENO), "wb");
+            dup2(STDERR_FILENO, STDOUT_FILENO);
+        }
+
+        float scale = fminf(params.render_width / params.width,
+                            params.render_height / params.height);
+        int failed = (raw && frames == NULL) ||
+                     raster_init(&raster, params.render_width,
+                                 params.render_height, scale) != 0;
+        if (!failed && params.render_pressure) {
+            failed = pressure_field_init(
+                         &field,
+                         (int)ceilf(params.width / RASTER_FIELD_CELL_SIZE),
+                         (int)ceilf(params.height / RASTER_FIELD_CELL_SIZE),
+                         RASTER_FIELD_CELL_SIZE, sim.threads) != 0;
+        }
+        if (failed || raster_output_open(&render,
+                                         raw ? NULL : params.render_output,
+                                         frames, params.render_width,
+                                         params.render_height) != 0) {
+            SPH_LOG_ERROR("Could not start rendering to %s",
+                          params.render_output);
+            pressure_field_free(&field);
+            raster_free(&raster);
+            export_series_free(&series);
+            trajectory_writer_close(&trajectory);
+            simulation_free(&sim);
+            return 1;
+        }
+    }
+
+    SPH_LOG_INFO("Running %d steps of %d particles on %d threads",
+                 params.steps, sim.particles.count, sim.threads);
+
+    double start = timing_now();
+    for (int i = 0; i < params.steps; i++) {
+        double t = profile_start(sim.perf, main_slot);
+        SPH_TRACE_BEGIN(main_slot, "step");
+        simulation_step(&sim, params.dt);
+        SPH_TRACE_END(main_slot, "step");
+        profile_lap(&timing, sim.perf, main_slot, TIMING_STEP, t);
+        timing_commit(&timing);
+        simulation_checkpoint(&sim);
+        if (trajectory.file != NULL) {
+            trajectory_capture(&trajectory, &sim);
+        }
+        if (series.prefix != NULL && params.export_every > 0 &&
+            sim.step % params.export_every == 0) {
+            export_series_write(&series, &sim.particles, sim.time);
+        }
+        if (raster.pixels != NULL && params.render_every > 0 &&
+            sim.step % params.render_every == 0) {
+            if (field.values != NULL) {
+                pressure_field_compute(&field, &sim);
+            }
+            raster_render(&raster, &sim, field.values != NULL ? &field : NULL);
+            raster_output_write(&render, &raster);
+        }
+    }
+    double elapsed = timing_now() - start;
+
+    if (series.prefix != NULL && params.export_every <= 0) {
+        export_series_write(&series, &sim.particles, sim.time);
+    }
+    export_series_free(&series);
+
+    struct simulation_stats stats;
+    simulation_compute_stats(&sim, &stats);
+
+    double steps = params.steps > 0 ? params.steps : 1;
+    double particles = sim.particles.count > 0 ? sim.particles.count : 1;
+    printf("steps: %ld, time: %.3f s, wall: %.3f s, ns/particle-step: %.3f\n",
+           sim.step, sim.time, elapsed, elapsed * 1e9 / (steps * particles));
+    printf("density: mean %.4f max %.4f, pressure: mean %.4f, kinetic "
+           "energy: %.4f, max speed: %.4f\n",
+           stats.mean_density, stats.max_density, stats.mean_pressure,
+           stats.kinetic_energy, stats.max_speed);
+
+    trajectory_writer_close(&trajectory);
+    if (raster.pixels != NULL) {
+        raster_output_close(&render);
+        if (render.raw != NULL) {
+            fclose(render.raw);
+        }
+        raster_free(&raster);
+        pressure_field_free(&field);
+    }
+    simulation_free(&sim);
+    timing_free(&timing);
+
+    if (sim.perf != NULL) {
+        perf_report(sim.perf, stdout);
+        perf_free(sim.perf);
+    }
+
+    if (params.trace != NULL) {
+        trace_dump(params.trace);
+    }
+    trace_free();
+
+    return 0;
+}
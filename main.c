@@ -1,21 +1,19 @@
-#include <pthread.h>
-#define INI_IMPLEMENTATION
+#include "command.h"
 #include "ini.h"
 #include "raylib.h"
 #include "raylib_extensions.h"
+#include "pressure_field.h"
 #include "raymath.h"
+#include "simulation.h"
 #include "sph.h"
+#include "surface.h"
+#include "timing.h"
+#include "trace.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
-#define ASSERT(condition, format, ...)                                         \
-    do {                                                                       \
-        if (!(condition)) {                                                    \
-            INI_PANIC(format, ##__VA_ARGS__);                                  \
-        }                                                                      \
-    } while (0)
-
 #define SCREEN_WIDTH 800
 #define SCREEN_HEIGHT 600
 
@@ -25,376 +23,147 @@
 
 #define SCALE_FACTOR 25
 
-struct simulation_parameters {
-        // Program
-        int threads;        // Number of threads
-
-        // World
-        int particle_count; // Number of particles
-        float gravity;      // Gravity (in m/s^2)
-        float width;        // Width of the world (in meters)
-        float height;       // Height of the world (in meters)
-
-        // Particle
-        float particle_radius; // Particle radius (in meters)
-        float particle_mass;   // Particle mass (in units of mass)
-        float damping;         // Collision with boundaries damping
-
-        // Fluid
-        float rest_density;               // Rest density (in kg/m^3)
-        float adiabatic_index;            // Adiabatic index
-        float speed_of_sound;             // Speed of sound (in m/s)
-        float background_pressure;        // Background pressure (in Pa)
-        float pressure_multiplier;        // Pressure multiplier
-        enum pressure_type pressure_type; // Pressure type
-
-        // Kernel function
-        enum kernel_type kernel_type; // Kernel function type
-        float h;                      // Smoothing length (in meters)
-};
-
-void simulation_parameters_parse(char *filename,
-                                 struct simulation_parameters *params) {
-    FILE *file = fopen(filename, "r");
-    if (file == NULL) {
-        fprintf(stderr, "Error: Could not open file %s\n", filename);
-        exit(1);
-    }
-
-    int buffer_count = 0;
-    int buffer_capacity = 256;
-    char *buffer = calloc(buffer_capacity, sizeof(char));
-    ASSERT(buffer != NULL, "Could not allocate memory");
-    char line[256];
-    while (fgets(line, sizeof(line), file)) {
-        int len = strlen(line);
-        if (buffer_count + len + 1 >= buffer_capacity) {
-            buffer_capacity = buffer_capacity * 2 + len;
-            buffer = realloc(buffer, buffer_capacity * sizeof(char));
-            ASSERT(buffer != NULL, "Could not allocate memory");
-        }
-
-        strcpy(buffer + buffer_count, line);
-        buffer_count += len;
-        buffer[buffer_count] = '\0';
-    }
-
-    struct ini_file ini = {0};
-    ini_parse(&ini, buffer);
-
-    char *value = NULL;
-
-    value = ini_get_value(&ini, "program", "threads");
-    if (value != NULL) {
-        params->threads = atoi(value);
-        free(value);
-    } else {
-        params->threads = 1;
-    }
+#define FIELD_COLUMNS (SCREEN_WIDTH / SCALE_FACTOR)
+#define FIELD_ROWS (SCREEN_HEIGHT / SCALE_FACTOR)
 
-    value = ini_get_value(&ini, "world", "particle_count");
-    ASSERT(value != NULL, "Could not find particle_count");
-    params->particle_count = atoi(value);
-    free(value);
-
-    value = ini_get_value(&ini, "world", "gravity");
-    ASSERT(value != NULL, "Could not find gravity");
-    params->gravity = atof(value);
-    free(value);
-
-    params->width = FROM_SCREEN_TO_WORLD(SCREEN_WIDTH);
-    params->height = FROM_SCREEN_TO_WORLD(SCREEN_HEIGHT);
-
-    value = ini_get_value(&ini, "particle", "radius");
-    ASSERT(value != NULL, "Could not find particle_radius");
-    params->particle_radius = atof(value);
-    free(value);
-
-    value = ini_get_value(&ini, "particle", "mass");
-    ASSERT(value != NULL, "Could not find particle_mass");
-    params->particle_mass = atof(value);
-    free(value);
-
-    value = ini_get_value(&ini, "particle", "damping");
-    ASSERT(value != NULL, "Could not find damping");
-    params->damping = atof(value);
-    free(value);
-
-    char *value1 = ini_get_value(&ini, "pressure", "type");
-    ASSERT(value1 != NULL, "Could not find pressure_type");
-    if (strcmp(value1, "cole") == 0) {
-        params->pressure_type = COLE_PRESSURE;
-
-        value = ini_get_value(&ini, "pressure.cole", "rest_density");
-        ASSERT(value != NULL, "Could not find rest_density");
-        params->rest_density = atof(value);
-        free(value);
-
-        value = ini_get_value(&ini, "pressure.cole", "adiabatic_index");
-        ASSERT(value != NULL, "Could not find adiabatic_index");
-        params->adiabatic_index = atof(value);
-        free(value);
-
-        value = ini_get_value(&ini, "pressure.cole", "speed_of_sound");
-        ASSERT(value != NULL, "Could not find speed_of_sound");
-        params->speed_of_sound = atof(value);
-        free(value);
-
-        value = ini_get_value(&ini, "pressure.cole", "background_pressure");
-        ASSERT(value != NULL, "Could not find background_pressure");
-        params->background_pressure = atof(value);
-        free(value);
-    } else if (strcmp(value1, "gas") == 0) {
-        params->pressure_type = GAS_PRESSURE;
-
-        value = ini_get_value(&ini, "pressure.gas", "rest_density");
-        ASSERT(value != NULL, "Could not find rest_density");
-        params->rest_density = atof(value);
-        free(value);
-
-        value = ini_get_value(&ini, "pressure.gas", "pressure_multiplier");
-        ASSERT(value != NULL, "Could not find pressure_multiplier");
-        params->pressure_multiplier = atof(value);
-        free(value);
-    } else {
-        INI_PANIC("Invalid pressure type");
-    }
-    free(value1);
-
-    value = ini_get_value(&ini, "kernel", "type");
-    ASSERT(value != NULL, "Could not find kernel_type");
-    if (strcmp(value, "gaussian") == 0) {
-        params->kernel_type = GAUSSIAN_KERNEL;
-    } else if (strcmp(value, "linear") == 0) {
-        params->kernel_type = LINEAR_KERNEL;
-    } else if (strcmp(value, "cubic") == 0) {
-        params->kernel_type = CUBIC_KERNEL;
-    } else {
-        INI_PANIC("Invalid kernel type");
-    }
-    free(value);
+// The surface grid has a node every 5 pixels and a tile is extracted again
+// once a particle near it moved by a pixel
+#define SURFACE_CELL_SIZE FROM_SCREEN_TO_WORLD(5.0f)
+#define SURFACE_THRESHOLD FROM_SCREEN_TO_WORLD(1.0f)
 
-    value = ini_get_value(&ini, "kernel", "h");
-    ASSERT(value != NULL, "Could not find h");
-    params->h = atof(value);
-    free(value);
+// The surface is where the density falls to this fraction of the rest density
+#define SURFACE_ISO_FRACTION 0.5f
 
-    ini_free(&ini);
-    free(buffer);
-    fclose(file);
-}
+// Right click removes the particles within 20 pixels of the mouse
+#define DELETE_RADIUS FROM_SCREEN_TO_WORLD(20.0f)
 
-void *get_pressure_params(struct simulation_parameters params) {
-    void *pressure_params;
-    switch (params.pressure_type) {
-    case COLE_PRESSURE: {
-        struct pressure_cole_params p = {
-            .rest_density = params.rest_density,
-            .speed_of_sound = params.speed_of_sound,
-            .adiabatic_index = params.adiabatic_index,
-            .background_pressure = params.background_pressure,
-        };
-        pressure_params = &p;
-        break;
-    }
-    case GAS_PRESSURE: {
-        struct pressure_gas_params p = {
-            .rest_density = params.rest_density,
-            .pressure_multiplier = params.pressure_multiplier,
-        };
-        pressure_params = &p;
-        break;
-    }
+// Queues a change of a parameter by the mouse wheel
+static void AdjustParameter(struct command_queue *commands,
+                            enum command_parameter parameter, float step,
+                            float min, float max) {
+    float wheel = GetMouseWheelMove();
+    if (wheel == 0.0f) {
+        return;
     }
 
-    return pressure_params;
+    struct command command = {
+        .type = COMMAND_ADJUST,
+        .adjust = {parameter, wheel * step, min, max},
+    };
+    command_queue_push(commands, &command);
 }
 
-void resolve_collisions(struct particle *particle, Vector2 position,
-                        struct simulation_parameters params) {
-    if (position.x < 0) {
-        position.x = 0;
-        particle->velocity.x *= -1.0f * params.damping;
-    } else if (position.x > params.width) {
-        position.x = params.width;
-        particle->velocity.x *= -1.0f * params.damping;
+// Colors the pressure field into a persistent texture and draws it over the
+// whole window
+void DrawPressureTexture(struct pressure_field *field, Texture2D texture,
+                         Color *pixels) {
+    for (int c = 0; c < field->columns * field->rows; c++) {
+        float p = field->values[c];
+        pixels[c] = pressure_field_color(field->max > 0.0f ? p / field->max
+                                                           : 0.0f);
     }
 
-    if (position.y < 0) {
-        position.y = 0;
-        particle->velocity.y *= -1.0f * params.damping;
-    } else if (position.y > params.height) {
-        position.y = params.height;
-        particle->velocity.y *= -1.0f * params.damping;
-    }
-
-    particle->position = position;
+    UpdateTexture(texture, pixels);
+    DrawTexturePro(texture,
+                   (Rectangle){0, 0, field->columns, field->rows},
+                   (Rectangle){0, 0, SCREEN_WIDTH, SCREEN_HEIGHT},
+                   (Vector2){0, 0}, 0.0f, WHITE);
 }
 
-struct particle_thread_args {
-    struct particle_array *particles;
-    struct simulation_parameters *params;
-    pthread_barrier_t *barrier;
-    pthread_barrier_t *main_barrier;
-    int index;
-};
-
-void *particle_simulation_step_thread(void *args) {
-    struct particle_thread_args *a = (struct particle_thread_args *)args;
+// Draws the pressure acceleration of every particle as computed by the last
+// step, none are drawn once particles were added, removed or moved since
+void DrawPressureAccelerations(struct simulation *sim) {
+    struct particle_array *particles = &sim->particles;
+    int count = sim->pressure_acceleration_count < particles->count
+                    ? sim->pressure_acceleration_count
+                    : particles->count;
 
-    int particles_per_thread = a->particles->count / a->params->threads;
+    for (int i = 0; i < count; i++) {
+        Vector2 screen_position_start =
+            (Vector2){FROM_WORLD_TO_SCREEN(particles->items[i].position.x),
+                      FROM_WORLD_TO_SCREEN(particles->items[i].position.y)};
 
-    int start = a->index * particles_per_thread;
-    int end = (a->index + 1) * particles_per_thread;
-    if (a->index == a->params->threads - 1) {
-        end = a->particles->count;
-    }
+        Vector2 screen_position_end =
+            Vector2Add(screen_position_start,
+                       Vector2Scale(sim->pressure_accelerations[i], 10.0f));
 
-    for (int i = start; i < end; i++) {
-        a->particles->items[i].density = particle_density(
-            a->particles, i, a->params->h, a->params->particle_mass, a->params->kernel_type);
-        a->particles->items[i].pressure =
-            pressure_value(a->particles->items[i].density,
-                           get_pressure_params(*a->params), a->params->pressure_type);
+        DrawLineV(screen_position_start, screen_position_end, GREEN);
     }
+}
 
-    pthread_barrier_wait(a->barrier);
-
-    for (int i = start; i < end; i++) {
-        Vector2 pressure_gradient = particle_pressure_gradient(
-            a->particles, i, a->params->h, a->params->particle_mass, a->params->kernel_type);
-
-        Vector2 pressure_acceleration =
-            Vector2Scale(pressure_gradient, 1.0f / a->particles->items[i].density);
-
-        Vector2 gravity_acceleration = {0.0f, a->params->gravity};
-
-        Vector2 acceleration =
-            Vector2Add(pressure_acceleration, gravity_acceleration);
-
-        a->particles->items[i].velocity = Vector2Add(
-            a->particles->items[i].velocity, Vector2Scale(acceleration, GetFrameTime()));
-    }
+// Screen positions of the particles, filled by the workers for the batch
+struct screen_positions {
+        Vector2 *items;
+        int count;
+        int capacity;
+};
 
-    pthread_barrier_wait(a->barrier);
+static void ScreenPositionsTask(struct simulation *sim, int worker,
+                                void *user) {
+    struct screen_positions *positions = (struct screen_positions *)user;
+    int start = (int)((long)worker * positions->count / sim->threads);
+    int end = (int)((long)(worker + 1) * positions->count / sim->threads);
 
     for (int i = start; i < end; i++) {
-        Vector2 position =
-            Vector2Add(a->particles->items[i].position,
-                       Vector2Scale(a->particles->items[i].velocity, GetFrameTime()));
-
-        resolve_collisions(&a->particles->items[i], position, *a->params);
+        positions->items[i] =
+            (Vector2){FROM_WORLD_TO_SCREEN(sim->particles.items[i].position.x),
+                      FROM_WORLD_TO_SCREEN(sim->particles.items[i].position.y)};
     }
-
-    pthread_barrier_wait(a->barrier);
-
-    return NULL;
 }
 
-void *particle_simulation_thread(void *args) {
-    struct particle_thread_args *a = (struct particle_thread_args *)args;
-
-    while (!WindowShouldClose()) {
-        // Key presses on main
-
-        pthread_barrier_wait(a->main_barrier);
-
-        if (IsKeyDown(KEY_SPACE)) {
-            particle_simulation_step_thread(args);
+void DrawParticles(struct simulation *sim, struct screen_positions *positions) {
+    int count = sim->particles.count;
+    if (count > positions->capacity) {
+        Vector2 *items = realloc(positions->items, count * sizeof(Vector2));
+        if (items == NULL) {
+            SPH_LOG_ERROR("Could not allocate %d screen positions", count);
+            return;
         }
-
-        pthread_barrier_wait(a->main_barrier);
-
-        // Draw particles
-
-        pthread_barrier_wait(a->main_barrier);
+        positions->items = items;
+        positions->capacity = count;
     }
+    positions->count = count;
 
-    return NULL;
-}
+    simulation_run(sim, ScreenPositionsTask, positions);
 
-void DrawPressureTexture(struct particle_array *particles,
-                         struct simulation_parameters params) {
-
-    float pressure[SCREEN_WIDTH / SCALE_FACTOR][SCREEN_HEIGHT / SCALE_FACTOR] =
-        {0};
-    for (int i = 0; i < particles->count; i++) {
-        for (int x = 0; x < SCREEN_WIDTH; x += SCALE_FACTOR) {
-            for (int y = 0; y < SCREEN_HEIGHT; y += SCALE_FACTOR) {
-                Vector2 point =
-                    (Vector2){FROM_SCREEN_TO_WORLD(x + SCALE_FACTOR / 2.0f),
-                              FROM_SCREEN_TO_WORLD(y + SCALE_FACTOR / 2.0f)};
-                float density =
-                    position_density(particles, point, params.h,
-                                     params.particle_mass, params.kernel_type);
-                float p = pressure_value(density, get_pressure_params(params),
-                                         params.pressure_type);
-                pressure[x / SCALE_FACTOR][y / SCALE_FACTOR] += p;
-            }
-        }
-    }
+    float screen_radius = FROM_WORLD_TO_SCREEN(sim->params.particle_radius);
+    DrawParticlesBatch(positions->items, count, screen_radius, GREEN);
+}
 
-    float max_pressure = 0.0f;
-    for (int x = 0; x < SCREEN_WIDTH; x += SCALE_FACTOR) {
-        for (int y = 0; y < SCREEN_HEIGHT; y += SCALE_FACTOR) {
-            float p = pressure[x / SCALE_FACTOR][y / SCALE_FACTOR];
-            max_pressure = fmaxf(max_pressure, fabsf(p));
+void DrawSurface(struct surface *surface) {
+    int tile_count = surface->tiles_x * surface->tiles_y;
+    for (int t = 0; t < tile_count; t++) {
+        struct surface_tile *tile = &surface->tiles[t];
+        for (int i = 0; i + 1 < tile->count; i += 2) {
+            Vector2 start = {FROM_WORLD_TO_SCREEN(tile->points[i].x),
+                             FROM_WORLD_TO_SCREEN(tile->points[i].y)};
+            Vector2 end = {FROM_WORLD_TO_SCREEN(tile->points[i + 1].x),
+                           FROM_WORLD_TO_SCREEN(tile->points[i + 1].y)};
+            DrawLineEx(start, end, 2.0f, SKYBLUE);
         }
     }
+}
 
-    Image img = GenImageColor(SCREEN_WIDTH / SCALE_FACTOR,
-                              SCREEN_HEIGHT / SCALE_FACTOR, BLANK);
-    for (int x = 0; x < SCREEN_WIDTH; x += SCALE_FACTOR) {
-        for (int y = 0; y < SCREEN_HEIGHT; y += SCALE_FACTOR) {
-            Color color;
-            float p = pressure[x / SCALE_FACTOR][y / SCALE_FACTOR];
-            float normalized_p = p / max_pressure;
-            if (normalized_p > 0.1f) {
-                float t = (normalized_p - 0.1f) / 0.9f;
-                color = ColorGradient((Color){255, 0, 0, 255}, BLACK, t);
-            } else if (normalized_p < -0.1f) {
-                float t = -(normalized_p + 0.1f) / 0.9f;
-                color = ColorGradient((Color){0, 0, 255, 255}, BLACK, t);
-            } else if (normalized_p > 0.0f) {
-                float t = normalized_p / 0.1f;
-                color = ColorGradient(WHITE, (Color){255, 0, 0, 255}, t);
-            } else {
-                float t = -normalized_p / 0.1f;
-                color = ColorGradient(WHITE, (Color){0, 0, 255, 255}, t);
-            }
-
-            ImageDrawPixel(&img, x / SCALE_FACTOR, y / SCALE_FACTOR, color);
+void DrawTimingOverlay(struct timing_table *timing, int threads) {
+    int x = SCREEN_WIDTH - 300;
+    int y = 10;
+
+    DrawText("phase: mean / max (ms)", x, y, 20, WHITE);
+    for (int p = 0; p < TIMING_PHASE_COUNT; p++) {
+        double mean, max;
+        // Worker phases are aggregated over the workers, the other ones are
+        // only measured on the main thread
+        if (p == TIMING_STEP || p == TIMING_PRESSURE_TEXTURE ||
+            p == TIMING_DRAW) {
+            timing_summary(timing, threads, threads + 1, p, &mean, &max);
+        } else {
+            timing_summary(timing, 0, threads, p, &mean, &max);
         }
-    }
-    ImageResize(&img, SCREEN_WIDTH, SCREEN_HEIGHT);
-
-    Texture2D texture = LoadTextureFromImage(img);
-    DrawTexture(texture, 0, 0, WHITE);
-    UnloadImage(img); // Unload the image as the texture now holds the data
-
-    for (int i = 0; i < particles->count; i++) {
-        particles->items[i].density = particle_density(
-            particles, i, params.h, params.particle_mass, params.kernel_type);
-        particles->items[i].pressure =
-            pressure_value(particles->items[i].density,
-                           get_pressure_params(params), params.pressure_type);
-    }
-
-    for (int i = 0; i < particles->count; i++) {
-        Vector2 pressure_gradient = particle_pressure_gradient(
-            particles, i, params.h, params.particle_mass, params.kernel_type);
-
-        Vector2 pressure_acceleration =
-            Vector2Scale(pressure_gradient, 1.0f / particles->items[i].density);
-
-        Vector2 screen_position_start =
-            (Vector2){FROM_WORLD_TO_SCREEN(particles->items[i].position.x),
-                      FROM_WORLD_TO_SCREEN(particles->items[i].position.y)};
-
-        Vector2 screen_position_end = Vector2Add(
-            screen_position_start, Vector2Scale(pressure_acceleration, 10.0f));
 
-        DrawLineV(screen_position_start, screen_position_end, GREEN);
+        y += 20;
+        DrawText(TextFormat("%s: %.3f / %.3f", timing_phase_name(p),
+                            mean * 1000.0, max * 1000.0),
+                 x, y, 20, WHITE);
     }
 }
 
@@ -404,37 +173,98 @@ int main() {
     struct simulation_parameters params;
     simulation_parameters_parse("params.ini", &params);
 
+    // The world is the size of the window
+    params.width = FROM_SCREEN_TO_WORLD(SCREEN_WIDTH);
+    params.height = FROM_SCREEN_TO_WORLD(SCREEN_HEIGHT);
+
     unsigned int debug = 0;
+    unsigned int show_surface = 0;
 
-    struct particle *ps =
-        calloc(params.particle_count, sizeof(struct particle));
-    struct particle_array particles = {
-        .items = ps,
-        .count = params.particle_count,
-        .capacity = params.particle_count,
-    };
+    struct simulation sim;
+    if (simulation_init(&sim, &params) != 0) {
+        return 1;
+    }
+    struct particle_array *particles = &sim.particles;
+
+    if (params.checkpoint_restart != NULL) {
+        if (simulation_restore(&sim, params.checkpoint_restart) != 0) {
+            simulation_free(&sim);
+            return 1;
+        }
 
-    particles_init_rand(&particles, params.width, params.height);
+        // The checkpoint may come from a headless run of another size
+        sim.params.width = params.width;
+        sim.params.height = params.height;
+    }
+
+    // One slot per worker and the last one for the main thread
+    struct timing_table timing;
+    timing_init(&timing, sim.threads + 1, params.timing_csv);
+    int main_slot = sim.threads;
+    sim.timing = &timing;
+
+    struct perf_table perf_table = {0};
+    struct perf_table *perf = NULL;
+    if (params.perf_counters && perf_init(&perf_table, sim.threads + 1) == 0) {
+        perf = &perf_table;
+        perf_thread_open(perf, main_slot);
+    }
 
-    pthread_t threads[params.threads];
-    struct particle_thread_args args[params.threads];
-    pthread_barrier_t barrier;
-    pthread_barrier_t main_barrier;
+    if (params.trace != NULL) {
+#ifdef SPH_TRACE
+        trace_init(sim.threads + 1, TRACE_DEFAULT_CAPACITY);
+#else
+        SPH_LOG_WARN("Tracing requested but sphlib was built without "
+                     "SPH_TRACE");
+#endif
+    }
 
-    pthread_barrier_init(&barrier, NULL, params.threads);
-    pthread_barrier_init(&main_barrier, NULL, params.threads + 1);
+    // The workers open their counters on their first task
+    sim.perf = perf;
 
     InitWindow(SCREEN_WIDTH, SCREEN_HEIGHT, "Smoothed Particle Hydrodynamics");
 
     SetTargetFPS(60);
 
-    for (int i = 0; i < params.threads; i++) {
-        args[i].particles = &particles;
-        args[i].params = &params;
-        args[i].barrier = &barrier;
-        args[i].main_barrier = &main_barrier;
-        args[i].index = i;
-        pthread_create(&threads[i], NULL, particle_simulation_thread, &args[i]);
+    // The pressure field of the debug view is uploaded to the same texture
+    // every frame
+    struct pressure_field field;
+    if (pressure_field_init(&field, FIELD_COLUMNS, FIELD_ROWS,
+                            FROM_SCREEN_TO_WORLD(SCALE_FACTOR),
+                            sim.threads) != 0) {
+        CloseWindow();
+        simulation_free(&sim);
+        return 1;
+    }
+    static Color field_pixels[FIELD_COLUMNS * FIELD_ROWS];
+    struct screen_positions screen_positions = {0};
+    Image field_image = GenImageColor(FIELD_COLUMNS, FIELD_ROWS, BLANK);
+    Texture2D field_texture = LoadTextureFromImage(field_image);
+    UnloadImage(field_image);
+    SetTextureFilter(field_texture, TEXTURE_FILTER_BILINEAR);
+
+    struct surface surface;
+    if (surface_init(&surface, params.width, params.height, SURFACE_CELL_SIZE,
+                     sim.params.rest_density * SURFACE_ISO_FRACTION,
+                     SURFACE_THRESHOLD) != 0) {
+        UnloadTexture(field_texture);
+        pressure_field_free(&field);
+        CloseWindow();
+        simulation_free(&sim);
+        return 1;
+    }
+
+    // The input only queues changes to the particles and the parameters,
+    // they are applied together before the next step. When the queue is full
+    // the input of the frame is dropped.
+    struct command_queue commands;
+    if (command_queue_init(&commands, COMMAND_DEFAULT_CAPACITY) != 0) {
+        surface_free(&surface);
+        UnloadTexture(field_texture);
+        pressure_field_free(&field);
+        CloseWindow();
+        simulation_free(&sim);
+        return 1;
     }
 
     while (!WindowShouldClose()) {
@@ -444,80 +274,150 @@ int main() {
                 FROM_SCREEN_TO_WORLD(mouse_position.x),
                 FROM_SCREEN_TO_WORLD(mouse_position.y),
             };
-            struct particle p = {
-                .position = world_position,
-                .velocity = (Vector2){0.0f, 0.0f},
-                .density = 0.0f,
-                .pressure = 0.0f,
+            struct command command = {
+                .type = COMMAND_SPAWN,
+                .spawn =
+                    {
+                        .position = world_position,
+                        .velocity = (Vector2){0.0f, 0.0f},
+                        .density = 0.0f,
+                        .pressure = 0.0f,
+                    },
+            };
+            command_queue_push(&commands, &command);
+        }
+
+        if (IsMouseButtonDown(MOUSE_RIGHT_BUTTON)) {
+            Vector2 mouse_position = GetMousePosition();
+            struct command command = {
+                .type = COMMAND_DELETE,
+                .remove = {{FROM_SCREEN_TO_WORLD(mouse_position.x),
+                            FROM_SCREEN_TO_WORLD(mouse_position.y)},
+                           DELETE_RADIUS},
             };
-            ini_da_append(&particles, p);
+            command_queue_push(&commands, &command);
         }
 
         if (IsKeyReleased(KEY_R)) {
-            particles.count = params.particle_count;
-            particles_init_rand(&particles, params.width, params.height);
+            struct command command = {.type = COMMAND_RESET};
+            command_queue_push(&commands, &command);
         }
 
         if (IsKeyDown(KEY_LEFT_SHIFT)) {
-            params.h += GetMouseWheelMove() * 0.1f;
-            params.h = Clamp(params.h, 1.0f, 5.5f);
+            AdjustParameter(&commands, COMMAND_PARAMETER_H, 0.1f, 1.0f, 5.5f);
         } else if (IsKeyDown(KEY_LEFT_CONTROL)) {
-            params.rest_density += GetMouseWheelMove() * 0.1f;
-            params.rest_density = Clamp(params.rest_density, 0.1f, 3.5f);
+            AdjustParameter(&commands, COMMAND_PARAMETER_REST_DENSITY, 0.1f,
+                            0.1f, 3.5f);
         } else if (IsKeyDown(KEY_RIGHT_SHIFT)) {
-            params.gravity += GetMouseWheelMove() * 0.5f;
-            params.gravity = Clamp(params.gravity, -10.0f, 10.0f);
+            AdjustParameter(&commands, COMMAND_PARAMETER_GRAVITY, 0.5f, -10.0f,
+                            10.0f);
+        }
+
+        // The workers are parked between steps, this is the only place where
+        // the particles and the parameters change
+        long reorders = sim.reorders;
+        int particle_count = sim.particles.count;
+        command_queue_apply(&commands, &sim);
+
+        // The accelerations of the last step belong to other particles once
+        // they moved, until the next step
+        if (sim.reorders != reorders || sim.particles.count != particle_count) {
+            sim.pressure_acceleration_count = 0;
         }
 
         if (IsKeyPressed(KEY_F1)) {
             debug = !debug;
         }
 
-        pthread_barrier_wait(&main_barrier);
+        if (IsKeyPressed(KEY_F3)) {
+            show_surface = !show_surface;
+        }
+
+        if (IsKeyPressed(KEY_F2)) {
+            sim.params.timing_overlay = !sim.params.timing_overlay;
+        }
+
+        double t = profile_start(perf, main_slot);
 
         // Update particles
+        if (IsKeyDown(KEY_SPACE)) {
+            SPH_TRACE_BEGIN(main_slot, "step");
+            simulation_step(&sim, GetFrameTime());
+            SPH_TRACE_END(main_slot, "step");
+            t = profile_lap(&timing, perf, main_slot, TIMING_STEP, t);
+            simulation_checkpoint(&sim);
+        }
 
-        pthread_barrier_wait(&main_barrier);
+        if (IsKeyPressed(KEY_F5)) {
+            checkpoint_write(sim.params.checkpoint_file != NULL
+                                 ? sim.params.checkpoint_file
+                                 : CHECKPOINT_DEFAULT_FILE,
+                             &sim);
+        }
 
         BeginDrawing();
         ClearBackground(DARKGRAY);
 
         if (debug) {
-            DrawPressureTexture(&particles, params);
+            SPH_TRACE_BEGIN(main_slot, "pressure_texture");
+            pressure_field_compute(&field, &sim);
+            DrawPressureTexture(&field, field_texture, field_pixels);
+            DrawPressureAccelerations(&sim);
+            SPH_TRACE_END(main_slot, "pressure_texture");
+            t = profile_lap(&timing, perf, main_slot, TIMING_PRESSURE_TEXTURE,
+                            t);
         }
 
         // Draw particles
-        for (int i = 0; i < particles.count; i++) {
-            Vector2 screen_position =
-                (Vector2){FROM_WORLD_TO_SCREEN(particles.items[i].position.x),
-                          FROM_WORLD_TO_SCREEN(particles.items[i].position.y)};
-            float screen_radius = FROM_WORLD_TO_SCREEN(params.particle_radius);
-            DrawCircleV(screen_position, screen_radius, GREEN);
+        SPH_TRACE_BEGIN(main_slot, "draw");
+        DrawParticles(&sim, &screen_positions);
+        if (show_surface) {
+            surface.iso = sim.params.rest_density * SURFACE_ISO_FRACTION;
+            surface_update(&surface, &sim);
+            DrawSurface(&surface);
+        }
+        SPH_TRACE_END(main_slot, "draw");
+        profile_lap(&timing, perf, main_slot, TIMING_DRAW, t);
+
+        // The workers are parked, so the table is ours
+        timing_commit(&timing);
+        if (sim.params.timing_overlay) {
+            DrawTimingOverlay(&timing, sim.threads);
         }
 
         // Draw FPS
         DrawText(
-            TextFormat("FPS: %d, particles: %d", GetFPS(), particles.count), 10,
+            TextFormat("FPS: %d, particles: %d", GetFPS(), particles->count), 10,
             10, 20, WHITE);
 
         // Draw parameters
-        DrawText(TextFormat("h: %f (left shift)", params.h), 10, 30, 20, WHITE);
-        DrawText(TextFormat("rho: %f (left ctrl)", params.rest_density), 10, 50,
+        DrawText(TextFormat("h: %f (left shift)", sim.params.h), 10, 30, 20, WHITE);
+        DrawText(TextFormat("rho: %f (left ctrl)", sim.params.rest_density), 10, 50,
                  20, WHITE);
-        DrawText(TextFormat("g: %f (right shift)", params.gravity), 10, 70, 20,
+        DrawText(TextFormat("g: %f (right shift)", sim.params.gravity), 10, 70, 20,
                  WHITE);
 
         EndDrawing();
-
-        pthread_barrier_wait(&main_barrier);
     }
 
-    for (int i = 0; i < params.threads; i++) {
-        pthread_join(threads[i], NULL);
+    UnloadTexture(field_texture);
+    command_queue_free(&commands);
+    surface_free(&surface);
+    free(screen_positions.items);
+    pressure_field_free(&field);
+    simulation_free(&sim);
+
+    timing_free(&timing);
+
+    if (perf != NULL) {
+        perf_report(perf, stdout);
+        perf_free(perf);
     }
 
-    pthread_barrier_destroy(&barrier);
-    pthread_barrier_destroy(&main_barrier);
+    if (params.trace != NULL) {
+        trace_dump(params.trace);
+    }
+    trace_free();
 
     CloseWindow();
 
@@ -0,0 +1,270 @@
+#include "raylib.h"
+#include "raylib_extensions.h"
+#include "sph.h"
+#include "trajectory.h"
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Plays back a trajectory recorded by a headless run
+//
+// Usage: replay run.traj
+//
+// Space plays and pauses, left and right step one frame (hold to scrub),
+// up and down jump by one second, home and end go to the first and last
+// frame and clicking on the timeline seeks to that frame.
+
+#define SCREEN_WIDTH 800
+#define SCREEN_HEIGHT 600
+#define TIMELINE_HEIGHT 20
+
+// Frames are decoded on a background thread into three buffers: the one
+// being decoded, the last decoded one and the one on screen. The render loop
+// only swaps pointers, so it never waits for a decode.
+struct replay {
+        struct trajectory_reader reader;
+        struct trajectory_cursor cursor;
+        struct trajectory_buffer buffers[3];
+        int decoding; // Owned by the decoder
+        int ready;    // Last decoded frame, swapped under the lock
+        int shown;    // Owned by the render loop
+        int fresh;    // Whether ready holds a frame that was not shown yet
+
+        pthread_mutex_t lock;
+        pthread_cond_t cond;
+        long requested; // Frame requested by the render loop
+        long decoded;   // Last frame the decoder worked on
+        int quit;
+};
+
+static void *replay_decoder(void *args) {
+    struct replay *replay = (struct replay *)args;
+
+    for (;;) {
+        pthread_mutex_lock(&replay->lock);
+        while (replay->requested == replay->decoded && !replay->quit) {
+            pthread_cond_wait(&replay->cond, &replay->lock);
+        }
+        if (replay->quit) {
+            pthread_mutex_unlock(&replay->lock);
+            break;
+        }
+        long frame = replay->requested;
+        replay->decoded = frame;
+        pthread_mutex_unlock(&replay->lock);
+
+        // Frames requested while decoding are skipped, only the latest one
+        // is decoded next
+        struct trajectory_buffer *buffer = &replay->buffers[replay->decoding];
+        if (trajectory_read_frame(&replay->reader, &replay->cursor, frame,
+                                  buffer) != 0) {
+            continue;
+        }
+
+        pthread_mutex_lock(&replay->lock);
+        int ready = replay->ready;
+        replay->ready = replay->decoding;
+        replay->decoding = ready;
+        replay->fresh = 1;
+        pthread_mutex_unlock(&replay->lock);
+    }
+
+    return NULL;
+}
+
+static void replay_request(struct replay *replay, long frame) {
+    pthread_mutex_lock(&replay->lock);
+    replay->requested = frame;
+    pthread_cond_signal(&replay->cond);
+    pthread_mutex_unlock(&replay->lock);
+}
+
+// Returns the buffer to draw, picking up the last decoded frame if any
+static struct trajectory_buffer *replay_acquire(struct replay *replay) {
+    pthread_mutex_lock(&replay->lock);
+    if (replay->fresh) {
+        int shown = replay->shown;
+        replay->shown = replay->ready;
+        replay->ready = shown;
+        replay->fresh = 0;
+    }
+    pthread_mutex_unlock(&replay->lock);
+
+    return &replay->buffers[replay->shown];
+}
+
+// Finds the last frame at or before a simulated time
+static long replay_find_time(const struct trajectory_reader *reader,
+                             double time) {
+    long low = 0;
+    long high = reader->frame_count - 1;
+    while (low < high) {
+        long mid = (low + high + 1) / 2;
+        if (reader->index[mid].time <= time) {
+            low = mid;
+        } else {
+            high = mid - 1;
+        }
+    }
+
+    return low;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s run.traj\n", argv[0]);
+        return 2;
+    }
+
+    struct replay replay = {0};
+    if (trajectory_reader_open(&replay.reader, argv[1]) != 0) {
+        return 1;
+    }
+    if (replay.reader.frame_count == 0) {
+        SPH_LOG_ERROR("Trajectory %s has no frames", argv[1]);
+        trajectory_reader_close(&replay.reader);
+        return 1;
+    }
+
+    const struct trajectory_reader *reader = &replay.reader;
+    long last = reader->frame_count - 1;
+    replay.cursor.frame = -1;
+    replay.decoding = 0;
+    replay.ready = 1;
+    replay.shown = 2;
+    replay.requested = 0;
+    replay.decoded = -1;
+    pthread_mutex_init(&replay.lock, NULL);
+    pthread_cond_init(&replay.cond, NULL);
+
+    pthread_t decoder;
+    pthread_create(&decoder, NULL, replay_decoder, &replay);
+
+    // Fit the world in the window above the timeline
+    float width = reader->header.width > 0.0f ? reader->header.width : 8.0f;
+    float height = reader->header.height > 0.0f ? reader->header.height : 6.0f;
+    float scale = fminf(SCREEN_WIDTH / width,
+                        (SCREEN_HEIGHT - TIMELINE_HEIGHT) / height);
+    float radius = reader->header.particle_radius > 0.0f
+                       ? reader->header.particle_radius
+                       : 0.05f;
+
+    InitWindow(SCREEN_WIDTH, SCREEN_HEIGHT, "Smoothed Particle Hydrodynamics");
+
+    SetTargetFPS(60);
+
+    Vector2 *positions = NULL;
+    int positions_capacity = 0;
+    long frame = 0;
+    int playing = 0;
+    while (!WindowShouldClose()) {
+        long target = frame;
+        if (IsKeyPressed(KEY_SPACE)) {
+            playing = !playing;
+        }
+        if (playing) {
+            target = target < last ? target + 1 : target;
+        }
+        if (IsKeyDown(KEY_RIGHT)) {
+            target++;
+        }
+        if (IsKeyDown(KEY_LEFT)) {
+            target--;
+        }
+        if (IsKeyPressed(KEY_UP)) {
+            target = replay_find_time(reader, reader->index[frame].time + 1.0);
+            target = target > frame ? target : frame + 1;
+        }
+        if (IsKeyPressed(KEY_DOWN)) {
+            target = replay_find_time(reader, reader->index[frame].time - 1.0);
+        }
+        if (IsKeyPressed(KEY_HOME)) {
+            target = 0;
+        }
+        if (IsKeyPressed(KEY_END)) {
+            target = last;
+        }
+
+        Vector2 mouse = GetMousePosition();
+        if (IsMouseButtonDown(MOUSE_LEFT_BUTTON) &&
+            mouse.y >= SCREEN_HEIGHT - TIMELINE_HEIGHT) {
+            target = (long)(mouse.x / SCREEN_WIDTH * last + 0.5f);
+        }
+
+        target = target < 0 ? 0 : target > last ? last : target;
+        if (target != frame) {
+            frame = target;
+            replay_request(&replay, frame);
+        }
+
+        struct trajectory_buffer *shown = replay_acquire(&replay);
+
+        BeginDrawing();
+        ClearBackground(DARKGRAY);
+
+        if (shown->count > positions_capacity) {
+            Vector2 *items = realloc(positions, shown->count * sizeof(Vector2));
+            if (items != NULL) {
+                positions = items;
+                positions_capacity = shown->count;
+            }
+        }
+        int drawn = shown->count < positions_capacity ? shown->count
+                                                      : positions_capacity;
+        for (int i = 0; i < drawn; i++) {
+            positions[i] = (Vector2){
+                shown->columns[CHECKPOINT_POSITION_X][i] * scale,
+                shown->columns[CHECKPOINT_POSITION_Y][i] * scale,
+            };
+        }
+        DrawParticlesBatch(positions, drawn, radius * scale, GREEN);
+
+        // Timeline, the keyframes are marked since seeking near them is the
+        // cheapest
+        int y = SCREEN_HEIGHT - TIMELINE_HEIGHT;
+        DrawRectangle(0, y, SCREEN_WIDTH, TIMELINE_HEIGHT, BLACK);
+        if (last > 0 && last < SCREEN_WIDTH) {
+            for (long f = 0; f <= last; f++) {
+                if (reader->index[f].flags & TRAJECTORY_KEYFRAME) {
+                    int x = (int)((float)f / last * (SCREEN_WIDTH - 1));
+                    DrawLine(x, y, x, y + TIMELINE_HEIGHT / 2, GRAY);
+                }
+            }
+        }
+        float progress = last > 0 ? (float)frame / last : 1.0f;
+        DrawRectangle(0, y + TIMELINE_HEIGHT / 2,
+                      (int)(progress * SCREEN_WIDTH), TIMELINE_HEIGHT / 2,
+                      GREEN);
+
+        DrawText(TextFormat("FPS: %d, particles: %d", GetFPS(), shown->count),
+                 10, 10, 20, WHITE);
+        DrawText(TextFormat("frame: %ld / %ld (%s)", frame, last,
+                            playing ? "playing" : "paused"),
+                 10, 30, 20, WHITE);
+        DrawText(TextFormat("step: %ld, time: %.3f s", shown->step,
+                            shown->time),
+                 10, 50, 20, WHITE);
+
+        EndDrawing();
+    }
+
+    pthread_mutex_lock(&replay.lock);
+    replay.quit = 1;
+    pthread_cond_signal(&replay.cond);
+    pthread_mutex_unlock(&replay.lock);
+    pthread_join(decoder, NULL);
+
+    CloseWindow();
+
+    free(positions);
+    for (int i = 0; i < 3; i++) {
+        trajectory_buffer_free(&replay.buffers[i]);
+    }
+    trajectory_cursor_free(&replay.cursor);
+    trajectory_reader_close(&replay.reader);
+    pthread_mutex_destroy(&replay.lock);
+    pthread_cond_destroy(&replay.cond);
+
+    return 0;
+}
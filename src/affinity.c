@@ -0,0 +1,344 @@
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include "affinity.h"
+#include "sph.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <linux/mempolicy.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Largest number of CPUs and NUMA nodes handled
+#define AFFINITY_MAX_CPUS 1024
+#define NUMA_MAX_NODES 1024
+
+// Parses a list of CPUs such as "0,2,4-7"
+//
+// Returns the number of CPUs or -1 if the list is invalid
+static int affinity_parse_list(const char *list, int *cpus, int capacity) {
+    int count = 0;
+    const char *c = list;
+    while (*c != '\0') {
+        char *end;
+        long first = strtol(c, &end, 10);
+        if (end == c || first < 0) {
+            return -1;
+        }
+        long last = first;
+        if (*end == '-') {
+            c = end + 1;
+            last = strtol(c, &end, 10);
+            if (end == c || last < first) {
+                return -1;
+            }
+        }
+        for (long cpu = first; cpu <= last && count < capacity; cpu++) {
+            cpus[count++] = (int)cpu;
+        }
+
+        c = end;
+        while (*c == ' ') {
+            c++;
+        }
+        if (*c == ',') {
+            c++;
+        } else if (*c != '\0') {
+            return -1;
+        }
+    }
+
+    return count;
+}
+
+#ifdef __linux__
+// Reads a number from a sysfs file
+//
+// Returns the number or -1 if the file cannot be read
+static int affinity_read_topology(int cpu, const char *name) {
+    char path[128];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/%s",
+             cpu, name);
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        return -1;
+    }
+    int value = -1;
+    if (fscanf(file, "%d", &value) != 1) {
+        value = -1;
+    }
+    fclose(file);
+
+    return value;
+}
+
+// Orders the CPUs so that consecutive ones are on different packages, and on
+// different cores of a package before sharing one
+static void affinity_scatter(int *cpus, int count) {
+    int *package = malloc(count * sizeof(int));
+    int *core = malloc(count * sizeof(int));
+    int *key = malloc(count * sizeof(int) * 3);
+    if (package == NULL || core == NULL || key == NULL) {
+        free(package);
+        free(core);
+        free(key);
+        return;
+    }
+
+    for (int i = 0; i < count; i++) {
+        package[i] = affinity_read_topology(cpus[i], "physical_package_id");
+        core[i] = affinity_read_topology(cpus[i], "core_id");
+    }
+
+    // Key of a CPU: its rank among the CPUs of its core, the rank of its
+    // core in its package and its package
+    for (int i = 0; i < count; i++) {
+        int sibling = 0;
+        int core_rank = 0;
+        for (int j = 0; j < i; j++) {
+            if (package[j] != package[i]) {
+                continue;
+            }
+            if (core[j] == core[i]) {
+                sibling++;
+                continue;
+            }
+            int first = 1;
+            for (int k = 0; k < j; k++) {
+                if (package[k] == package[j] && core[k] == core[j]) {
+                    first = 0;
+                    break;
+                }
+            }
+            core_rank += first;
+        }
+        key[3 * i] = sibling;
+        key[3 * i + 1] = core_rank;
+        key[3 * i + 2] = package[i];
+    }
+
+    // Insertion sort, there are few CPUs
+    for (int i = 1; i < count; i++) {
+        int cpu = cpus[i];
+        int k[3] = {key[3 * i], key[3 * i + 1], key[3 * i + 2]};
+        int j = i - 1;
+        while (j >= 0 &&
+               (key[3 * j] > k[0] ||
+                (key[3 * j] == k[0] && key[3 * j + 1] > k[1]) ||
+                (key[3 * j] == k[0] && key[3 * j + 1] == k[1] &&
+                 key[3 * j + 2] > k[2]))) {
+            cpus[j + 1] = cpus[j];
+            memcpy(&key[3 * (j + 1)], &key[3 * j], 3 * sizeof(int));
+            j--;
+        }
+        cpus[j + 1] = cpu;
+        memcpy(&key[3 * (j + 1)], k, 3 * sizeof(int));
+    }
+
+    free(package);
+    free(core);
+    free(key);
+}
+#endif
+
+// Assigns a CPU to every worker
+//
+// Arguments:
+// - affinity: "compact" fills the CPUs the process may run on in order,
+//   "scatter" spreads the workers over the packages and the cores first, a
+//   list such as "0,2,4-7" gives the CPUs of the workers in order, NULL or
+//   "none" leaves the workers unpinned. Workers wrap around the CPUs when
+//   there are more of them.
+// - workers: the number of workers
+// - cpus: the CPU of each worker, -1 for none
+//
+// Returns 0 on success or -1 if the affinity is invalid
+int affinity_plan(const char *affinity, int workers, int *cpus) {
+    for (int i = 0; i < workers; i++) {
+        cpus[i] = -1;
+    }
+    if (affinity == NULL || strcmp(affinity, "none") == 0) {
+        return 0;
+    }
+
+    int available[AFFINITY_MAX_CPUS];
+    int count = 0;
+    if (strcmp(affinity, "compact") == 0 || strcmp(affinity, "scatter") == 0) {
+#ifdef __linux__
+        cpu_set_t set;
+        if (sched_getaffinity(0, sizeof(set), &set) != 0) {
+            SPH_LOG_ERROR("Could not read the CPUs of the process");
+            return -1;
+        }
+        for (int cpu = 0; cpu < CPU_SETSIZE && count < AFFINITY_MAX_CPUS;
+             cpu++) {
+            if (CPU_ISSET(cpu, &set)) {
+                available[count++] = cpu;
+            }
+        }
+        if (strcmp(affinity, "scatter") == 0) {
+            affinity_scatter(available, count);
+        }
+#else
+        SPH_LOG_WARN("Thread affinity is only supported on Linux");
+        return 0;
+#endif
+    } else {
+        count = affinity_parse_list(affinity, available, AFFINITY_MAX_CPUS);
+        if (count <= 0) {
+            SPH_LOG_ERROR("Invalid affinity %s, expected none, compact, "
+                          "scatter or a list of CPUs",
+                          affinity);
+            return -1;
+        }
+    }
+
+    for (int i = 0; i < workers && count > 0; i++) {
+        cpus[i] = available[i % count];
+    }
+
+    return 0;
+}
+
+// Pins the calling thread to a CPU
+//
+// Returns 0 on success or -1 on failure
+int affinity_pin(int cpu) {
+#ifdef __linux__
+    if (cpu < 0 || cpu >= CPU_SETSIZE) {
+        return -1;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0 ? 0
+                                                                          : -1;
+#else
+    (void)cpu;
+    return -1;
+#endif
+}
+
+#ifdef __linux__
+// Mask of the nodes read from a sysfs list such as "0-1"
+static int numa_online_nodes(unsigned long *mask) {
+    memset(mask, 0, NUMA_MAX_NODES / 8);
+
+    FILE *file = fopen("/sys/devices/system/node/online", "r");
+    if (file == NULL) {
+        return -1;
+    }
+    char list[256];
+    char *line = fgets(list, sizeof(list), file);
+    fclose(file);
+    if (line == NULL) {
+        return -1;
+    }
+    list[strcspn(list, "\n")] = '\0';
+
+    int nodes[NUMA_MAX_NODES];
+    int count = affinity_parse_list(list, nodes, NUMA_MAX_NODES);
+    for (int i = 0; i < count; i++) {
+        if (nodes[i] < NUMA_MAX_NODES) {
+            mask[nodes[i] / (8 * sizeof(long))] |=
+                1ul << (nodes[i] % (8 * sizeof(long)));
+        }
+    }
+
+    return count > 0 ? 0 : -1;
+}
+
+// Mask of the node of the CPU the calling thread runs on
+static int numa_current_node(unsigned long *mask) {
+    memset(mask, 0, NUMA_MAX_NODES / 8);
+
+    unsigned int cpu, node;
+    if (syscall(SYS_getcpu, &cpu, &node, NULL) != 0 ||
+        node >= NUMA_MAX_NODES) {
+        return -1;
+    }
+    mask[node / (8 * sizeof(long))] |= 1ul << (node % (8 * sizeof(long)));
+
+    return 0;
+}
+
+// Applies a policy to the whole pages of a range, the partial pages at both
+// ends are left to the first touch
+static int numa_mbind(void *start, size_t size, int mode,
+                      const unsigned long *mask, unsigned flags) {
+    uintptr_t page = sysconf(_SC_PAGESIZE);
+    uintptr_t first = ((uintptr_t)start + page - 1) / page * page;
+    uintptr_t last = ((uintptr_t)start + size) / page * page;
+    if (last <= first) {
+        return 0;
+    }
+
+    // The kernel expects one more than the number of bits of the mask
+    return syscall(SYS_mbind, first, last - first, mode, mask,
+                   NUMA_MAX_NODES + 1, flags) == 0
+               ? 0
+               : -1;
+}
+#endif
+
+// Spreads the pages of a range over every node, round robin
+//
+// Returns 0 on success or -1 on failure
+int numa_interleave(void *start, size_t size) {
+#ifdef __linux__
+    unsigned long mask[NUMA_MAX_NODES / (8 * sizeof(long))];
+    if (numa_online_nodes(mask) != 0) {
+        return -1;
+    }
+    return numa_mbind(start, size, MPOL_INTERLEAVE, mask, 0);
+#else
+    (void)start;
+    (void)size;
+    return -1;
+#endif
+}
+
+// Moves the pages of a range to the node of the calling thread, which should
+// be pinned, and keeps the new pages there
+//
+// Returns 0 on success or -1 on failure
+int numa_bind_local(void *start, size_t size) {
+#ifdef __linux__
+    unsigned long mask[NUMA_MAX_NODES / (8 * sizeof(long))];
+    if (numa_current_node(mask) != 0) {
+        return -1;
+    }
+    return numa_mbind(start, size, MPOL_PREFERRED, mask, MPOL_MF_MOVE);
+#else
+    (void)start;
+    (void)size;
+    return -1;
+#endif
+}
+
+// Makes the node of the calling thread the preferred node of the memory it
+// allocates from now on
+//
+// Returns 0 on success or -1 on failure
+int numa_prefer_local(void) {
+#ifdef __linux__
+    unsigned long mask[NUMA_MAX_NODES / (8 * sizeof(long))];
+    if (numa_current_node(mask) != 0) {
+        return -1;
+    }
+    return syscall(SYS_set_mempolicy, MPOL_PREFERRED, mask,
+                   NUMA_MAX_NODES + 1) == 0
+               ? 0
+               : -1;
+#else
+    return -1;
+#endif
+}
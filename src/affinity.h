@@ -0,0 +1,27 @@
+#ifndef AFFINITY_H
+#define AFFINITY_H
+
+#include <stddef.h>
+
+// Placement of the pages of the particles on NUMA machines
+enum numa_policy {
+    NUMA_DEFAULT,    // Placed by the first touch of each worker
+    NUMA_INTERLEAVE, // Spread over every node
+    NUMA_LOCAL,      // Moved to the node of the worker that owns them
+};
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+int affinity_plan(const char *affinity, int workers, int *cpus);
+int affinity_pin(int cpu);
+int numa_interleave(void *start, size_t size);
+int numa_bind_local(void *start, size_t size);
+int numa_prefer_local(void);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif // AFFINITY_H
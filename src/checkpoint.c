@@ -0,0 +1,299 @@
+#include "simulation.h"
+#include "sph.h"
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Checkpoint file layout
+//
+// The file starts with a fixed size header followed by one column per
+// particle attribute. Every column is a float array aligned to
+// CHECKPOINT_ALIGNMENT bytes, so a mapped file can be used in place without
+// any parsing. All the values are stored in the byte order of the machine
+// that wrote the file, which is recorded in the header.
+
+static const char checkpoint_magic[8] = "SPHCKPT";
+
+static size_t checkpoint_align(size_t offset) {
+    return (offset + CHECKPOINT_ALIGNMENT - 1) & ~(size_t)(CHECKPOINT_ALIGNMENT - 1);
+}
+
+static void checkpoint_params_store(struct checkpoint_params *out,
+                                    const struct simulation_parameters *in) {
+    out->particle_count = in->particle_count;
+    out->pressure_type = in->pressure_type;
+    out->kernel_type = in->kernel_type;
+    out->gravity = in->gravity;
+    out->width = in->width;
+    out->height = in->height;
+    out->particle_radius = in->particle_radius;
+    out->particle_mass = in->particle_mass;
+    out->damping = in->damping;
+    out->rest_density = in->rest_density;
+    out->adiabatic_index = in->adiabatic_index;
+    out->speed_of_sound = in->speed_of_sound;
+    out->background_pressure = in->background_pressure;
+    out->pressure_multiplier = in->pressure_multiplier;
+    out->h = in->h;
+}
+
+static void checkpoint_params_load(struct simulation_parameters *out,
+                                   const struct checkpoint_params *in) {
+    out->particle_count = in->particle_count;
+    out->pressure_type = in->pressure_type;
+    out->kernel_type = in->kernel_type;
+    out->gravity = in->gravity;
+    out->width = in->width;
+    out->height = in->height;
+    out->particle_radius = in->particle_radius;
+    out->particle_mass = in->particle_mass;
+    out->damping = in->damping;
+    out->rest_density = in->rest_density;
+    out->adiabatic_index = in->adiabatic_index;
+    out->speed_of_sound = in->speed_of_sound;
+    out->background_pressure = in->background_pressure;
+    out->pressure_multiplier = in->pressure_multiplier;
+    out->h = in->h;
+}
+
+static float checkpoint_particle_value(const struct particle *p, int column) {
+    switch (column) {
+    case CHECKPOINT_POSITION_X:
+        return p->position.x;
+    case CHECKPOINT_POSITION_Y:
+        return p->position.y;
+    case CHECKPOINT_VELOCITY_X:
+        return p->velocity.x;
+    case CHECKPOINT_VELOCITY_Y:
+        return p->velocity.y;
+    case CHECKPOINT_DENSITY:
+        return p->density;
+    case CHECKPOINT_PRESSURE:
+        return p->pressure;
+    default:
+        return 0.0f;
+    }
+}
+
+// Writes the state of a simulation to a checkpoint file
+//
+// The file is written next to the destination and renamed over it, so an
+// interrupted write never corrupts the previous checkpoint. Must be called
+// while the workers are parked.
+//
+// Returns 0 on success and -1 on failure
+int checkpoint_write(const char *filename, const struct simulation *sim) {
+    const struct particle_array *particles = &sim->particles;
+    uint64_t count = particles->count > 0 ? (uint64_t)particles->count : 0;
+
+    struct checkpoint_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, checkpoint_magic, sizeof(header.magic));
+    header.version = CHECKPOINT_VERSION;
+    header.byte_order = CHECKPOINT_BYTE_ORDER;
+    header.header_size = sizeof(header);
+    header.step = sim->step;
+    header.time = sim->time;
+    header.count = count;
+    checkpoint_params_store(&header.params, &sim->params);
+
+    size_t offset = checkpoint_align(sizeof(header));
+    for (int c = 0; c < CHECKPOINT_COLUMN_COUNT; c++) {
+        header.columns[c] = offset;
+        offset = checkpoint_align(offset + count * sizeof(float));
+    }
+    header.file_size = offset;
+
+    char temporary[4096];
+    snprintf(temporary, sizeof(temporary), "%s.tmp", filename);
+    FILE *file = fopen(temporary, "wb");
+    if (file == NULL) {
+        SPH_LOG_ERROR("Could not open checkpoint %s", temporary);
+        return -1;
+    }
+
+    float *column = malloc(count > 0 ? count * sizeof(float) : 1);
+    if (column == NULL) {
+        SPH_LOG_ERROR("Could not allocate memory for the checkpoint");
+        fclose(file);
+        return -1;
+    }
+
+    static const char zeros[CHECKPOINT_ALIGNMENT] = {0};
+    int ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    size_t written = sizeof(header);
+    for (int c = 0; c < CHECKPOINT_COLUMN_COUNT && ok; c++) {
+        ok = fwrite(zeros, 1, header.columns[c] - written, file) ==
+             header.columns[c] - written;
+
+        for (uint64_t i = 0; i < count; i++) {
+            column[i] = checkpoint_particle_value(&particles->items[i], c);
+        }
+        ok = ok && fwrite(column, sizeof(float), count, file) == count;
+        written = header.columns[c] + count * sizeof(float);
+    }
+    ok = ok && fwrite(zeros, 1, header.file_size - written, file) ==
+                   header.file_size - written;
+    free(column);
+
+    ok = fclose(file) == 0 && ok;
+    if (!ok || rename(temporary, filename) != 0) {
+        SPH_LOG_ERROR("Could not write checkpoint %s", filename);
+        remove(temporary);
+        return -1;
+    }
+
+    return 0;
+}
+
+// Maps a checkpoint file in memory and validates its header
+//
+// The columns of the view point straight into the mapping.
+//
+// Returns 0 on success and -1 if the file is missing or invalid
+int checkpoint_map(const char *filename, struct checkpoint_view *view) {
+    memset(view, 0, sizeof(*view));
+
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        SPH_LOG_ERROR("Could not open checkpoint %s", filename);
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(struct checkpoint_header)) {
+        SPH_LOG_ERROR("Checkpoint %s is truncated", filename);
+        close(fd);
+        return -1;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        SPH_LOG_ERROR("Could not map checkpoint %s", filename);
+        return -1;
+    }
+
+    const struct checkpoint_header *header = map;
+    const char *error = NULL;
+    if (memcmp(header->magic, checkpoint_magic, sizeof(header->magic)) != 0) {
+        error = "not a checkpoint";
+    } else if (header->byte_order != CHECKPOINT_BYTE_ORDER) {
+        error = "written with another byte order";
+    } else if (header->version != CHECKPOINT_VERSION ||
+               header->header_size != sizeof(struct checkpoint_header)) {
+        error = "unsupported version";
+    } else if (header->file_size > (uint64_t)st.st_size) {
+        error = "truncated";
+    } else if (header->count > INT_MAX) {
+        error = "too many particles";
+    }
+
+    // Written so that no sum can wrap around on a crafted header
+    for (int c = 0; c < CHECKPOINT_COLUMN_COUNT && error == NULL; c++) {
+        if (header->columns[c] % CHECKPOINT_ALIGNMENT != 0 ||
+            header->columns[c] > header->file_size ||
+            header->count > (header->file_size - header->columns[c]) /
+                                sizeof(float)) {
+            error = "corrupted column table";
+        }
+        view->columns[c] = (const float *)((const char *)map + header->columns[c]);
+    }
+
+    if (error != NULL) {
+        SPH_LOG_ERROR("Checkpoint %s: %s", filename, error);
+        munmap(map, st.st_size);
+        memset(view, 0, sizeof(*view));
+        return -1;
+    }
+
+    view->header = header;
+    view->map = map;
+    view->size = st.st_size;
+
+    return 0;
+}
+
+void checkpoint_unmap(struct checkpoint_view *view) {
+    if (view->map != NULL) {
+        munmap(view->map, view->size);
+    }
+    memset(view, 0, sizeof(*view));
+}
+
+// Restores the particles, the step and the time of a simulation from a
+// checkpoint
+//
+// Must be called while the workers are parked.
+//
+// Returns 0 on success and -1 on failure
+int checkpoint_restore(const struct checkpoint_view *view,
+                       struct simulation *sim) {
+    uint64_t count = view->header->count;
+    struct particle_array *particles = &sim->particles;
+
+    if (count > INT_MAX) {
+        SPH_LOG_ERROR("Too many particles in the checkpoint");
+        return -1;
+    }
+
+    if (particle_pool_resize(&sim->pool, count) != 0) {
+        return -1;
+    }
+
+    for (uint64_t i = 0; i < count; i++) {
+        struct particle *p = &particles->items[i];
+        p->position.x = view->columns[CHECKPOINT_POSITION_X][i];
+        p->position.y = view->columns[CHECKPOINT_POSITION_Y][i];
+        p->velocity.x = view->columns[CHECKPOINT_VELOCITY_X][i];
+        p->velocity.y = view->columns[CHECKPOINT_VELOCITY_Y][i];
+        p->density = view->columns[CHECKPOINT_DENSITY][i];
+        p->pressure = view->columns[CHECKPOINT_PRESSURE][i];
+    }
+    particles->count = count;
+
+    checkpoint_params_load(&sim->params, &view->header->params);
+    sim->step = view->header->step;
+    sim->time = view->header->time;
+
+    return 0;
+}
+
+// Maps a checkpoint, restores a simulation from it and unmaps it
+int simulation_restore(struct simulation *sim, const char *filename) {
+    struct checkpoint_view view;
+    if (checkpoint_map(filename, &view) != 0) {
+        return -1;
+    }
+
+    int error = checkpoint_restore(&view, sim);
+    checkpoint_unmap(&view);
+
+    if (error == 0) {
+        SPH_LOG_INFO("Restored %d particles at step %ld from %s",
+                     sim->particles.count, sim->step, filename);
+    }
+
+    return error;
+}
+
+// Writes a checkpoint when the current step is a multiple of the checkpoint
+// period of the parameters
+//
+// Returns 0 when nothing had to be written or on success and -1 on failure
+int simulation_checkpoint(struct simulation *sim) {
+    int every = sim->params.checkpoint_every;
+    if (every <= 0 || sim->step == 0 || sim->step % every != 0) {
+        return 0;
+    }
+
+    const char *filename = sim->params.checkpoint_file != NULL
+                               ? sim->params.checkpoint_file
+                               : CHECKPOINT_DEFAULT_FILE;
+    return checkpoint_write(filename, sim);
+}
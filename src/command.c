@@ -0,0 +1,192 @@
+#include "command.h"
+#include <stdlib.h>
+
+// Initializes an empty queue
+//
+// Arguments:
+// - queue: the queue to initialize
+// - capacity: the number of commands that can be queued, must be a power of
+//   two
+//
+// Returns 0 on success or -1 on failure
+int command_queue_init(struct command_queue *queue, size_t capacity) {
+    if (capacity == 0 || (capacity & (capacity - 1)) != 0) {
+        SPH_LOG_ERROR("Command queue capacity %zu is not a power of two",
+                      capacity);
+        return -1;
+    }
+
+    queue->slots = malloc(capacity * sizeof(struct command_slot));
+    queue->batch = malloc(capacity * sizeof(struct command));
+    if (queue->slots == NULL || queue->batch == NULL) {
+        SPH_LOG_ERROR("Could not allocate a queue of %zu commands", capacity);
+        free(queue->slots);
+        free(queue->batch);
+        return -1;
+    }
+
+    for (size_t i = 0; i < capacity; i++) {
+        atomic_init(&queue->slots[i].sequence, i);
+    }
+    queue->mask = capacity - 1;
+    queue->tail = 0;
+    atomic_init(&queue->head, 0);
+
+    return 0;
+}
+
+// Queues a command, only one thread may push
+//
+// Returns 0 on success or -1 if the queue is full, in which case the command
+// is dropped
+int command_queue_push(struct command_queue *queue,
+                       const struct command *command) {
+    size_t position = queue->tail;
+    struct command_slot *slot = &queue->slots[position & queue->mask];
+
+    // The slot is free once the consumer of the previous lap released it
+    if (atomic_load_explicit(&slot->sequence, memory_order_acquire) !=
+        position) {
+        return -1;
+    }
+
+    slot->command = *command;
+    atomic_store_explicit(&slot->sequence, position + 1, memory_order_release);
+    queue->tail = position + 1;
+
+    return 0;
+}
+
+// Takes the oldest command, any number of threads may pop
+//
+// Returns 1 if a command was taken or 0 if the queue is empty
+int command_queue_pop(struct command_queue *queue, struct command *command) {
+    size_t position = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    for (;;) {
+        struct command_slot *slot = &queue->slots[position & queue->mask];
+        size_t sequence =
+            atomic_load_explicit(&slot->sequence, memory_order_acquire);
+        ptrdiff_t ready = (ptrdiff_t)(sequence - (position + 1));
+
+        if (ready < 0) {
+            return 0;
+        }
+        if (ready > 0) {
+            // Another consumer took this position
+            position = atomic_load_explicit(&queue->head, memory_order_relaxed);
+            continue;
+        }
+        if (atomic_compare_exchange_weak_explicit(
+                &queue->head, &position, position + 1, memory_order_relaxed,
+                memory_order_relaxed)) {
+            *command = slot->command;
+
+            // Hands the slot back to the producer for its next lap
+            atomic_store_explicit(&slot->sequence, position + queue->mask + 1,
+                                  memory_order_release);
+            return 1;
+        }
+    }
+}
+
+static float *command_parameter(struct simulation_parameters *params,
+                                enum command_parameter parameter) {
+    switch (parameter) {
+    case COMMAND_PARAMETER_H:
+        return &params->h;
+    case COMMAND_PARAMETER_REST_DENSITY:
+        return &params->rest_density;
+    case COMMAND_PARAMETER_GRAVITY:
+        return &params->gravity;
+    default:
+        return NULL;
+    }
+}
+
+// Removes the particles within a radius of a position, they leave holes
+// until the pool is compacted
+static void command_delete(struct simulation *sim, Vector2 position,
+                           float radius) {
+    struct particle_array *particles = &sim->particles;
+    float radius_squared = radius * radius;
+    for (int i = 0; i < particles->count; i++) {
+        Vector2 d = {particles->items[i].position.x - position.x,
+                     particles->items[i].position.y - position.y};
+        if (d.x * d.x + d.y * d.y <= radius_squared) {
+            particle_pool_remove(&sim->pool, i);
+        }
+    }
+}
+
+// Applies every queued command in the order it was pushed
+//
+// The commands are popped into a batch first, so the pages of the particles
+// are committed at most once for all the spawns of the batch. Removed
+// particles leave holes that the following spawns fill, and the pool is
+// compacted once the batch is applied. Must only be called while the
+// workers are parked, between two steps.
+//
+// Arguments:
+// - queue: the queue to drain
+// - sim: the simulation to modify
+//
+// Returns the number of commands applied
+int command_queue_apply(struct command_queue *queue, struct simulation *sim) {
+    struct particle_array *particles = &sim->particles;
+
+    int count = 0;
+    int spawns = 0;
+    while (count <= (int)queue->mask &&
+           command_queue_pop(queue, &queue->batch[count])) {
+        spawns += queue->batch[count].type == COMMAND_SPAWN;
+        count++;
+    }
+    if (count == 0) {
+        return 0;
+    }
+
+    // On failure every spawn tries again on its own below
+    particle_pool_reserve(&sim->pool, particles->count + spawns);
+    for (int i = 0; i < count; i++) {
+        struct command *command = &queue->batch[i];
+        switch (command->type) {
+        case COMMAND_SPAWN:
+            particle_pool_add(&sim->pool, &command->spawn);
+            break;
+        case COMMAND_DELETE:
+            command_delete(sim, command->remove.position,
+                           command->remove.radius);
+            break;
+        case COMMAND_RESET:
+            if (particle_pool_resize(&sim->pool, sim->params.particle_count) ==
+                0) {
+                particles_init_rand(particles, sim->params.width,
+                                    sim->params.height);
+            }
+            break;
+        case COMMAND_ADJUST: {
+            float *value =
+                command_parameter(&sim->params, command->adjust.parameter);
+            if (value != NULL) {
+                *value += command->adjust.delta;
+                *value = *value < command->adjust.min   ? command->adjust.min
+                         : *value > command->adjust.max ? command->adjust.max
+                                                        : *value;
+            }
+            break;
+        }
+        }
+    }
+    if (particle_pool_compact(&sim->pool) > 0) {
+        sim->reorders++;
+    }
+
+    return count;
+}
+
+void command_queue_free(struct command_queue *queue) {
+    free(queue->slots);
+    free(queue->batch);
+    queue->slots = NULL;
+    queue->batch = NULL;
+}
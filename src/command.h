@@ -0,0 +1,80 @@
+#ifndef COMMAND_H
+#define COMMAND_H
+
+#include "simulation.h"
+#include <stdatomic.h>
+#include <stddef.h>
+
+// Default number of commands that can wait for the next step (must be a
+// power of two)
+#define COMMAND_DEFAULT_CAPACITY 1024
+
+enum command_type {
+    COMMAND_SPAWN,  // Add a particle
+    COMMAND_DELETE, // Remove the particles within a radius of a position
+    COMMAND_RESET,  // Scatter the initial number of particles again
+    COMMAND_ADJUST, // Add to a parameter and clamp it
+};
+
+enum command_parameter {
+    COMMAND_PARAMETER_H,
+    COMMAND_PARAMETER_REST_DENSITY,
+    COMMAND_PARAMETER_GRAVITY,
+};
+
+struct command {
+        enum command_type type;
+        union {
+                struct particle spawn;
+                struct {
+                        Vector2 position; // (in meters)
+                        float radius;     // (in meters)
+                } remove;
+                struct {
+                        enum command_parameter parameter;
+                        float delta;
+                        float min;
+                        float max;
+                } adjust;
+        };
+};
+
+struct command_slot {
+        atomic_size_t sequence; // Position the slot can be written or read at
+        struct command command;
+};
+
+// Bounded single producer, multiple consumer queue of commands
+//
+// The UI thread pushes commands while the workers may be running a step,
+// they are popped and applied in a batch between two steps. Every slot
+// carries a sequence number that tells the producer when it is free and the
+// consumers when it holds a command, so neither side takes a lock and a push
+// never allocates. Consumers claim a position by moving the head with a
+// compare and swap.
+struct command_queue {
+        struct command_slot *slots;
+        size_t mask; // Capacity minus one
+
+        _Alignas(64) size_t tail;          // Owned by the producer
+        _Alignas(64) atomic_size_t head;   // Shared by the consumers
+
+        struct command *batch; // Commands popped by the last apply, scratch
+};
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+int command_queue_init(struct command_queue *queue, size_t capacity);
+int command_queue_push(struct command_queue *queue,
+                       const struct command *command);
+int command_queue_pop(struct command_queue *queue, struct command *command);
+int command_queue_apply(struct command_queue *queue, struct simulation *sim);
+void command_queue_free(struct command_queue *queue);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif // COMMAND_H
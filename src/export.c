@@ -0,0 +1,467 @@
+#include "sph.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Below this many particles per thread the threads cost more than the
+// formatting
+#define EXPORT_MIN_CHUNK 4096
+
+// Upper bound of the length of a formatted CSV line
+#define EXPORT_CSV_LINE 128
+
+// The arrays of the appended data section of a VTU file, in order
+enum export_vtu_array {
+    EXPORT_VTU_POINTS,       // Float32 x3
+    EXPORT_VTU_VELOCITY,     // Float32 x3
+    EXPORT_VTU_DENSITY,      // Float32
+    EXPORT_VTU_PRESSURE,     // Float32
+    EXPORT_VTU_CONNECTIVITY, // Int32
+    EXPORT_VTU_OFFSETS,      // Int32
+    EXPORT_VTU_TYPES,        // UInt8
+    EXPORT_VTU_ARRAY_COUNT,
+};
+
+static const size_t export_vtu_item_size[EXPORT_VTU_ARRAY_COUNT] = {
+    3 * sizeof(float), 3 * sizeof(float), sizeof(float), sizeof(float),
+    sizeof(int32_t),   sizeof(int32_t),   sizeof(uint8_t),
+};
+
+// VTK_VERTEX, one cell per particle so that every reader shows the points
+#define EXPORT_VTK_VERTEX 1
+
+struct export_chunk {
+        const struct particle_array *particles;
+        int start;
+        int end;
+
+        // VTU
+        int fd;
+        const uint64_t *offsets; // Offset of the data of each array
+
+        // CSV
+        char *data;
+        size_t size;
+
+        int error;
+};
+
+static int export_is_little_endian(void) {
+    uint16_t value = 1;
+    return *(uint8_t *)&value == 1;
+}
+
+static int export_thread_count(int count, int threads) {
+    int useful = count / EXPORT_MIN_CHUNK;
+    if (threads > useful) {
+        threads = useful;
+    }
+    return threads > 1 ? threads : 1;
+}
+
+static int export_pwrite(int fd, const void *data, size_t size,
+                         uint64_t offset) {
+    const char *bytes = data;
+    while (size > 0) {
+        ssize_t written = pwrite(fd, bytes, size, offset);
+        if (written <= 0) {
+            return -1;
+        }
+        bytes += written;
+        size -= written;
+        offset += written;
+    }
+    return 0;
+}
+
+// Writes the slice of every array of a chunk at its final place in the file
+static void *export_vtu_chunk(void *args) {
+    struct export_chunk *chunk = (struct export_chunk *)args;
+    const struct particle *items = chunk->particles->items;
+    int count = chunk->end - chunk->start;
+    if (count <= 0) {
+        return NULL;
+    }
+
+    void *buffer = malloc(count * 3 * sizeof(float));
+    if (buffer == NULL) {
+        chunk->error = 1;
+        return NULL;
+    }
+
+    for (int a = 0; a < EXPORT_VTU_ARRAY_COUNT && !chunk->error; a++) {
+        float *floats = buffer;
+        int32_t *ints = buffer;
+        uint8_t *bytes = buffer;
+        for (int i = 0; i < count; i++) {
+            const struct particle *p = &items[chunk->start + i];
+            switch (a) {
+            case EXPORT_VTU_POINTS:
+                floats[3 * i + 0] = p->position.x;
+                floats[3 * i + 1] = p->position.y;
+                floats[3 * i + 2] = 0.0f;
+                break;
+            case EXPORT_VTU_VELOCITY:
+                floats[3 * i + 0] = p->velocity.x;
+                floats[3 * i + 1] = p->velocity.y;
+                floats[3 * i + 2] = 0.0f;
+                break;
+            case EXPORT_VTU_DENSITY:
+                floats[i] = p->density;
+                break;
+            case EXPORT_VTU_PRESSURE:
+                floats[i] = p->pressure;
+                break;
+            case EXPORT_VTU_CONNECTIVITY:
+                ints[i] = chunk->start + i;
+                break;
+            case EXPORT_VTU_OFFSETS:
+                ints[i] = chunk->start + i + 1;
+                break;
+            case EXPORT_VTU_TYPES:
+                bytes[i] = EXPORT_VTK_VERTEX;
+                break;
+            }
+        }
+
+        size_t item = export_vtu_item_size[a];
+        uint64_t offset = chunk->offsets[a] + (uint64_t)chunk->start * item;
+        if (export_pwrite(chunk->fd, buffer, count * item, offset) != 0) {
+            chunk->error = 1;
+        }
+    }
+
+    free(buffer);
+    return NULL;
+}
+
+// Formats the lines of a chunk into its own buffer
+static void *export_csv_chunk(void *args) {
+    struct export_chunk *chunk = (struct export_chunk *)args;
+    const struct particle *items = chunk->particles->items;
+    size_t capacity = (size_t)(chunk->end - chunk->start) * EXPORT_CSV_LINE + 1;
+
+    chunk->data = malloc(capacity);
+    if (chunk->data == NULL) {
+        chunk->error = 1;
+        return NULL;
+    }
+
+    size_t size = 0;
+    for (int i = chunk->start; i < chunk->end; i++) {
+        const struct particle *p = &items[i];
+        size += snprintf(chunk->data + size, capacity - size,
+                         "%.9g,%.9g,%.9g,%.9g,%.9g,%.9g\n", p->position.x,
+                         p->position.y, p->velocity.x, p->velocity.y,
+                         p->density, p->pressure);
+    }
+    chunk->size = size;
+
+    return NULL;
+}
+
+// Runs a chunk function on ranges of the particles, the last chunk runs on
+// the calling thread
+static int export_run_chunks(struct export_chunk *chunks, int threads,
+                             void *(*function)(void *)) {
+    pthread_t workers[threads];
+    int started[threads];
+    for (int t = 0; t < threads - 1; t++) {
+        started[t] =
+            pthread_create(&workers[t], NULL, function, &chunks[t]) == 0;
+        if (!started[t]) {
+            function(&chunks[t]);
+        }
+    }
+    function(&chunks[threads - 1]);
+    for (int t = 0; t < threads - 1; t++) {
+        if (started[t]) {
+            pthread_join(workers[t], NULL);
+        }
+    }
+
+    int error = 0;
+    for (int t = 0; t < threads; t++) {
+        error |= chunks[t].error;
+    }
+    return error ? -1 : 0;
+}
+
+static void export_split(struct export_chunk *chunks, int threads,
+                         const struct particle_array *particles) {
+    for (int t = 0; t < threads; t++) {
+        chunks[t] = (struct export_chunk){
+            .particles = particles,
+            .start = (int)((long)t * particles->count / threads),
+            .end = (int)((long)(t + 1) * particles->count / threads),
+        };
+    }
+}
+
+static int export_vtu(const struct particle_array *particles,
+                      const char *filename, int threads) {
+    static const char *names[EXPORT_VTU_ARRAY_COUNT] = {
+        "Points", "velocity", "density", "pressure",
+        "connectivity", "offsets", "types",
+    };
+    static const char *types[EXPORT_VTU_ARRAY_COUNT] = {
+        "Float32", "Float32", "Float32", "Float32", "Int32", "Int32", "UInt8",
+    };
+    static const int components[EXPORT_VTU_ARRAY_COUNT] = {3, 3, 1, 1,
+                                                           1, 1, 1};
+
+    int count = particles->count > 0 ? particles->count : 0;
+
+    // Every array is preceded by its size in bytes, so the layout of the
+    // appended data is known before any particle is formatted
+    uint64_t appended[EXPORT_VTU_ARRAY_COUNT];
+    uint64_t sizes[EXPORT_VTU_ARRAY_COUNT];
+    uint64_t position = 0;
+    for (int a = 0; a < EXPORT_VTU_ARRAY_COUNT; a++) {
+        sizes[a] = (uint64_t)count * export_vtu_item_size[a];
+        appended[a] = position;
+        position += sizeof(uint64_t) + sizes[a];
+    }
+
+    char header[4096];
+    int length = snprintf(
+        header, sizeof(header),
+        "<?xml version=\"1.0\"?>\n"
+        "<VTKFile type=\"UnstructuredGrid\" version=\"1.0\" "
+        "byte_order=\"%s\" header_type=\"UInt64\">\n"
+        "  <UnstructuredGrid>\n"
+        "    <Piece NumberOfPoints=\"%d\" NumberOfCells=\"%d\">\n",
+        export_is_little_endian() ? "LittleEndian" : "BigEndian", count,
+        count);
+    for (int a = 0; a < EXPORT_VTU_ARRAY_COUNT; a++) {
+        const char *open = NULL;
+        const char *close = NULL;
+        if (a == EXPORT_VTU_POINTS) {
+            open = "      <Points>\n";
+            close = "      </Points>\n";
+        } else if (a == EXPORT_VTU_VELOCITY) {
+            open = "      <PointData Scalars=\"density\" "
+                   "Vectors=\"velocity\">\n";
+        } else if (a == EXPORT_VTU_PRESSURE) {
+            close = "      </PointData>\n";
+        } else if (a == EXPORT_VTU_CONNECTIVITY) {
+            open = "      <Cells>\n";
+        } else if (a == EXPORT_VTU_TYPES) {
+            close = "      </Cells>\n";
+        }
+
+        length += snprintf(header + length, sizeof(header) - length,
+                           "%s        <DataArray type=\"%s\" Name=\"%s\" "
+                           "NumberOfComponents=\"%d\" format=\"appended\" "
+                           "offset=\"%llu\"/>\n%s",
+                           open != NULL ? open : "", types[a], names[a],
+                           components[a], (unsigned long long)appended[a],
+                           close != NULL ? close : "");
+    }
+    length += snprintf(header + length, sizeof(header) - length,
+                       "    </Piece>\n"
+                       "  </UnstructuredGrid>\n"
+                       "  <AppendedData encoding=\"raw\">\n"
+                       "   _");
+
+    const char *footer = "\n  </AppendedData>\n</VTKFile>\n";
+    uint64_t data_start = length;
+    uint64_t total = data_start + position + strlen(footer);
+
+    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        SPH_LOG_ERROR("Could not open %s", filename);
+        return -1;
+    }
+
+    int error = ftruncate(fd, total) != 0 ||
+                export_pwrite(fd, header, length, 0) != 0 ||
+                export_pwrite(fd, footer, strlen(footer),
+                              data_start + position) != 0;
+
+    uint64_t offsets[EXPORT_VTU_ARRAY_COUNT];
+    for (int a = 0; a < EXPORT_VTU_ARRAY_COUNT && !error; a++) {
+        uint64_t at = data_start + appended[a];
+        error = export_pwrite(fd, &sizes[a], sizeof(uint64_t), at) != 0;
+        offsets[a] = at + sizeof(uint64_t);
+    }
+
+    if (!error) {
+        threads = export_thread_count(count, threads);
+        struct export_chunk chunks[threads];
+        export_split(chunks, threads, particles);
+        for (int t = 0; t < threads; t++) {
+            chunks[t].fd = fd;
+            chunks[t].offsets = offsets;
+        }
+        error = export_run_chunks(chunks, threads, export_vtu_chunk) != 0;
+    }
+
+    error = close(fd) != 0 || error;
+    if (error) {
+        SPH_LOG_ERROR("Could not write %s", filename);
+        return -1;
+    }
+
+    return 0;
+}
+
+static int export_csv(const struct particle_array *particles,
+                      const char *filename, int threads) {
+    int count = particles->count > 0 ? particles->count : 0;
+
+    FILE *file = fopen(filename, "w");
+    if (file == NULL) {
+        SPH_LOG_ERROR("Could not open %s", filename);
+        return -1;
+    }
+    int error = fputs("x,y,vx,vy,density,pressure\n", file) < 0;
+
+    threads = export_thread_count(count, threads);
+    struct export_chunk chunks[threads];
+    export_split(chunks, threads, particles);
+    error = export_run_chunks(chunks, threads, export_csv_chunk) != 0 || error;
+
+    for (int t = 0; t < threads; t++) {
+        if (!error && fwrite(chunks[t].data, 1, chunks[t].size, file) !=
+                          chunks[t].size) {
+            error = 1;
+        }
+        free(chunks[t].data);
+    }
+
+    error = fclose(file) != 0 || error;
+    if (error) {
+        SPH_LOG_ERROR("Could not write %s", filename);
+        return -1;
+    }
+
+    return 0;
+}
+
+// Writes the particles to a file that ParaView can read
+//
+// VTU files hold the particles as vertices with binary appended data, CSV
+// files hold one particle per line. Large frames are formatted by several
+// threads, each one working on its own range of particles.
+//
+// Arguments:
+// - particles: the particles to export
+// - filename: the file to write, truncated if it exists
+// - format: EXPORT_VTU or EXPORT_CSV
+// - threads: the maximum number of threads to use
+//
+// Returns 0 on success and -1 on failure
+int particles_export(const struct particle_array *particles,
+                     const char *filename, enum export_format format,
+                     int threads) {
+    switch (format) {
+    case EXPORT_VTU:
+        return export_vtu(particles, filename, threads);
+    case EXPORT_CSV:
+        return export_csv(particles, filename, threads);
+    }
+
+    return -1;
+}
+
+static const char *export_extension(enum export_format format) {
+    return format == EXPORT_VTU ? "vtu" : "csv";
+}
+
+// Starts a time series of exported frames
+//
+// The frames are named <prefix>_<frame>.<extension>. For VTU series the
+// <prefix>.pvd index is rewritten after every frame, so it stays valid if
+// the run is interrupted. CSV series have no index, ParaView groups the
+// numbered files on its own.
+//
+// Returns 0 on success and -1 on failure
+int export_series_init(struct export_series *series, const char *prefix,
+                       enum export_format format, int threads) {
+    memset(series, 0, sizeof(*series));
+    series->prefix = strdup(prefix);
+    if (series->prefix == NULL) {
+        SPH_LOG_ERROR("Could not allocate memory for the export series");
+        return -1;
+    }
+    series->format = format;
+    series->threads = threads;
+
+    return 0;
+}
+
+static int export_series_index(struct export_series *series) {
+    char filename[4096];
+    snprintf(filename, sizeof(filename), "%s.pvd", series->prefix);
+
+    // The datasets are referenced relative to the index
+    const char *name = strrchr(series->prefix, '/');
+    name = name != NULL ? name + 1 : series->prefix;
+
+    FILE *file = fopen(filename, "w");
+    if (file == NULL) {
+        SPH_LOG_ERROR("Could not open %s", filename);
+        return -1;
+    }
+
+    fprintf(file, "<?xml version=\"1.0\"?>\n"
+                  "<VTKFile type=\"Collection\" version=\"1.0\">\n"
+                  "  <Collection>\n");
+    for (int f = 0; f < series->frame_count; f++) {
+        fprintf(file,
+                "    <DataSet timestep=\"%.9g\" part=\"0\" "
+                "file=\"%s_%06d.%s\"/>\n",
+                series->times[f], name, f, export_extension(series->format));
+    }
+    fprintf(file, "  </Collection>\n"
+                  "</VTKFile>\n");
+
+    if (fclose(file) != 0) {
+        SPH_LOG_ERROR("Could not write %s", filename);
+        return -1;
+    }
+
+    return 0;
+}
+
+// Exports one frame of a time series
+//
+// Returns 0 on success and -1 on failure
+int export_series_write(struct export_series *series,
+                        const struct particle_array *particles, double time) {
+    if (series->frame_count == series->capacity) {
+        int capacity = series->capacity > 0 ? series->capacity * 2 : 64;
+        double *times = realloc(series->times, capacity * sizeof(double));
+        if (times == NULL) {
+            SPH_LOG_ERROR("Could not allocate memory for the export series");
+            return -1;
+        }
+        series->times = times;
+        series->capacity = capacity;
+    }
+
+    char filename[4096];
+    snprintf(filename, sizeof(filename), "%s_%06d.%s", series->prefix,
+             series->frame_count, export_extension(series->format));
+    if (particles_export(particles, filename, series->format,
+                         series->threads) != 0) {
+        return -1;
+    }
+    series->times[series->frame_count++] = time;
+
+    if (series->format == EXPORT_VTU) {
+        return export_series_index(series);
+    }
+
+    return 0;
+}
+
+void export_series_free(struct export_series *series) {
+    free(series->prefix);
+    free(series->times);
+    memset(series, 0, sizeof(*series));
+}
@@ -119,3 +119,96 @@ float kernel_function_derivative(float x, float h, enum kernel_type type) {
 
     return 0.0f;
 }
+
+// Computes the constants of a kernel function for a smoothing length
+//
+// Arguments:
+// - kernel: the coefficients to fill
+// - h: the smoothing length (in meters)
+// - type: the type of kernel function
+void kernel_coefficients_init(struct kernel_coefficients *kernel, float h,
+                              enum kernel_type type) {
+    kernel->type = type;
+    kernel->h = h;
+    kernel->h2 = h * h;
+
+    // The same expressions as the kernel functions, so that both give the
+    // same results
+    switch (type) {
+    case GAUSSIAN_KERNEL:
+        kernel->volume = 1.0f / (h * sqrtf(M_PI));
+        kernel->slope = 0.0f;
+        break;
+    case CUBIC_KERNEL:
+        kernel->volume = M_PI * powf(h, 8) / 4.0f;
+        kernel->slope = -24.0 / (M_PI * powf(h, 8));
+        break;
+    case LINEAR_KERNEL:
+        kernel->volume = (M_PI * powf(h, 4)) / 6.0f;
+        kernel->slope = -12.0f / (M_PI * powf(h, 4));
+        break;
+    default:
+        SPH_LOG_ERROR("Unknown kernel type %d", type);
+        kernel->volume = 0.0f;
+        kernel->slope = 0.0f;
+        break;
+    }
+}
+
+// Same as kernel_function with precomputed coefficients
+float kernel_evaluate(const struct kernel_coefficients *kernel, float x) {
+    float h = kernel->h;
+    switch (kernel->type) {
+    case GAUSSIAN_KERNEL:
+        return kernel->volume * expf(-1.0f * (x * x) / kernel->h2);
+    case CUBIC_KERNEL: {
+        float value = Max(0, kernel->h2 - x * x);
+        return value * value * value / kernel->volume;
+    }
+    case LINEAR_KERNEL:
+        if (x >= h || x <= -h) {
+            return 0.0f;
+        }
+        return (h - x) * (h - x) / kernel->volume;
+    default:
+        return 0.0f;
+    }
+}
+
+// Same as kernel_function_derivative with precomputed coefficients
+float kernel_evaluate_derivative(const struct kernel_coefficients *kernel,
+                                 float x) {
+    float h = kernel->h;
+    switch (kernel->type) {
+    case GAUSSIAN_KERNEL:
+        return (-2.0f * x) / kernel->h2 *
+               (kernel->volume * expf(-1.0f * (x * x) / kernel->h2));
+    case CUBIC_KERNEL: {
+        if (x > h || x < -h) {
+            return 0.0f;
+        }
+        float f = kernel->h2 - x * x;
+        return kernel->slope * x * f * f;
+    }
+    case LINEAR_KERNEL:
+        if (x >= h || x <= -h) {
+            return 0.0f;
+        }
+        return (h - x) * kernel->slope;
+    default:
+        return 0.0f;
+    }
+}
+
+// Distance past which a kernel is zero
+//
+// Returns the support (in meters), INFINITY for the Gaussian kernel
+float kernel_support(const struct kernel_coefficients *kernel) {
+    switch (kernel->type) {
+    case CUBIC_KERNEL:
+    case LINEAR_KERNEL:
+        return kernel->h;
+    default:
+        return INFINITY;
+    }
+}
@@ -0,0 +1,153 @@
+#ifndef KERNEL_SIMD_H
+#define KERNEL_SIMD_H
+
+// Kernel functions evaluated on 4 distances at once
+//
+// The web build enables them with -msimd128, they are written with the
+// vector extensions of the compiler so that clang lowers them to wasm SIMD128
+// and they can also be built natively with -DSPH_SIMD to compare them with
+// the scalar kernels.
+
+#if defined(__wasm_simd128__) && !defined(SPH_SIMD)
+#define SPH_SIMD
+#endif
+
+#ifdef SPH_SIMD
+
+#include "sph.h"
+#include <math.h>
+
+#if defined(__wasm_simd128__)
+#include <wasm_simd128.h>
+#endif
+
+typedef float f32x4 __attribute__((vector_size(16)));
+typedef int i32x4 __attribute__((vector_size(16)));
+
+static inline f32x4 f32x4_splat(float value) {
+    return (f32x4){value, value, value, value};
+}
+
+// Picks a where the mask is set and b elsewhere
+static inline f32x4 f32x4_select(i32x4 mask, f32x4 a, f32x4 b) {
+    return (f32x4)((mask & (i32x4)a) | (~mask & (i32x4)b));
+}
+
+static inline f32x4 f32x4_max(f32x4 a, f32x4 b) {
+    return f32x4_select(a > b, a, b);
+}
+
+static inline f32x4 f32x4_sqrt(f32x4 x) {
+#if defined(__wasm_simd128__)
+    return (f32x4)wasm_f32x4_sqrt((v128_t)x);
+#else
+    return (f32x4){sqrtf(x[0]), sqrtf(x[1]), sqrtf(x[2]), sqrtf(x[3])};
+#endif
+}
+
+static inline float f32x4_sum(f32x4 x) { return (x[0] + x[1]) + (x[2] + x[3]); }
+
+// Cephes single precision exponential, within 2 ulp of expf over the range
+// that does not underflow
+static inline f32x4 f32x4_exp(f32x4 x) {
+    x = f32x4_max(x, f32x4_splat(-87.3f));
+
+    // x = n * ln(2) + r with |r| <= ln(2) / 2
+    f32x4 t = x * f32x4_splat(1.44269504088896341f) + f32x4_splat(0.5f);
+    i32x4 n = __builtin_convertvector(t, i32x4);
+    n += (i32x4)(__builtin_convertvector(n, f32x4) > t); // Floor, not trunc
+    f32x4 fn = __builtin_convertvector(n, f32x4);
+    f32x4 r = x - fn * f32x4_splat(0.693359375f) +
+              fn * f32x4_splat(2.12194440e-4f);
+
+    f32x4 y = f32x4_splat(1.9875691500e-4f);
+    y = y * r + f32x4_splat(1.3981999507e-3f);
+    y = y * r + f32x4_splat(8.3334519073e-3f);
+    y = y * r + f32x4_splat(4.1665795894e-2f);
+    y = y * r + f32x4_splat(1.6666665459e-1f);
+    y = y * r + f32x4_splat(5.0000001201e-1f);
+    y = y * r * r + r + f32x4_splat(1.0f);
+
+    // 2^n built from its exponent bits
+    return y * (f32x4)((n + 127) << 23);
+}
+
+// The constants of the kernels come from struct kernel_coefficients, so they
+// are computed once per edit of the parameters like for kernel_evaluate
+
+static inline f32x4 kernel_gaussian_x4(const struct kernel_coefficients *kernel,
+                                       f32x4 x) {
+    return f32x4_splat(kernel->volume) *
+           f32x4_exp(-(x * x) / f32x4_splat(kernel->h2));
+}
+
+static inline f32x4
+kernel_gaussian_derivative_x4(const struct kernel_coefficients *kernel,
+                              f32x4 x) {
+    return f32x4_splat(-2.0f) * x / f32x4_splat(kernel->h2) *
+           kernel_gaussian_x4(kernel, x);
+}
+
+static inline f32x4 kernel_cubic_x4(const struct kernel_coefficients *kernel,
+                                    f32x4 x) {
+    f32x4 value =
+        f32x4_max(f32x4_splat(0.0f), f32x4_splat(kernel->h2) - x * x);
+    return value * value * value / f32x4_splat(kernel->volume);
+}
+
+static inline f32x4
+kernel_cubic_derivative_x4(const struct kernel_coefficients *kernel, f32x4 x) {
+    f32x4 f = f32x4_splat(kernel->h2) - x * x;
+    return f32x4_select(x > f32x4_splat(kernel->h), f32x4_splat(0.0f),
+                        f32x4_splat(kernel->slope) * x * f * f);
+}
+
+static inline f32x4 kernel_linear_x4(const struct kernel_coefficients *kernel,
+                                     f32x4 x) {
+    f32x4 d = f32x4_splat(kernel->h) - x;
+    return f32x4_select(x >= f32x4_splat(kernel->h), f32x4_splat(0.0f),
+                        d * d / f32x4_splat(kernel->volume));
+}
+
+static inline f32x4
+kernel_linear_derivative_x4(const struct kernel_coefficients *kernel,
+                            f32x4 x) {
+    return f32x4_select(x >= f32x4_splat(kernel->h), f32x4_splat(0.0f),
+                        (f32x4_splat(kernel->h) - x) *
+                            f32x4_splat(kernel->slope));
+}
+
+// Batch versions of kernel_evaluate and kernel_evaluate_derivative, the
+// distances are never negative
+static inline f32x4 kernel_evaluate_x4(const struct kernel_coefficients *kernel,
+                                       f32x4 x) {
+    switch (kernel->type) {
+    case GAUSSIAN_KERNEL:
+        return kernel_gaussian_x4(kernel, x);
+    case CUBIC_KERNEL:
+        return kernel_cubic_x4(kernel, x);
+    case LINEAR_KERNEL:
+        return kernel_linear_x4(kernel, x);
+    default:
+        return f32x4_splat(0.0f);
+    }
+}
+
+static inline f32x4
+kernel_evaluate_derivative_x4(const struct kernel_coefficients *kernel,
+                              f32x4 x) {
+    switch (kernel->type) {
+    case GAUSSIAN_KERNEL:
+        return kernel_gaussian_derivative_x4(kernel, x);
+    case CUBIC_KERNEL:
+        return kernel_cubic_derivative_x4(kernel, x);
+    case LINEAR_KERNEL:
+        return kernel_linear_derivative_x4(kernel, x);
+    default:
+        return f32x4_splat(0.0f);
+    }
+}
+
+#endif // SPH_SIMD
+
+#endif // KERNEL_SIMD_H
@@ -0,0 +1,354 @@
+#include "sph.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Below this many bytes per thread the threads cost more than the parsing
+#define LOADER_MIN_CHUNK (1 << 20)
+
+// Size of a particle in a raw binary file: x, y, vx, vy as float32
+#define LOADER_RAW_RECORD (4 * sizeof(float))
+
+struct loader_chunk {
+        const char *start; // First byte of the first line of the chunk
+        const char *end;   // One past the last byte of the chunk
+        struct particle *items;
+        long first; // Index of the first particle of the chunk
+        long lines; // Number of particles in the chunk
+        long error; // Byte offset of the first invalid line, -1 if none
+        void *(*pass)(struct loader_chunk *chunk);
+};
+
+static int loader_is_blank(const char *line, const char *end) {
+    for (; line < end && *line != '\n'; line++) {
+        if (*line != ' ' && *line != '\t' && *line != '\r') {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Parses a decimal floating point number without reading past the end of
+// the mapping, which is not NUL terminated
+static const char *loader_parse_float(const char *c, const char *end,
+                                      float *out) {
+    while (c < end && (*c == ' ' || *c == '\t')) {
+        c++;
+    }
+
+    int negative = 0;
+    if (c < end && (*c == '-' || *c == '+')) {
+        negative = *c == '-';
+        c++;
+    }
+
+    double value = 0.0;
+    int digits = 0;
+    for (; c < end && *c >= '0' && *c <= '9'; c++, digits++) {
+        value = value * 10.0 + (*c - '0');
+    }
+    if (c < end && *c == '.') {
+        double scale = 0.1;
+        for (c++; c < end && *c >= '0' && *c <= '9'; c++, digits++) {
+            value += (*c - '0') * scale;
+            scale *= 0.1;
+        }
+    }
+    if (digits == 0) {
+        return NULL;
+    }
+
+    if (c < end && (*c == 'e' || *c == 'E')) {
+        const char *e = c + 1;
+        int exponent_negative = 0;
+        if (e < end && (*e == '-' || *e == '+')) {
+            exponent_negative = *e == '-';
+            e++;
+        }
+        int exponent = 0;
+        int exponent_digits = 0;
+        for (; e < end && *e >= '0' && *e <= '9'; e++, exponent_digits++) {
+            exponent = exponent < 400 ? exponent * 10 + (*e - '0') : exponent;
+        }
+        if (exponent_digits > 0) {
+            double power = 1.0;
+            double base = exponent_negative ? 0.1 : 10.0;
+            for (; exponent > 0; exponent--) {
+                power *= base;
+            }
+            value *= power;
+            c = e;
+        }
+    }
+
+    while (c < end && (*c == ' ' || *c == '\t' || *c == '\r')) {
+        c++;
+    }
+
+    *out = (float)(negative ? -value : value);
+    return c;
+}
+
+// Counts the non blank lines of a chunk
+static void *loader_count_pass(struct loader_chunk *chunk) {
+    long lines = 0;
+    const char *line = chunk->start;
+    while (line < chunk->end) {
+        const char *next = memchr(line, '\n', chunk->end - line);
+        next = next != NULL ? next + 1 : chunk->end;
+        lines += !loader_is_blank(line, next);
+        line = next;
+    }
+    chunk->lines = lines;
+
+    return NULL;
+}
+
+// Parses the lines of a chunk into its range of particles, the columns after
+// x, y, vx and vy are ignored
+static void *loader_parse_pass(struct loader_chunk *chunk) {
+    struct particle *p = &chunk->items[chunk->first];
+    const char *line = chunk->start;
+    while (line < chunk->end) {
+        const char *next = memchr(line, '\n', chunk->end - line);
+        const char *line_end = next != NULL ? next : chunk->end;
+        next = next != NULL ? next + 1 : chunk->end;
+        if (loader_is_blank(line, next)) {
+            line = next;
+            continue;
+        }
+
+        float values[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+        int columns = 0;
+        const char *c = line;
+        while (columns < 4) {
+            c = loader_parse_float(c, line_end, &values[columns]);
+            if (c == NULL) {
+                break;
+            }
+            columns++;
+            if (c == line_end || *c != ',') {
+                break;
+            }
+            c++;
+        }
+        if (columns < 2 || columns == 3) {
+            chunk->error = line - chunk->start;
+            return NULL;
+        }
+
+        *p++ = (struct particle){
+            .position = (Vector2){values[0], values[1]},
+            .velocity = (Vector2){values[2], values[3]},
+            .density = 0.0f,
+            .pressure = 0.0f,
+        };
+        line = next;
+    }
+
+    return NULL;
+}
+
+static void *loader_thread(void *args) {
+    struct loader_chunk *chunk = (struct loader_chunk *)args;
+    return chunk->pass(chunk);
+}
+
+// Runs a pass on every chunk, the last chunk runs on the calling thread
+static void loader_run(struct loader_chunk *chunks, int threads,
+                       void *(*pass)(struct loader_chunk *chunk)) {
+    pthread_t workers[threads];
+    int started[threads];
+    for (int t = 0; t < threads; t++) {
+        chunks[t].pass = pass;
+    }
+    for (int t = 0; t < threads - 1; t++) {
+        started[t] =
+            pthread_create(&workers[t], NULL, loader_thread, &chunks[t]) == 0;
+        if (!started[t]) {
+            pass(&chunks[t]);
+        }
+    }
+    pass(&chunks[threads - 1]);
+    for (int t = 0; t < threads - 1; t++) {
+        if (started[t]) {
+            pthread_join(workers[t], NULL);
+        }
+    }
+}
+
+static int loader_reserve(struct particle_array *particles, long count) {
+    if (count > INT32_MAX) {
+        SPH_LOG_ERROR("Too many particles to load (%ld)", count);
+        return -1;
+    }
+
+    if (count > particles->capacity) {
+        struct particle *items =
+            realloc(particles->items, count * sizeof(struct particle));
+        if (items == NULL) {
+            SPH_LOG_ERROR("Could not allocate %ld particles", count);
+            return -1;
+        }
+        particles->items = items;
+        particles->capacity = count;
+    }
+    particles->count = count;
+
+    return 0;
+}
+
+static long loader_csv(struct particle_array *particles, const char *data,
+                       size_t size, const char *filename, int threads) {
+    const char *end = data + size;
+
+    // A header line is recognized by its first character
+    const char *start = data;
+    while (start < end && (*start == ' ' || *start == '\t')) {
+        start++;
+    }
+    if (start < end && !(*start >= '0' && *start <= '9') && *start != '-' &&
+        *start != '+' && *start != '.') {
+        const char *next = memchr(start, '\n', end - start);
+        start = next != NULL ? next + 1 : end;
+    }
+
+    // Chunks are cut on line boundaries
+    long useful = (end - start) / LOADER_MIN_CHUNK;
+    if (threads > useful) {
+        threads = useful > 1 ? (int)useful : 1;
+    }
+    struct loader_chunk chunks[threads];
+    const char *cut = start;
+    for (int t = 0; t < threads; t++) {
+        const char *chunk_end = start + (end - start) * (t + 1) / threads;
+        if (t == threads - 1 || chunk_end < cut) {
+            chunk_end = t == threads - 1 ? end : cut;
+        } else {
+            const char *newline = memchr(chunk_end, '\n', end - chunk_end);
+            chunk_end = newline != NULL ? newline + 1 : end;
+        }
+        chunks[t] = (struct loader_chunk){
+            .start = cut,
+            .end = chunk_end,
+            .error = -1,
+        };
+        cut = chunk_end;
+    }
+
+    loader_run(chunks, threads, loader_count_pass);
+
+    long count = 0;
+    for (int t = 0; t < threads; t++) {
+        chunks[t].first = count;
+        count += chunks[t].lines;
+    }
+    if (loader_reserve(particles, count) != 0) {
+        return -1;
+    }
+    for (int t = 0; t < threads; t++) {
+        chunks[t].items = particles->items;
+    }
+
+    loader_run(chunks, threads, loader_parse_pass);
+
+    for (int t = 0; t < threads; t++) {
+        if (chunks[t].error >= 0) {
+            SPH_LOG_ERROR("%s: invalid line at byte %ld, expected x,y or "
+                          "x,y,vx,vy",
+                          filename,
+                          (long)(chunks[t].start - data) + chunks[t].error);
+            particles->count = 0;
+            return -1;
+        }
+    }
+
+    return count;
+}
+
+static long loader_raw(struct particle_array *particles, const char *data,
+                       size_t size, const char *filename) {
+    if (size % LOADER_RAW_RECORD != 0) {
+        SPH_LOG_ERROR("%s: size is not a multiple of %zu bytes", filename,
+                      LOADER_RAW_RECORD);
+        return -1;
+    }
+
+    long count = size / LOADER_RAW_RECORD;
+    if (loader_reserve(particles, count) != 0) {
+        return -1;
+    }
+
+    for (long i = 0; i < count; i++) {
+        float record[4];
+        memcpy(record, data + i * LOADER_RAW_RECORD, sizeof(record));
+        particles->items[i] = (struct particle){
+            .position = (Vector2){record[0], record[1]},
+            .velocity = (Vector2){record[2], record[3]},
+            .density = 0.0f,
+            .pressure = 0.0f,
+        };
+    }
+
+    return count;
+}
+
+// Loads the initial positions and velocities of the particles from a file
+//
+// Files ending in .csv hold one particle per line as x,y or x,y,vx,vy, an
+// optional header line is skipped and extra columns are ignored, so the
+// files written by particles_export can be loaded back. They are parsed in
+// parallel chunks. Any other file is read as raw native endian float32
+// records of x, y, vx and vy. Both are memory-mapped.
+//
+// Arguments:
+// - particles: the array to fill, grown with realloc if needed
+// - filename: the file to load
+// - threads: the maximum number of threads used to parse a CSV file
+//
+// Returns the number of particles loaded or -1 on failure
+long particles_load(struct particle_array *particles, const char *filename,
+                    int threads) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        SPH_LOG_ERROR("Could not open %s", filename);
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        SPH_LOG_ERROR("Could not read %s", filename);
+        close(fd);
+        return -1;
+    }
+
+    size_t size = st.st_size;
+    const char *data = NULL;
+    if (size > 0) {
+        data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            SPH_LOG_ERROR("Could not map %s", filename);
+            close(fd);
+            return -1;
+        }
+        madvise((void *)data, size, MADV_SEQUENTIAL);
+    }
+    close(fd);
+
+    size_t length = strlen(filename);
+    int csv = length >= 4 && strcmp(filename + length - 4, ".csv") == 0;
+    long count = csv ? loader_csv(particles, data, size, filename,
+                                  threads > 0 ? threads : 1)
+                     : loader_raw(particles, data, size, filename);
+
+    if (data != NULL) {
+        munmap((void *)data, size);
+    }
+
+    return count;
+}
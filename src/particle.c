@@ -1,3 +1,4 @@
+#include "kernel_simd.h"
 #include "raylib.h"
 #include "raylib_extensions.h"
 #include "raymath.h"
@@ -57,6 +58,52 @@ void particles_init_grid(struct particle_array *particles, float width,
     }
 }
 
+#ifdef SPH_SIMD
+// Positions of particles j to j + 3
+static inline void particles_positions_x4(const struct particle *items, int j,
+                                          f32x4 *x, f32x4 *y) {
+    *x = (f32x4){items[j].position.x, items[j + 1].position.x,
+                 items[j + 2].position.x, items[j + 3].position.x};
+    *y = (f32x4){items[j].position.y, items[j + 1].position.y,
+                 items[j + 2].position.y, items[j + 3].position.y};
+}
+
+// Sum of the kernel over the particles around a point, 4 particles at a time,
+// the particle skip (if any) is left out
+static float position_density_x4(struct particle_array *particles, Vector2 pos,
+                                 int skip,
+                                 const struct kernel_coefficients *kernel,
+                                 float particle_mass) {
+    const struct particle *items = particles->items;
+    f32x4 px = f32x4_splat(pos.x);
+    f32x4 py = f32x4_splat(pos.y);
+    f32x4 sum = f32x4_splat(0.0f);
+
+    int j = 0;
+    for (; j + 4 <= particles->count; j += 4) {
+        f32x4 x, y;
+        particles_positions_x4(items, j, &x, &y);
+        f32x4 dx = px - x;
+        f32x4 dy = py - y;
+        f32x4 influence =
+            kernel_evaluate_x4(kernel, f32x4_sqrt(dx * dx + dy * dy));
+        i32x4 index = (i32x4){j, j + 1, j + 2, j + 3};
+        sum += f32x4_select(index == skip, f32x4_splat(0.0f), influence);
+    }
+
+    float density = f32x4_sum(sum) * particle_mass;
+    for (; j < particles->count; j++) {
+        if (j == skip) {
+            continue;
+        }
+        Vector2 dir = Vector2Subtract(pos, items[j].position);
+        density += kernel_evaluate(kernel, Vector2Length(dir)) * particle_mass;
+    }
+
+    return density;
+}
+#endif
+
 // Computes the density of particle i with respect to the other particles
 //
 // The function computes the density property of a particle by using the
@@ -85,6 +132,22 @@ void particles_init_grid(struct particle_array *particles, float width,
 // Returns the density of particle i (in kg/m^3)
 float particle_density(struct particle_array *particles, int i, float h,
                        float particle_mass, enum kernel_type type) {
+    struct kernel_coefficients kernel;
+    kernel_coefficients_init(&kernel, h, type);
+    return particle_density_kernel(particles, i, &kernel, particle_mass);
+}
+
+// Same as particle_density with the kernel coefficients computed by the
+// caller
+float particle_density_kernel(struct particle_array *particles, int i,
+                              const struct kernel_coefficients *kernel,
+                              float particle_mass) {
+#ifdef SPH_SIMD
+    return Max(position_density_x4(particles, particles->items[i].position, i,
+                                   kernel, particle_mass),
+               1e-6f);
+#endif
+
     float density = 0.0f;
     for (int j = 0; j < particles->count; j++) {
         if (i == j) {
@@ -94,7 +157,7 @@ float particle_density(struct particle_array *particles, int i, float h,
         Vector2 dir = Vector2Subtract(particles->items[i].position,
                                       particles->items[j].position);
         float x = Vector2Length(dir);
-        float influence = kernel_function(x, h, type);
+        float influence = kernel_evaluate(kernel, x);
         density += influence * particle_mass;
     }
 
@@ -113,11 +176,18 @@ float particle_density(struct particle_array *particles, int i, float h,
 // Returns the density of the point (in kg/m^3)
 float position_density(struct particle_array *particles, Vector2 pos, float h,
                        float particle_mass, enum kernel_type type) {
+    struct kernel_coefficients kernel;
+    kernel_coefficients_init(&kernel, h, type);
+
+#ifdef SPH_SIMD
+    return position_density_x4(particles, pos, -1, &kernel, particle_mass);
+#endif
+
     float density = 0.0f;
     for (int j = 0; j < particles->count; j++) {
         Vector2 dir = Vector2Subtract(pos, particles->items[j].position);
         float x = Vector2Length(dir);
-        float influence = kernel_function(x, h, type);
+        float influence = kernel_evaluate(&kernel, x);
         density += influence * particle_mass;
     }
 
@@ -156,8 +226,56 @@ float position_density(struct particle_array *particles, Vector2 pos, float h,
 Vector2 particle_pressure_gradient(struct particle_array *particles, int i,
                                    float h, float particle_mass,
                                    enum kernel_type kernel_type) {
+    struct kernel_coefficients kernel;
+    kernel_coefficients_init(&kernel, h, kernel_type);
+    return particle_pressure_gradient_kernel(particles, i, &kernel,
+                                             particle_mass);
+}
+
+// Same as particle_pressure_gradient with the kernel coefficients computed by
+// the caller
+Vector2 particle_pressure_gradient_kernel(struct particle_array *particles,
+                                          int i,
+                                          const struct kernel_coefficients *kernel,
+                                          float particle_mass) {
     Vector2 force = {0.0f, 0.0f};
-    for (int j = 0; j < particles->count; j++) {
+    int j = 0;
+
+#ifdef SPH_SIMD
+    const struct particle *items = particles->items;
+    f32x4 px = f32x4_splat(items[i].position.x);
+    f32x4 py = f32x4_splat(items[i].position.y);
+    f32x4 fx = f32x4_splat(0.0f);
+    f32x4 fy = f32x4_splat(0.0f);
+    for (; j + 4 <= particles->count; j += 4) {
+        f32x4 x, y;
+        particles_positions_x4(items, j, &x, &y);
+        f32x4 dx = px - x;
+        f32x4 dy = py - y;
+        f32x4 distance = f32x4_sqrt(dx * dx + dy * dy);
+
+        // Normalized offsets, zero for coincident particles like
+        // Vector2Normalize
+        f32x4 inverse = f32x4_select(distance > f32x4_splat(0.0f),
+                                     f32x4_splat(1.0f) / distance,
+                                     f32x4_splat(0.0f));
+
+        f32x4 slope = kernel_evaluate_derivative_x4(kernel, distance);
+        f32x4 density = {items[j].density, items[j + 1].density,
+                         items[j + 2].density, items[j + 3].density};
+        f32x4 pressure = {items[j].pressure, items[j + 1].pressure,
+                          items[j + 2].pressure, items[j + 3].pressure};
+        f32x4 scale = -pressure * slope * f32x4_splat(particle_mass) / density;
+
+        i32x4 index = (i32x4){j, j + 1, j + 2, j + 3};
+        scale = f32x4_select(index == i, f32x4_splat(0.0f), scale * inverse);
+        fx += dx * scale;
+        fy += dy * scale;
+    }
+    force = (Vector2){f32x4_sum(fx), f32x4_sum(fy)};
+#endif
+
+    for (; j < particles->count; j++) {
         if (i == j) {
             continue;
         }
@@ -167,7 +285,7 @@ Vector2 particle_pressure_gradient(struct particle_array *particles, int i,
         float x = Vector2Length(offset);
         Vector2 dir = Vector2Normalize(offset);
 
-        float slope = kernel_function_derivative(x, h, kernel_type);
+        float slope = kernel_evaluate_derivative(kernel, x);
         float density = particles->items[j].density;
         float pressure_i = particles->items[j].pressure;
         float pressure_j = particles->items[j].pressure;
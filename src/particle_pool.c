@@ -0,0 +1,200 @@
+#include "particle_pool.h"
+#include <sys/mman.h>
+
+// Once compacted, pages are released when less than half of them is used
+#define PARTICLE_POOL_RELEASE_RATIO 2
+
+static void *particle_pool_map(size_t size, int prot) {
+    void *map = mmap(NULL, size, prot,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    return map != MAP_FAILED ? map : NULL;
+}
+
+static size_t particle_pool_pages(size_t bytes) {
+    return (bytes + PARTICLE_POOL_PAGE_SIZE - 1) / PARTICLE_POOL_PAGE_SIZE *
+           PARTICLE_POOL_PAGE_SIZE;
+}
+
+// Updates the capacity of the particles from the committed pages
+static void particle_pool_update_capacity(struct particle_pool *pool) {
+    size_t fits = pool->committed / sizeof(struct particle);
+    pool->particles->capacity =
+        fits < (size_t)pool->max_count ? (int)fits : pool->max_count;
+}
+
+// Reserves the address space of a pool, no page is committed yet
+//
+// Arguments:
+// - pool: the pool to initialize
+// - particles: the array whose items the pool owns, it is left empty
+// - max_count: the largest number of particles the pool can hold
+//
+// Returns 0 on success or -1 on failure
+int particle_pool_init(struct particle_pool *pool,
+                       struct particle_array *particles, int max_count) {
+    pool->particles = particles;
+    pool->max_count = max_count;
+    pool->reserved = particle_pool_pages((size_t)max_count *
+                                         sizeof(struct particle));
+    pool->committed = 0;
+    pool->hole_count = 0;
+
+    // The free list and the flags are touched a page at a time by the
+    // removals, so they are not committed either
+    particles->items = particle_pool_map(pool->reserved, PROT_NONE);
+    pool->dead = particle_pool_map(max_count, PROT_READ | PROT_WRITE);
+    pool->holes =
+        particle_pool_map(max_count * sizeof(int), PROT_READ | PROT_WRITE);
+    particles->count = 0;
+    particles->capacity = 0;
+    if (particles->items == NULL || pool->dead == NULL || pool->holes == NULL) {
+        SPH_LOG_ERROR("Could not reserve room for %d particles", max_count);
+        particle_pool_free(pool);
+        return -1;
+    }
+
+    return 0;
+}
+
+// Commits the pages needed to hold a number of particles
+//
+// Returns 0 on success or -1 if the pool cannot hold that many particles
+int particle_pool_reserve(struct particle_pool *pool, int capacity) {
+    struct particle_array *particles = pool->particles;
+    if (capacity <= particles->capacity) {
+        return 0;
+    }
+    if (capacity > pool->max_count) {
+        SPH_LOG_ERROR("Too many particles (%d), the pool holds at most %d",
+                      capacity, pool->max_count);
+        return -1;
+    }
+
+    size_t committed =
+        particle_pool_pages((size_t)capacity * sizeof(struct particle));
+    committed = committed < pool->reserved ? committed : pool->reserved;
+    if (mprotect((char *)particles->items + pool->committed,
+                 committed - pool->committed, PROT_READ | PROT_WRITE) != 0) {
+        SPH_LOG_ERROR("Could not allocate %d particles", capacity);
+        return -1;
+    }
+    pool->committed = committed;
+    particle_pool_update_capacity(pool);
+
+    return 0;
+}
+
+// Sets the number of particles, dropping every hole, the particles past the
+// previous count are left for the caller to fill
+//
+// Returns 0 on success or -1 if the pool cannot hold that many particles
+int particle_pool_resize(struct particle_pool *pool, int count) {
+    if (particle_pool_reserve(pool, count) != 0) {
+        return -1;
+    }
+
+    for (int i = 0; i < pool->hole_count; i++) {
+        pool->dead[pool->holes[i]] = 0;
+    }
+    pool->hole_count = 0;
+    pool->particles->count = count;
+
+    return 0;
+}
+
+// Adds a particle in the last hole left by a removal, or after the last
+// particle when there is none
+//
+// Returns the index of the particle or -1 if the pool is full
+int particle_pool_add(struct particle_pool *pool,
+                      const struct particle *particle) {
+    struct particle_array *particles = pool->particles;
+
+    int index;
+    if (pool->hole_count > 0) {
+        index = pool->holes[--pool->hole_count];
+        pool->dead[index] = 0;
+    } else {
+        if (particle_pool_reserve(pool, particles->count + 1) != 0) {
+            return -1;
+        }
+        index = particles->count++;
+    }
+    particles->items[index] = *particle;
+
+    return index;
+}
+
+// Removes a particle, leaving a hole until a particle is added or the pool
+// is compacted
+//
+// The particles keep their indices until the next compaction, so any number
+// of them can be removed while iterating over the array.
+void particle_pool_remove(struct particle_pool *pool, int index) {
+    if (index < 0 || index >= pool->particles->count || pool->dead[index]) {
+        return;
+    }
+
+    pool->dead[index] = 1;
+    pool->holes[pool->hole_count++] = index;
+}
+
+// Fills the holes with the last particles and releases the pages that are
+// no longer needed
+//
+// Must only be called while no thread reads the particles.
+//
+// Returns the number of particles moved
+int particle_pool_compact(struct particle_pool *pool) {
+    struct particle_array *particles = pool->particles;
+
+    int moved = 0;
+    while (pool->hole_count > 0) {
+        int hole = pool->holes[--pool->hole_count];
+
+        // Holes at the end are dropped, so the last particle is alive
+        while (particles->count > 0 && pool->dead[particles->count - 1]) {
+            pool->dead[--particles->count] = 0;
+        }
+        if (hole >= particles->count) {
+            continue;
+        }
+
+        particles->items[hole] = particles->items[--particles->count];
+        pool->dead[hole] = 0;
+        moved++;
+    }
+
+    size_t used =
+        particle_pool_pages((size_t)particles->count * sizeof(struct particle));
+    if (pool->committed > used * PARTICLE_POOL_RELEASE_RATIO &&
+        pool->committed - used >= PARTICLE_POOL_PAGE_SIZE) {
+        char *start = (char *)particles->items + used;
+        madvise(start, pool->committed - used, MADV_DONTNEED);
+        mprotect(start, pool->committed - used, PROT_NONE);
+        pool->committed = used;
+        particle_pool_update_capacity(pool);
+    }
+
+    return moved;
+}
+
+void particle_pool_free(struct particle_pool *pool) {
+    struct particle_array *particles = pool->particles;
+    if (particles->items != NULL) {
+        munmap(particles->items, pool->reserved);
+    }
+    if (pool->dead != NULL) {
+        munmap(pool->dead, pool->max_count);
+    }
+    if (pool->holes != NULL) {
+        munmap(pool->holes, pool->max_count * sizeof(int));
+    }
+    particles->items = NULL;
+    particles->count = 0;
+    particles->capacity = 0;
+    pool->dead = NULL;
+    pool->holes = NULL;
+    pool->hole_count = 0;
+    pool->committed = 0;
+}
@@ -0,0 +1,52 @@
+#ifndef PARTICLE_POOL_H
+#define PARTICLE_POOL_H
+
+#include "sph.h"
+#include <stddef.h>
+
+// Bytes of particles committed at a time (a multiple of the page size)
+#define PARTICLE_POOL_PAGE_SIZE (1 << 16)
+
+// Particles the address space is reserved for by default, only the pages in
+// use are backed by memory
+#define PARTICLE_POOL_DEFAULT_MAX (1 << 24)
+
+// Storage of the particles of a simulation
+//
+// The address space of the largest array is reserved once and committed in
+// fixed size pages as the particles grow, so the items never move and
+// growing never copies them. A removed particle leaves a hole that goes on a
+// free list, the next particle added takes its place, and the holes left
+// are filled with the last particles by a compaction at a safe point. The
+// particle array stays contiguous, which the solver and the exporters rely
+// on, and has no hole once compacted.
+struct particle_pool {
+        struct particle_array *particles; // Items of the pool, capacity is
+                                          // the committed part
+        int max_count;       // Particles the address space is reserved for
+        size_t reserved;     // Bytes reserved for the particles
+        size_t committed;    // Bytes readable and writable
+        unsigned char *dead; // Whether each slot is a hole
+        int *holes;          // Free list of the holes
+        int hole_count;
+};
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+int particle_pool_init(struct particle_pool *pool,
+                       struct particle_array *particles, int max_count);
+int particle_pool_reserve(struct particle_pool *pool, int capacity);
+int particle_pool_resize(struct particle_pool *pool, int count);
+int particle_pool_add(struct particle_pool *pool,
+                      const struct particle *particle);
+void particle_pool_remove(struct particle_pool *pool, int index);
+int particle_pool_compact(struct particle_pool *pool);
+void particle_pool_free(struct particle_pool *pool);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif // PARTICLE_POOL_H
@@ -0,0 +1,293 @@
+#include "perf_counters.h"
+#include "sph.h"
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+static const char *perf_counter_names[PERF_COUNTER_COUNT] = {
+    [PERF_CYCLES] = "cycles",
+    [PERF_INSTRUCTIONS] = "instructions",
+    [PERF_L1D_MISSES] = "l1d_misses",
+    [PERF_LLC_MISSES] = "llc_misses",
+    [PERF_BRANCH_MISSES] = "branch_misses",
+};
+
+const char *perf_counter_name(enum perf_counter counter) {
+    if (counter < 0 || counter >= PERF_COUNTER_COUNT) {
+        return "unknown";
+    }
+
+    return perf_counter_names[counter];
+}
+
+// Allocates the counter slots, no counter is opened yet
+//
+// Returns 0 on success and -1 if the slots could not be allocated
+int perf_init(struct perf_table *table, int count) {
+    table->threads = calloc(count, sizeof(struct perf_thread));
+    if (table->threads == NULL) {
+        SPH_LOG_ERROR("Could not allocate memory for the perf counters");
+        table->count = 0;
+        return -1;
+    }
+
+    table->count = count;
+    for (int t = 0; t < count; t++) {
+        table->threads[t].leader = -1;
+        for (int c = 0; c < PERF_COUNTER_COUNT; c++) {
+            table->threads[t].fds[c] = -1;
+            table->threads[t].slots[c] = -1;
+        }
+    }
+
+    return 0;
+}
+
+#ifdef __linux__
+// Layout of a read of a group with PERF_FORMAT_GROUP and both times
+struct perf_group_read {
+        uint64_t count;   // Number of values
+        uint64_t enabled; // Time the group was enabled (in nanoseconds)
+        uint64_t running; // Time it was on the PMU (in nanoseconds)
+        uint64_t values[PERF_COUNTER_COUNT];
+};
+
+// Opens a counter of the calling thread in the group of a leader, or as the
+// leader of a new group if `leader` is -1
+static int perf_open_counter(enum perf_counter counter, int leader) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                       PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    switch (counter) {
+    case PERF_CYCLES:
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_CPU_CYCLES;
+        break;
+    case PERF_INSTRUCTIONS:
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+        break;
+    case PERF_L1D_MISSES:
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.config = PERF_COUNT_HW_CACHE_L1D |
+                      (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                      (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        break;
+    case PERF_LLC_MISSES:
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        break;
+    case PERF_BRANCH_MISSES:
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+        break;
+    default:
+        return -1;
+    }
+
+    // pid = 0 and cpu = -1 counts the calling thread on any CPU
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0);
+}
+
+// Reads every counter of the group of a thread at once
+//
+// Returns 0 on success and -1 on failure
+static int perf_read_group(const struct perf_thread *pt,
+                           struct perf_group_read *group) {
+    size_t size = (3 + (size_t)pt->members) * sizeof(uint64_t);
+    if (read(pt->leader, group, size) != (ssize_t)size ||
+        group->count != (uint64_t)pt->members) {
+        return -1;
+    }
+
+    return 0;
+}
+#endif
+
+// Opens the counters of the calling thread as one group, led by the cycles
+// when they are available
+//
+// Counters that the kernel or the container refuses are left closed and
+// their columns read as zero.
+//
+// Returns the number of counters that could be opened
+int perf_thread_open(struct perf_table *table, int thread) {
+    if (table == NULL || thread < 0 || thread >= table->count) {
+        return 0;
+    }
+
+    struct perf_thread *pt = &table->threads[thread];
+    int opened = 0;
+
+#ifdef __linux__
+    int error = 0;
+    for (int c = 0; c < PERF_COUNTER_COUNT; c++) {
+        pt->fds[c] = perf_open_counter(c, pt->leader);
+        if (pt->fds[c] < 0) {
+            error = errno;
+            continue;
+        }
+
+        if (pt->leader < 0) {
+            pt->leader = pt->fds[c];
+        }
+        pt->slots[c] = pt->members++;
+        opened++;
+    }
+
+    if (opened < PERF_COUNTER_COUNT && thread == 0) {
+        SPH_LOG_WARN("Only %d of %d perf counters are available (%s), check "
+                     "/proc/sys/kernel/perf_event_paranoid",
+                     opened, PERF_COUNTER_COUNT, strerror(error));
+    }
+#else
+    if (thread == 0) {
+        SPH_LOG_WARN("Perf counters are only supported on Linux");
+    }
+#endif
+
+    pt->open = opened > 0;
+    perf_sample(table, thread);
+
+    return opened;
+}
+
+// Reads the counters of a thread without attributing them to any phase
+void perf_sample(struct perf_table *table, int thread) {
+    if (table == NULL || thread < 0 || thread >= table->count) {
+        return;
+    }
+
+#ifdef __linux__
+    struct perf_thread *pt = &table->threads[thread];
+    struct perf_group_read group;
+    if (!pt->open || perf_read_group(pt, &group) != 0) {
+        return;
+    }
+
+    for (int c = 0; c < PERF_COUNTER_COUNT; c++) {
+        if (pt->slots[c] >= 0) {
+            pt->last[c] = group.values[pt->slots[c]];
+        }
+    }
+    pt->last_enabled = group.enabled;
+    pt->last_running = group.running;
+#endif
+}
+
+// Attributes the events counted since the last sample to a phase
+void perf_lap(struct perf_table *table, int thread, enum timing_phase phase) {
+    if (table == NULL || thread < 0 || thread >= table->count) {
+        return;
+    }
+
+#ifdef __linux__
+    struct perf_thread *pt = &table->threads[thread];
+    struct perf_group_read group;
+    if (!pt->open || perf_read_group(pt, &group) != 0) {
+        return;
+    }
+
+    // The group counted for `running` of the `enabled` nanoseconds of the
+    // lap, the events of the rest of it are extrapolated
+    uint64_t enabled = group.enabled - pt->last_enabled;
+    uint64_t running = group.running - pt->last_running;
+    double scale = running > 0 ? (double)enabled / running : 0.0;
+    for (int c = 0; c < PERF_COUNTER_COUNT; c++) {
+        if (pt->slots[c] < 0) {
+            continue;
+        }
+
+        uint64_t value = group.values[pt->slots[c]];
+        pt->totals[phase][c] += (uint64_t)((value - pt->last[c]) * scale);
+        pt->last[c] = value;
+    }
+    pt->last_enabled = group.enabled;
+    pt->last_running = group.running;
+    pt->enabled += enabled;
+    pt->running += running;
+    pt->laps[phase]++;
+#else
+    (void)phase;
+#endif
+}
+
+// Prints the counters of every phase summed over all the threads
+void perf_report(struct perf_table *table, FILE *file) {
+    int open = 0;
+    uint64_t enabled = 0;
+    uint64_t running = 0;
+    for (int t = 0; t < table->count; t++) {
+        open |= table->threads[t].open;
+        enabled += table->threads[t].enabled;
+        running += table->threads[t].running;
+    }
+
+    if (!open) {
+        fprintf(file, "perf counters: unavailable\n");
+        return;
+    }
+    if (running < enabled) {
+        fprintf(file,
+                "perf counters: multiplexed, counted %.1f%% of the time and "
+                "scaled\n",
+                100.0 * running / enabled);
+    }
+
+    fprintf(file, "%-18s %14s %14s %6s %12s %12s %12s\n", "phase", "cycles",
+            "instructions", "ipc", "l1d_mpki", "llc_mpki", "branch_mpki");
+    for (int p = 0; p < TIMING_PHASE_COUNT; p++) {
+        uint64_t totals[PERF_COUNTER_COUNT] = {0};
+        uint64_t laps = 0;
+        for (int t = 0; t < table->count; t++) {
+            for (int c = 0; c < PERF_COUNTER_COUNT; c++) {
+                totals[c] += table->threads[t].totals[p][c];
+            }
+            laps += table->threads[t].laps[p];
+        }
+
+        if (laps == 0) {
+            continue;
+        }
+
+        double instructions = (double)totals[PERF_INSTRUCTIONS];
+        double kilo = instructions > 0.0 ? instructions / 1000.0 : 1.0;
+        double ipc = totals[PERF_CYCLES] > 0
+                         ? instructions / (double)totals[PERF_CYCLES]
+                         : 0.0;
+
+        fprintf(file, "%-18s %14llu %14llu %6.2f %12.3f %12.3f %12.3f\n",
+                timing_phase_name(p), (unsigned long long)totals[PERF_CYCLES],
+                (unsigned long long)totals[PERF_INSTRUCTIONS], ipc,
+                totals[PERF_L1D_MISSES] / kilo, totals[PERF_LLC_MISSES] / kilo,
+                totals[PERF_BRANCH_MISSES] / kilo);
+    }
+}
+
+void perf_free(struct perf_table *table) {
+#ifdef __linux__
+    for (int t = 0; t < table->count; t++) {
+        for (int c = 0; c < PERF_COUNTER_COUNT; c++) {
+            if (table->threads[t].fds[c] >= 0) {
+                close(table->threads[t].fds[c]);
+            }
+        }
+    }
+#endif
+
+    free(table->threads);
+    table->threads = NULL;
+    table->count = 0;
+}
@@ -0,0 +1,62 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include "timing.h"
+#include <stdint.h>
+#include <stdio.h>
+
+// Hardware counters collected on every thread
+enum perf_counter {
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_L1D_MISSES,
+    PERF_LLC_MISSES,
+    PERF_BRANCH_MISSES,
+    PERF_COUNTER_COUNT,
+};
+
+// The counters of a thread, attributed to the timing phases
+//
+// The counters are opened as one group so that they are all scheduled on
+// the PMU together and read with a single syscall. When the kernel
+// multiplexes the group with other events, the deltas of a lap are scaled
+// by the time the group was enabled over the time it actually counted.
+struct perf_thread {
+        int fds[PERF_COUNTER_COUNT];     // -1 when the counter is unavailable
+        int slots[PERF_COUNTER_COUNT];   // Position in a group read, -1 if none
+        int leader;                      // Descriptor read for the group
+        int members;                     // Counters in the group
+        uint64_t last[PERF_COUNTER_COUNT]; // Values at the end of the last lap
+        uint64_t last_enabled;           // Times at the end of the last lap
+        uint64_t last_running;           // (in nanoseconds)
+        uint64_t totals[TIMING_PHASE_COUNT][PERF_COUNTER_COUNT];
+        uint64_t laps[TIMING_PHASE_COUNT]; // Number of laps per phase
+        uint64_t enabled;                // Time the laps lasted
+        uint64_t running;                // Part of it the group counted
+        int open;                        // Whether any counter is open
+};
+
+// One slot per thread, each slot is only touched by its own thread until
+// perf_report is called
+struct perf_table {
+        struct perf_thread *threads;
+        int count;
+};
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+const char *perf_counter_name(enum perf_counter counter);
+int perf_init(struct perf_table *table, int count);
+int perf_thread_open(struct perf_table *table, int thread);
+void perf_sample(struct perf_table *table, int thread);
+void perf_lap(struct perf_table *table, int thread, enum timing_phase phase);
+void perf_report(struct perf_table *table, FILE *file);
+void perf_free(struct perf_table *table);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif // PERF_COUNTERS_H
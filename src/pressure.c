@@ -54,3 +54,51 @@ float pressure_value(float density, void *params, enum pressure_type type) {
     }
     }
 }
+
+// Computes the constants of an equation of state
+//
+// Arguments:
+// - pressure: the coefficients to fill
+// - params: the parameters of the equation, as passed to pressure_value
+// - type: the type of equation of state
+void pressure_coefficients_init(struct pressure_coefficients *pressure,
+                                const void *params, enum pressure_type type) {
+    *pressure = (struct pressure_coefficients){.type = type};
+    switch (type) {
+    case COLE_PRESSURE: {
+        const struct pressure_cole_params *p =
+            (const struct pressure_cole_params *)params;
+        pressure->rest_density = p->rest_density;
+        pressure->inverse_rest_density = 1.0f / p->rest_density;
+        pressure->adiabatic_index = p->adiabatic_index;
+        pressure->bulk_modulus = p->rest_density * p->speed_of_sound *
+                                 p->speed_of_sound / p->adiabatic_index;
+        pressure->background_pressure = p->background_pressure;
+        break;
+    }
+    case GAS_PRESSURE: {
+        const struct pressure_gas_params *p =
+            (const struct pressure_gas_params *)params;
+        pressure->rest_density = p->rest_density;
+        pressure->multiplier = p->pressure_multiplier;
+        break;
+    }
+    }
+}
+
+// Same as pressure_value with precomputed coefficients
+float pressure_evaluate(const struct pressure_coefficients *pressure,
+                        float density) {
+    switch (pressure->type) {
+    case COLE_PRESSURE: {
+        float x = powf(density * pressure->inverse_rest_density,
+                       pressure->adiabatic_index) -
+                  1.0f;
+        return pressure->bulk_modulus * x + pressure->background_pressure;
+    }
+    case GAS_PRESSURE:
+        return (density - pressure->rest_density) * pressure->multiplier;
+    default:
+        return 0.0f;
+    }
+}
@@ -0,0 +1,147 @@
+#include "pressure_field.h"
+#include "raylib_extensions.h"
+#include "raymath.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Allocates a field of columns x rows cells
+//
+// Arguments:
+// - field: the field to initialize
+// - columns: the number of cells along x
+// - rows: the number of cells along y
+// - cell_size: the size of a cell (in meters)
+// - threads: the number of workers of the simulation
+//
+// Returns 0 on success and -1 if the grids could not be allocated
+int pressure_field_init(struct pressure_field *field, int columns, int rows,
+                        float cell_size, int threads) {
+    memset(field, 0, sizeof(*field));
+    field->columns = columns;
+    field->rows = rows;
+    field->cell_size = cell_size;
+    field->threads = threads;
+
+    size_t cells = (size_t)columns * rows;
+    field->partial = malloc(cells * threads * sizeof(float));
+    field->values = calloc(cells, sizeof(float));
+    if (field->partial == NULL || field->values == NULL) {
+        SPH_LOG_ERROR("Could not allocate the pressure field");
+        pressure_field_free(field);
+        return -1;
+    }
+
+    return 0;
+}
+
+// Adds the density of the particle range of a worker to its partial grid,
+// each particle only touches the cells within the support of the kernel
+static void pressure_field_splat_task(struct simulation *sim, int worker,
+                                      void *user) {
+    struct pressure_field *field = (struct pressure_field *)user;
+    struct particle_array *particles = &sim->particles;
+    const struct simulation_snapshot *snapshot =
+        atomic_load_explicit(&sim->snapshot, memory_order_acquire);
+    const struct simulation_parameters *params = &snapshot->params;
+    int cells = field->columns * field->rows;
+    float *grid = &field->partial[(size_t)worker * cells];
+    memset(grid, 0, cells * sizeof(float));
+
+    int start = (int)((long)worker * particles->count / sim->threads);
+    int end = (int)((long)(worker + 1) * particles->count / sim->threads);
+
+    float support = params->kernel_type == GAUSSIAN_KERNEL
+                        ? PRESSURE_FIELD_GAUSSIAN_SUPPORT * params->h
+                        : params->h;
+    float inverse_cell = 1.0f / field->cell_size;
+
+    for (int i = start; i < end; i++) {
+        Vector2 position = particles->items[i].position;
+        int x0 = (int)floorf((position.x - support) * inverse_cell);
+        int x1 = (int)floorf((position.x + support) * inverse_cell);
+        int y0 = (int)floorf((position.y - support) * inverse_cell);
+        int y1 = (int)floorf((position.y + support) * inverse_cell);
+        x0 = x0 > 0 ? x0 : 0;
+        y0 = y0 > 0 ? y0 : 0;
+        x1 = x1 < field->columns - 1 ? x1 : field->columns - 1;
+        y1 = y1 < field->rows - 1 ? y1 : field->rows - 1;
+
+        for (int y = y0; y <= y1; y++) {
+            float dy = (y + 0.5f) * field->cell_size - position.y;
+            for (int x = x0; x <= x1; x++) {
+                float dx = (x + 0.5f) * field->cell_size - position.x;
+                float distance = sqrtf(dx * dx + dy * dy);
+                if (distance < support) {
+                    grid[y * field->columns + x] +=
+                        kernel_evaluate(&snapshot->kernel, distance) *
+                        params->particle_mass;
+                }
+            }
+        }
+    }
+}
+
+// Sums the partial grids over the cell range of a worker and evaluates the
+// pressure of each cell
+static void pressure_field_reduce_task(struct simulation *sim, int worker,
+                                       void *user) {
+    struct pressure_field *field = (struct pressure_field *)user;
+    int cells = field->columns * field->rows;
+    int start = (int)((long)worker * cells / sim->threads);
+    int end = (int)((long)(worker + 1) * cells / sim->threads);
+
+    const struct simulation_snapshot *snapshot =
+        atomic_load_explicit(&sim->snapshot, memory_order_acquire);
+
+    for (int c = start; c < end; c++) {
+        float density = 0.0f;
+        for (int t = 0; t < field->threads; t++) {
+            density += field->partial[(size_t)t * cells + c];
+        }
+        field->values[c] = pressure_evaluate(&snapshot->pressure, density);
+    }
+}
+
+// Computes the pressure of every cell from the current particles
+//
+// Must be called while the workers are parked
+void pressure_field_compute(struct pressure_field *field,
+                            struct simulation *sim) {
+    // The tasks read the coefficients of the current parameters
+    simulation_publish(sim);
+    simulation_run(sim, pressure_field_splat_task, field);
+    simulation_run(sim, pressure_field_reduce_task, field);
+
+    field->max = 0.0f;
+    int cells = field->columns * field->rows;
+    for (int c = 0; c < cells; c++) {
+        field->max = fmaxf(field->max, fabsf(field->values[c]));
+    }
+}
+
+// Maps a pressure normalized to [-1, 1] to the colors of the debug view:
+// white around zero, red for compression and blue for tension, fading to
+// black at the extremes
+Color pressure_field_color(float normalized_p) {
+    if (normalized_p > 0.1f) {
+        float t = (normalized_p - 0.1f) / 0.9f;
+        return ColorGradient((Color){255, 0, 0, 255}, BLACK, t);
+    } else if (normalized_p < -0.1f) {
+        float t = -(normalized_p + 0.1f) / 0.9f;
+        return ColorGradient((Color){0, 0, 255, 255}, BLACK, t);
+    } else if (normalized_p > 0.0f) {
+        float t = normalized_p / 0.1f;
+        return ColorGradient(WHITE, (Color){255, 0, 0, 255}, t);
+    } else {
+        float t = -normalized_p / 0.1f;
+        return ColorGradient(WHITE, (Color){0, 0, 255, 255}, t);
+    }
+}
+
+void pressure_field_free(struct pressure_field *field) {
+    free(field->partial);
+    free(field->values);
+    field->partial = NULL;
+    field->values = NULL;
+}
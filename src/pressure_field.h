@@ -0,0 +1,41 @@
+#ifndef PRESSURE_FIELD_H
+#define PRESSURE_FIELD_H
+
+#include "simulation.h"
+
+// Multiple of the smoothing length past which the Gaussian kernel is
+// neglected, its weight there is below 1e-3 of the peak
+#define PRESSURE_FIELD_GAUSSIAN_SUPPORT 3.0f
+
+// Pressure sampled at the center of the cells of a regular grid
+//
+// The field is computed on the worker pool in two passes: every worker
+// splats its range of particles into its own partial density grid, then
+// every worker sums the partial grids over its range of cells and evaluates
+// the equation of state.
+struct pressure_field {
+        int columns;
+        int rows;
+        float cell_size; // Size of a cell (in meters)
+        int threads;     // Number of partial grids
+        float *partial;  // One density grid per worker
+        float *values;   // Pressure of each cell, row major
+        float max;       // Largest absolute pressure of the last compute
+};
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+int pressure_field_init(struct pressure_field *field, int columns, int rows,
+                        float cell_size, int threads);
+void pressure_field_compute(struct pressure_field *field,
+                            struct simulation *sim);
+Color pressure_field_color(float normalized_p);
+void pressure_field_free(struct pressure_field *field);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif // PRESSURE_FIELD_H
@@ -0,0 +1,402 @@
+#include "raster.h"
+#include "raylib.h"
+#include "raymath.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Allocates the frame and the tiles of a renderer
+//
+// Arguments:
+// - raster: the renderer to initialize
+// - width: the width of the frames (in pixels)
+// - height: the height of the frames (in pixels)
+// - scale: the number of pixels per meter
+//
+// Returns 0 on success and -1 if the frame could not be allocated
+int raster_init(struct raster *raster, int width, int height, float scale) {
+    memset(raster, 0, sizeof(*raster));
+    raster->width = width;
+    raster->height = height;
+    raster->scale = scale;
+    raster->background = DARKGRAY;
+    raster->particle_color = GREEN;
+    raster->tiles_x = (width + RASTER_TILE_SIZE - 1) / RASTER_TILE_SIZE;
+    raster->tiles_y = (height + RASTER_TILE_SIZE - 1) / RASTER_TILE_SIZE;
+
+    raster->pixels = malloc((size_t)width * height * sizeof(Color));
+    raster->tile_start =
+        calloc(raster->tiles_x * raster->tiles_y + 1, sizeof(int));
+    if (raster->pixels == NULL || raster->tile_start == NULL) {
+        SPH_LOG_ERROR("Could not allocate a %dx%d frame", width, height);
+        raster_free(raster);
+        return -1;
+    }
+
+    return 0;
+}
+
+// Returns the range of tiles overlapped by a particle, false if none
+static int raster_particle_tiles(const struct raster *raster, Vector2 center,
+                                 float radius, int *x0, int *y0, int *x1,
+                                 int *y1) {
+    *x0 = (int)floorf((center.x - radius) / RASTER_TILE_SIZE);
+    *y0 = (int)floorf((center.y - radius) / RASTER_TILE_SIZE);
+    *x1 = (int)floorf((center.x + radius) / RASTER_TILE_SIZE);
+    *y1 = (int)floorf((center.y + radius) / RASTER_TILE_SIZE);
+    if (*x1 < 0 || *y1 < 0 || *x0 >= raster->tiles_x ||
+        *y0 >= raster->tiles_y) {
+        return 0;
+    }
+    *x0 = *x0 > 0 ? *x0 : 0;
+    *y0 = *y0 > 0 ? *y0 : 0;
+    *x1 = *x1 < raster->tiles_x - 1 ? *x1 : raster->tiles_x - 1;
+    *y1 = *y1 < raster->tiles_y - 1 ? *y1 : raster->tiles_y - 1;
+    return 1;
+}
+
+// Groups the particle indices by tile with a counting sort, keeping the
+// order of the particles inside each tile
+static int raster_bin(struct raster *raster, struct simulation *sim) {
+    struct particle_array *particles = &sim->particles;
+    int tile_count = raster->tiles_x * raster->tiles_y;
+    float radius = sim->params.particle_radius * raster->scale;
+    int *start = raster->tile_start;
+    memset(start, 0, (tile_count + 1) * sizeof(int));
+
+    int x0, y0, x1, y1;
+    for (int i = 0; i < particles->count; i++) {
+        Vector2 center =
+            Vector2Scale(particles->items[i].position, raster->scale);
+        if (!raster_particle_tiles(raster, center, radius, &x0, &y0, &x1,
+                                   &y1)) {
+            continue;
+        }
+        for (int ty = y0; ty <= y1; ty++) {
+            for (int tx = x0; tx <= x1; tx++) {
+                start[ty * raster->tiles_x + tx + 1]++;
+            }
+        }
+    }
+    for (int t = 0; t < tile_count; t++) {
+        start[t + 1] += start[t];
+    }
+
+    int items = start[tile_count];
+    if (items > raster->item_capacity) {
+        int *tile_items = realloc(raster->tile_items, items * sizeof(int));
+        if (tile_items == NULL) {
+            SPH_LOG_ERROR("Could not allocate the tiles of the frame");
+            return -1;
+        }
+        raster->tile_items = tile_items;
+        raster->item_capacity = items;
+    }
+
+    // The start offsets are used as cursors and restored afterwards
+    for (int i = 0; i < particles->count; i++) {
+        Vector2 center =
+            Vector2Scale(particles->items[i].position, raster->scale);
+        if (!raster_particle_tiles(raster, center, radius, &x0, &y0, &x1,
+                                   &y1)) {
+            continue;
+        }
+        for (int ty = y0; ty <= y1; ty++) {
+            for (int tx = x0; tx <= x1; tx++) {
+                raster->tile_items[start[ty * raster->tiles_x + tx]++] = i;
+            }
+        }
+    }
+    for (int t = tile_count; t > 0; t--) {
+        start[t] = start[t - 1];
+    }
+    start[0] = 0;
+
+    return 0;
+}
+
+// Bilinear sample of the normalized pressure at a pixel
+static float raster_sample_field(const struct raster *raster,
+                                 const struct pressure_field *field, int x,
+                                 int y) {
+    float u = (x + 0.5f) / raster->scale / field->cell_size - 0.5f;
+    float v = (y + 0.5f) / raster->scale / field->cell_size - 0.5f;
+    u = fminf(fmaxf(u, 0.0f), field->columns - 1.0f);
+    v = fminf(fmaxf(v, 0.0f), field->rows - 1.0f);
+
+    int u0 = (int)u;
+    int v0 = (int)v;
+    int u1 = u0 + 1 < field->columns ? u0 + 1 : u0;
+    int v1 = v0 + 1 < field->rows ? v0 + 1 : v0;
+    float fu = u - u0;
+    float fv = v - v0;
+
+    const float *values = field->values;
+    float top = values[v0 * field->columns + u0] * (1.0f - fu) +
+                values[v0 * field->columns + u1] * fu;
+    float bottom = values[v1 * field->columns + u0] * (1.0f - fu) +
+                   values[v1 * field->columns + u1] * fu;
+    float p = top * (1.0f - fv) + bottom * fv;
+
+    return field->max > 0.0f ? p / field->max : 0.0f;
+}
+
+static Color raster_blend(Color dst, Color src, float alpha) {
+    return (Color){
+        (unsigned char)(dst.r + (src.r - dst.r) * alpha),
+        (unsigned char)(dst.g + (src.g - dst.g) * alpha),
+        (unsigned char)(dst.b + (src.b - dst.b) * alpha),
+        255,
+    };
+}
+
+static void raster_draw_tile(struct raster *raster, struct simulation *sim,
+                             int tile) {
+    int tx = tile % raster->tiles_x;
+    int ty = tile / raster->tiles_x;
+    int x0 = tx * RASTER_TILE_SIZE;
+    int y0 = ty * RASTER_TILE_SIZE;
+    int x1 = x0 + RASTER_TILE_SIZE < raster->width ? x0 + RASTER_TILE_SIZE
+                                                   : raster->width;
+    int y1 = y0 + RASTER_TILE_SIZE < raster->height ? y0 + RASTER_TILE_SIZE
+                                                    : raster->height;
+
+    for (int y = y0; y < y1; y++) {
+        Color *row = &raster->pixels[(size_t)y * raster->width];
+        for (int x = x0; x < x1; x++) {
+            row[x] = raster->field != NULL
+                         ? pressure_field_color(raster_sample_field(
+                               raster, raster->field, x, y))
+                         : raster->background;
+        }
+    }
+
+    float radius = sim->params.particle_radius * raster->scale;
+    Color color = raster->particle_color;
+    float opacity = color.a / 255.0f;
+    for (int k = raster->tile_start[tile]; k < raster->tile_start[tile + 1];
+         k++) {
+        Vector2 center = Vector2Scale(
+            sim->particles.items[raster->tile_items[k]].position, raster->scale);
+
+        int px0 = (int)floorf(center.x - radius);
+        int py0 = (int)floorf(center.y - radius);
+        int px1 = (int)ceilf(center.x + radius);
+        int py1 = (int)ceilf(center.y + radius);
+        px0 = px0 > x0 ? px0 : x0;
+        py0 = py0 > y0 ? py0 : y0;
+        px1 = px1 < x1 ? px1 : x1;
+        py1 = py1 < y1 ? py1 : y1;
+
+        for (int y = py0; y < py1; y++) {
+            Color *row = &raster->pixels[(size_t)y * raster->width];
+            float dy = y + 0.5f - center.y;
+            for (int x = px0; x < px1; x++) {
+                float dx = x + 0.5f - center.x;
+                // One pixel of antialiasing on the edge of the disc
+                float coverage = radius - sqrtf(dx * dx + dy * dy) + 0.5f;
+                if (coverage <= 0.0f) {
+                    continue;
+                }
+                coverage = coverage < 1.0f ? coverage : 1.0f;
+                row[x] = raster_blend(row[x], color, coverage * opacity);
+            }
+        }
+    }
+}
+
+// Draws tiles until none is left, the tiles are handed out dynamically
+// since the particles are rarely spread evenly
+static void raster_task(struct simulation *sim, int worker, void *user) {
+    struct raster *raster = (struct raster *)user;
+    int tile_count = raster->tiles_x * raster->tiles_y;
+
+    for (;;) {
+        int tile = atomic_fetch_add_explicit(&raster->next_tile, 1,
+                                             memory_order_relaxed);
+        if (tile >= tile_count) {
+            break;
+        }
+        raster_draw_tile(raster, sim, tile);
+    }
+}
+
+// Renders the particles, and the pressure field under them if one is given,
+// into the frame of the renderer
+//
+// Must be called while the workers are parked
+void raster_render(struct raster *raster, struct simulation *sim,
+                   const struct pressure_field *field) {
+    if (raster_bin(raster, sim) != 0) {
+        return;
+    }
+
+    raster->field = field;
+    atomic_store(&raster->next_tile, 0);
+    simulation_run(sim, raster_task, raster);
+}
+
+void raster_free(struct raster *raster) {
+    free(raster->pixels);
+    free(raster->tile_start);
+    free(raster->tile_items);
+    memset(raster, 0, sizeof(*raster));
+}
+
+static int raster_output_frame(struct raster_output *output, long frame) {
+    if (output->pattern == NULL) {
+        size_t pixels = (size_t)output->width * output->height;
+        if (fwrite(output->pending, sizeof(Color), pixels, output->raw) !=
+                pixels ||
+            fflush(output->raw) != 0) {
+            SPH_LOG_ERROR("Could not write raw frame %ld", frame);
+            return -1;
+        }
+        return 0;
+    }
+
+    char filename[4096];
+    snprintf(filename, sizeof(filename), output->pattern, (int)frame);
+    Image image = {
+        .data = output->pending,
+        .width = output->width,
+        .height = output->height,
+        .mipmaps = 1,
+        .format = PIXELFORMAT_UNCOMPRESSED_R8G8B8A8,
+    };
+    if (!ExportImage(image, filename)) {
+        SPH_LOG_ERROR("Could not write %s", filename);
+        return -1;
+    }
+    return 0;
+}
+
+static void *raster_output_thread(void *args) {
+    struct raster_output *output = (struct raster_output *)args;
+
+    pthread_mutex_lock(&output->lock);
+    for (;;) {
+        while (!output->busy && !output->quit) {
+            pthread_cond_wait(&output->cond, &output->lock);
+        }
+        if (!output->busy) {
+            break;
+        }
+        long frame = output->frame - 1;
+        pthread_mutex_unlock(&output->lock);
+
+        int error = raster_output_frame(output, frame);
+
+        pthread_mutex_lock(&output->lock);
+        output->error |= error != 0;
+        output->busy = 0;
+        pthread_cond_broadcast(&output->cond);
+    }
+    pthread_mutex_unlock(&output->lock);
+
+    return NULL;
+}
+
+// Checks that a pattern of file names has exactly one conversion and that
+// it prints an int (e.g. %05d), so that it is safe to pass to snprintf
+static int raster_pattern_valid(const char *pattern) {
+    int conversions = 0;
+    for (const char *c = pattern; *c != '\0'; c++) {
+        if (*c != '%') {
+            continue;
+        }
+        if (*++c == '%') {
+            continue;
+        }
+        c += strspn(c, "-+ #0");
+        c += strspn(c, "0123456789");
+        if (*c == '.') {
+            c++;
+            c += strspn(c, "0123456789");
+        }
+        if (*c != 'd' && *c != 'i') {
+            return 0;
+        }
+        conversions++;
+    }
+
+    return conversions == 1;
+}
+
+// Starts the output thread of a sequence of frames
+//
+// Arguments:
+// - output: the output to initialize
+// - pattern: the printf pattern of the PNG files with a single int
+//   conversion (e.g. frames/%05d.png), or NULL to write raw RGBA frames to
+//   the raw stream
+// - raw: the stream of the raw frames
+// - width: the width of the frames (in pixels)
+// - height: the height of the frames (in pixels)
+//
+// Returns 0 on success and -1 on failure
+int raster_output_open(struct raster_output *output, const char *pattern,
+                       FILE *raw, int width, int height) {
+    memset(output, 0, sizeof(*output));
+    if (pattern != NULL && !raster_pattern_valid(pattern)) {
+        SPH_LOG_ERROR("Output pattern %s must have exactly one %%d conversion",
+                      pattern);
+        return -1;
+    }
+    output->raw = raw;
+    output->width = width;
+    output->height = height;
+    output->pattern = pattern != NULL ? strdup(pattern) : NULL;
+    output->pending = malloc((size_t)width * height * sizeof(Color));
+    if (output->pending == NULL ||
+        (pattern != NULL && output->pattern == NULL)) {
+        SPH_LOG_ERROR("Could not allocate the output frame");
+        free(output->pending);
+        free(output->pattern);
+        return -1;
+    }
+
+    pthread_mutex_init(&output->lock, NULL);
+    pthread_cond_init(&output->cond, NULL);
+    pthread_create(&output->thread, NULL, raster_output_thread, output);
+
+    return 0;
+}
+
+// Hands a copy of the current frame to the output thread, waiting for the
+// previous frame to be written first
+//
+// Returns 0 on success and -1 if a previous frame could not be written
+int raster_output_write(struct raster_output *output,
+                        const struct raster *raster) {
+    pthread_mutex_lock(&output->lock);
+    while (output->busy) {
+        pthread_cond_wait(&output->cond, &output->lock);
+    }
+    memcpy(output->pending, raster->pixels,
+           (size_t)output->width * output->height * sizeof(Color));
+    output->frame++;
+    output->busy = 1;
+    int error = output->error;
+    pthread_cond_broadcast(&output->cond);
+    pthread_mutex_unlock(&output->lock);
+
+    return error ? -1 : 0;
+}
+
+// Waits for the last frame and stops the output thread
+void raster_output_close(struct raster_output *output) {
+    pthread_mutex_lock(&output->lock);
+    output->quit = 1;
+    pthread_cond_broadcast(&output->cond);
+    pthread_mutex_unlock(&output->lock);
+    pthread_join(output->thread, NULL);
+
+    if (output->raw != NULL) {
+        fflush(output->raw);
+    }
+    free(output->pending);
+    free(output->pattern);
+    pthread_mutex_destroy(&output->lock);
+    pthread_cond_destroy(&output->cond);
+}
@@ -0,0 +1,81 @@
+#ifndef RASTER_H
+#define RASTER_H
+
+#include "pressure_field.h"
+#include "simulation.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+
+// Size of the square tiles rendered by one worker at a time (in pixels)
+#define RASTER_TILE_SIZE 64
+
+// Size of a cell of the pressure field drawn under the particles, the same
+// as in the window of the main executable (in meters)
+#define RASTER_FIELD_CELL_SIZE 0.25f
+
+// Software renderer for machines without a window or an OpenGL context
+//
+// The frame is split in tiles. The particles are binned into the tiles they
+// overlap on the main thread, then the workers take the tiles one by one and
+// draw the pressure field and the particles of each tile, so no two workers
+// ever write the same pixel.
+struct raster {
+        int width;             // Width of a frame (in pixels)
+        int height;            // Height of a frame (in pixels)
+        float scale;           // Pixels per meter
+        Color background;      // Color of the pixels without field
+        Color particle_color;  // Color of the particles
+        Color *pixels;         // The frame, row major RGBA
+
+        // Tiles
+        int tiles_x;
+        int tiles_y;
+        int *tile_start; // Offset of the particles of each tile in tile_items
+        int *tile_items; // Particle indices grouped by tile
+        int item_capacity;
+        atomic_int next_tile;
+
+        const struct pressure_field *field; // Field of the frame being drawn
+};
+
+// Writes the rendered frames from a dedicated thread
+//
+// Frames go either to numbered PNG files or as raw RGBA to a stream. The
+// next frame waits for the previous one to be written, every frame of a
+// report matters so none is dropped.
+struct raster_output {
+        char *pattern; // printf pattern of the PNG files, NULL for raw frames
+        FILE *raw;     // Stream of the raw frames
+        int width;
+        int height;
+        Color *pending; // Copy of the frame being written
+        long frame;     // Number of frames handed to the thread
+        int busy;       // Whether the thread is writing a frame
+        int quit;
+        int error;
+        pthread_mutex_t lock;
+        pthread_cond_t cond;
+        pthread_t thread;
+};
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+int raster_init(struct raster *raster, int width, int height, float scale);
+void raster_render(struct raster *raster, struct simulation *sim,
+                   const struct pressure_field *field);
+void raster_free(struct raster *raster);
+
+int raster_output_open(struct raster_output *output, const char *pattern,
+                       FILE *raw, int width, int height);
+int raster_output_write(struct raster_output *output,
+                        const struct raster *raster);
+void raster_output_close(struct raster_output *output);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif // RASTER_H
@@ -1,11 +1,17 @@
 #include "raylib_extensions.h"
-#include "rlgl.h"
 #include <math.h>
 
+// The web build has no rlgl, raylib.js implements the drawing functions
+// below as imports instead
+#ifndef SPH_NO_RLGL
+#include "rlgl.h"
+#endif
+
 float GetRandomFloat(float min, float max) {
     return min + GetRandomValue(0, 10000) / 10000.0f * (max - min);
 }
 
+#ifndef SPH_NO_RLGL
 void DrawCircleGradientV(Vector2 position, float radius, Color color1,
                          Color color2) {
     rlBegin(RL_TRIANGLES);
@@ -22,6 +28,83 @@ void DrawCircleGradientV(Vector2 position, float radius, Color color1,
     rlEnd();
 }
 
+// Size of the circle texture of the particle batches (in pixels)
+#define PARTICLE_TEXTURE_SIZE 64
+
+// Quads submitted between two checks of the render batch, well below the
+// capacity of the default batch
+#define PARTICLE_BATCH_QUADS 1024
+
+// The circle texture shared by all the particle batches, loaded on the first
+// draw and released with the window
+static Texture2D particle_texture = {0};
+
+static void LoadParticleTexture(void) {
+    Image image = GenImageColor(PARTICLE_TEXTURE_SIZE, PARTICLE_TEXTURE_SIZE,
+                                BLANK);
+    Color *pixels = (Color *)image.data;
+    float center = PARTICLE_TEXTURE_SIZE / 2.0f;
+    for (int y = 0; y < PARTICLE_TEXTURE_SIZE; y++) {
+        for (int x = 0; x < PARTICLE_TEXTURE_SIZE; x++) {
+            float dx = x + 0.5f - center;
+            float dy = y + 0.5f - center;
+            // One pixel of antialiasing on the edge of the disc
+            float coverage = center - sqrtf(dx * dx + dy * dy);
+            coverage = coverage < 0.0f ? 0.0f : coverage > 1.0f ? 1.0f : coverage;
+            pixels[y * PARTICLE_TEXTURE_SIZE + x] =
+                (Color){255, 255, 255, (unsigned char)(coverage * 255.0f)};
+        }
+    }
+
+    particle_texture = LoadTextureFromImage(image);
+    UnloadImage(image);
+    SetTextureFilter(particle_texture, TEXTURE_FILTER_BILINEAR);
+}
+
+// Draws discs of the same radius and color as textured quads
+//
+// All the quads share one texture, so they end up in a handful of draw calls
+// of the render batch instead of one tessellated circle per particle.
+//
+// Arguments:
+// - positions: the centers of the discs (in screen coordinates)
+// - count: the number of discs
+// - radius: the radius of the discs (in pixels)
+// - color: the color of the discs
+void DrawParticlesBatch(const Vector2 *positions, int count, float radius,
+                        Color color) {
+    if (particle_texture.id == 0) {
+        LoadParticleTexture();
+    }
+
+    rlSetTexture(particle_texture.id);
+    for (int start = 0; start < count; start += PARTICLE_BATCH_QUADS) {
+        int end = start + PARTICLE_BATCH_QUADS < count
+                      ? start + PARTICLE_BATCH_QUADS
+                      : count;
+        rlCheckRenderBatchLimit(4 * (end - start));
+
+        rlBegin(RL_QUADS);
+        rlColor4ub(color.r, color.g, color.b, color.a);
+        rlNormal3f(0.0f, 0.0f, 1.0f);
+        for (int i = start; i < end; i++) {
+            float x = positions[i].x;
+            float y = positions[i].y;
+            rlTexCoord2f(0.0f, 0.0f);
+            rlVertex2f(x - radius, y - radius);
+            rlTexCoord2f(0.0f, 1.0f);
+            rlVertex2f(x - radius, y + radius);
+            rlTexCoord2f(1.0f, 1.0f);
+            rlVertex2f(x + radius, y + radius);
+            rlTexCoord2f(1.0f, 0.0f);
+            rlVertex2f(x + radius, y - radius);
+        }
+        rlEnd();
+    }
+    rlSetTexture(0);
+}
+#endif // SPH_NO_RLGL
+
 float Max(float a, float b) { return a > b ? a : b; }
 
 Vector2 Vector2Random(float min, float max) {
@@ -6,6 +6,8 @@
 float GetRandomFloat(float min, float max);
 void DrawCircleGradientV(Vector2 position, float radius, Color color1,
                          Color color2);
+void DrawParticlesBatch(const Vector2 *positions, int count, float radius,
+                        Color color);
 float Max(float a, float b);
 Vector2 Vector2Random(float min, float max);
 Color ColorGradient(Color start, Color end, float t);
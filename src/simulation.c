@@ -0,0 +1,1105 @@
+#define INI_IMPLEMENTATION
+#include "ini.h"
+#include "simulation.h"
+#include "raylib.h"
+#include "raymath.h"
+#include "trace.h"
+#include <math.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Spins of a worker waiting at a barrier before it yields its core
+#define SIMULATION_BARRIER_SPINS 1000
+
+// The step is calibrated again once the particle count is this many times
+// larger or smaller than at the last calibration
+#define SIMULATION_TUNE_RATIO 2
+
+// Smallest number of particles claimed at a time
+#define SIMULATION_MIN_CHUNK 16
+
+// Neighbour evaluations of a calibration probe, the probe only claims as
+// many of the first particles as this allows
+#define SIMULATION_PROBE_INTERACTIONS (1 << 18)
+
+// Each candidate keeps the fastest of this many probes
+#define SIMULATION_PROBE_REPEATS 3
+
+// The calibration stops trying fewer workers once a candidate is this many
+// times slower than the best one, or once it ran for this long (in seconds)
+#define SIMULATION_TUNE_PRUNE 1.5
+#define SIMULATION_TUNE_BUDGET 0.05
+
+#define ASSERT(condition, format, ...)                                         \
+    do {                                                                       \
+        if (!(condition)) {                                                    \
+            INI_PANIC(format, ##__VA_ARGS__);                                  \
+        }                                                                      \
+    } while (0)
+
+int parse_bool(const char *value) {
+    return strcmp(value, "true") == 0 || strcmp(value, "yes") == 0 ||
+           atoi(value) != 0;
+}
+
+// Returns the number of threads, SIMULATION_THREADS_AUTO for "auto"
+static int parse_threads(const char *value) {
+    if (strcmp(value, "auto") == 0) {
+        return SIMULATION_THREADS_AUTO;
+    }
+    int threads = atoi(value);
+    return threads > 0 ? threads : 1;
+}
+
+static int parse_numa_policy(const char *value, enum numa_policy *policy) {
+    if (strcmp(value, "default") == 0 || strcmp(value, "none") == 0) {
+        *policy = NUMA_DEFAULT;
+    } else if (strcmp(value, "interleave") == 0) {
+        *policy = NUMA_INTERLEAVE;
+    } else if (strcmp(value, "local") == 0) {
+        *policy = NUMA_LOCAL;
+    } else {
+        return -1;
+    }
+
+    return 0;
+}
+
+static int parse_partition(const char *value,
+                           enum simulation_partition *partition) {
+    if (strcmp(value, "index") == 0) {
+        *partition = SIMULATION_PARTITION_INDEX;
+    } else if (strcmp(value, "slabs") == 0) {
+        *partition = SIMULATION_PARTITION_SLABS;
+    } else {
+        return -1;
+    }
+
+    return 0;
+}
+
+static int parse_kernel_type(const char *value, enum kernel_type *type) {
+    if (strcmp(value, "gaussian") == 0) {
+        *type = GAUSSIAN_KERNEL;
+    } else if (strcmp(value, "linear") == 0) {
+        *type = LINEAR_KERNEL;
+    } else if (strcmp(value, "cubic") == 0) {
+        *type = CUBIC_KERNEL;
+    } else {
+        return -1;
+    }
+
+    return 0;
+}
+
+static int parse_pressure_type(const char *value, enum pressure_type *type) {
+    if (strcmp(value, "cole") == 0) {
+        *type = COLE_PRESSURE;
+    } else if (strcmp(value, "gas") == 0) {
+        *type = GAS_PRESSURE;
+    } else {
+        return -1;
+    }
+
+    return 0;
+}
+
+static int parse_export_format(const char *value, enum export_format *format) {
+    if (strcmp(value, "vtu") == 0) {
+        *format = EXPORT_VTU;
+    } else if (strcmp(value, "csv") == 0) {
+        *format = EXPORT_CSV;
+    } else {
+        return -1;
+    }
+
+    return 0;
+}
+
+// Reads the simulation parameters from an ini file
+//
+// Missing required keys are fatal, the optional ones get a default value
+void simulation_parameters_parse(const char *filename,
+                                 struct simulation_parameters *params) {
+    FILE *file = fopen(filename, "r");
+    if (file == NULL) {
+        fprintf(stderr, "Error: Could not open file %s\n", filename);
+        exit(1);
+    }
+
+    int buffer_count = 0;
+    int buffer_capacity = 256;
+    char *buffer = calloc(buffer_capacity, sizeof(char));
+    ASSERT(buffer != NULL, "Could not allocate memory");
+    char line[256];
+    while (fgets(line, sizeof(line), file)) {
+        int len = strlen(line);
+        if (buffer_count + len + 1 >= buffer_capacity) {
+            buffer_capacity = buffer_capacity * 2 + len;
+            buffer = realloc(buffer, buffer_capacity * sizeof(char));
+            ASSERT(buffer != NULL, "Could not allocate memory");
+        }
+
+        strcpy(buffer + buffer_count, line);
+        buffer_count += len;
+        buffer[buffer_count] = '\0';
+    }
+
+    struct ini_file ini = {0};
+    ini_parse(&ini, buffer);
+
+    char *value = NULL;
+
+    value = ini_get_value(&ini, "program", "threads");
+    if (value != NULL) {
+        params->threads = parse_threads(value);
+        free(value);
+    } else {
+        params->threads = 1;
+    }
+
+    // Kept for the whole run, so it is not freed
+    params->affinity = ini_get_value(&ini, "program", "affinity");
+
+    value = ini_get_value(&ini, "program", "numa");
+    params->numa = NUMA_DEFAULT;
+    if (value != NULL) {
+        ASSERT(parse_numa_policy(value, &params->numa) == 0,
+               "Invalid numa policy");
+        free(value);
+    }
+
+    value = ini_get_value(&ini, "program", "partition");
+    params->partition = SIMULATION_PARTITION_INDEX;
+    if (value != NULL) {
+        ASSERT(parse_partition(value, &params->partition) == 0,
+               "Invalid partition");
+        free(value);
+    }
+
+    value = ini_get_value(&ini, "world", "particle_count");
+    ASSERT(value != NULL, "Could not find particle_count");
+    params->particle_count = atoi(value);
+    free(value);
+
+    value = ini_get_value(&ini, "world", "gravity");
+    ASSERT(value != NULL, "Could not find gravity");
+    params->gravity = atof(value);
+    free(value);
+
+    value = ini_get_value(&ini, "world", "width");
+    params->width = value != NULL ? atof(value) : SIMULATION_DEFAULT_WIDTH;
+    free(value);
+
+    value = ini_get_value(&ini, "world", "height");
+    params->height = value != NULL ? atof(value) : SIMULATION_DEFAULT_HEIGHT;
+    free(value);
+
+    value = ini_get_value(&ini, "world", "seed");
+    params->seed = value != NULL ? strtoul(value, NULL, 10) : 0;
+    free(value);
+
+    params->initial = ini_get_value(&ini, "world", "initial");
+
+    value = ini_get_value(&ini, "particle", "radius");
+    ASSERT(value != NULL, "Could not find particle_radius");
+    params->particle_radius = atof(value);
+    free(value);
+
+    value = ini_get_value(&ini, "particle", "mass");
+    ASSERT(value != NULL, "Could not find particle_mass");
+    params->particle_mass = atof(value);
+    free(value);
+
+    value = ini_get_value(&ini, "particle", "damping");
+    ASSERT(value != NULL, "Could not find damping");
+    params->damping = atof(value);
+    free(value);
+
+    char *value1 = ini_get_value(&ini, "pressure", "type");
+    ASSERT(value1 != NULL, "Could not find pressure_type");
+    ASSERT(parse_pressure_type(value1, &params->pressure_type) == 0,
+           "Invalid pressure type");
+    if (params->pressure_type == COLE_PRESSURE) {
+        value = ini_get_value(&ini, "pressure.cole", "rest_density");
+        ASSERT(value != NULL, "Could not find rest_density");
+        params->rest_density = atof(value);
+        free(value);
+
+        value = ini_get_value(&ini, "pressure.cole", "adiabatic_index");
+        ASSERT(value != NULL, "Could not find adiabatic_index");
+        params->adiabatic_index = atof(value);
+        free(value);
+
+        value = ini_get_value(&ini, "pressure.cole", "speed_of_sound");
+        ASSERT(value != NULL, "Could not find speed_of_sound");
+        params->speed_of_sound = atof(value);
+        free(value);
+
+        value = ini_get_value(&ini, "pressure.cole", "background_pressure");
+        ASSERT(value != NULL, "Could not find background_pressure");
+        params->background_pressure = atof(value);
+        free(value);
+    } else {
+        value = ini_get_value(&ini, "pressure.gas", "rest_density");
+        ASSERT(value != NULL, "Could not find rest_density");
+        params->rest_density = atof(value);
+        free(value);
+
+        value = ini_get_value(&ini, "pressure.gas", "pressure_multiplier");
+        ASSERT(value != NULL, "Could not find pressure_multiplier");
+        params->pressure_multiplier = atof(value);
+        free(value);
+    }
+    free(value1);
+
+    value = ini_get_value(&ini, "kernel", "type");
+    ASSERT(value != NULL, "Could not find kernel_type");
+    ASSERT(parse_kernel_type(value, &params->kernel_type) == 0,
+           "Invalid kernel type");
+    free(value);
+
+    value = ini_get_value(&ini, "kernel", "h");
+    ASSERT(value != NULL, "Could not find h");
+    params->h = atof(value);
+    free(value);
+
+    value = ini_get_value(&ini, "headless", "steps");
+    params->steps = value != NULL ? atoi(value) : 1000;
+    free(value);
+
+    value = ini_get_value(&ini, "headless", "dt");
+    params->dt = value != NULL ? atof(value) : 1.0f / 60.0f;
+    free(value);
+
+    value = ini_get_value(&ini, "profiling", "overlay");
+    if (value != NULL) {
+        params->timing_overlay = parse_bool(value);
+        free(value);
+    } else {
+        params->timing_overlay = 0;
+    }
+
+    // The values are kept for the whole run, so they are not freed
+    params->timing_csv = ini_get_value(&ini, "profiling", "timing_csv");
+    params->trace = ini_get_value(&ini, "profiling", "trace");
+
+    value = ini_get_value(&ini, "profiling", "perf_counters");
+    if (value != NULL) {
+        params->perf_counters = parse_bool(value);
+        free(value);
+    } else {
+        params->perf_counters = 0;
+    }
+
+    params->checkpoint_restart = ini_get_value(&ini, "checkpoint", "restart");
+    params->checkpoint_file = ini_get_value(&ini, "checkpoint", "file");
+
+    value = ini_get_value(&ini, "checkpoint", "every");
+    params->checkpoint_every = value != NULL ? atoi(value) : 0;
+    free(value);
+
+    params->trajectory_file = ini_get_value(&ini, "trajectory", "file");
+
+    value = ini_get_value(&ini, "trajectory", "every");
+    params->trajectory_every = value != NULL ? atoi(value) : 1;
+    free(value);
+
+    value = ini_get_value(&ini, "trajectory", "keyframe");
+    params->trajectory_keyframe = value != NULL ? atoi(value) : 30;
+    free(value);
+
+    value = ini_get_value(&ini, "trajectory", "compress");
+    params->trajectory_compress = value != NULL ? parse_bool(value) : 0;
+    free(value);
+
+    value = ini_get_value(&ini, "trajectory", "buffers");
+    params->trajectory_buffers = value != NULL ? atoi(value) : 4;
+    free(value);
+
+    params->export_prefix = ini_get_value(&ini, "export", "prefix");
+
+    value = ini_get_value(&ini, "export", "format");
+    params->export_format = EXPORT_VTU;
+    if (value != NULL) {
+        ASSERT(parse_export_format(value, &params->export_format) == 0,
+               "Invalid export format");
+        free(value);
+    }
+
+    value = ini_get_value(&ini, "export", "every");
+    params->export_every = value != NULL ? atoi(value) : 0;
+    free(value);
+
+    params->render_output = ini_get_value(&ini, "render", "output");
+
+    value = ini_get_value(&ini, "render", "every");
+    params->render_every = value != NULL ? atoi(value) : 1;
+    free(value);
+
+    value = ini_get_value(&ini, "render", "width");
+    params->render_width = value != NULL ? atoi(value) : 800;
+    free(value);
+
+    value = ini_get_value(&ini, "render", "height");
+    params->render_height = value != NULL ? atoi(value) : 600;
+    free(value);
+
+    value = ini_get_value(&ini, "render", "pressure");
+    params->render_pressure = value != NULL ? parse_bool(value) : 0;
+    free(value);
+
+    ini_free(&ini);
+    free(buffer);
+    fclose(file);
+}
+
+// Overrides a single parameter, using the same section and key names as the
+// ini file (e.g. section "pressure.gas", key "rest_density")
+//
+// Returns 0 on success and -1 if the key or the value is invalid
+int simulation_parameters_set(struct simulation_parameters *params,
+                              const char *section, const char *key,
+                              const char *value) {
+    if (strcmp(section, "program") == 0 && strcmp(key, "threads") == 0) {
+        params->threads = parse_threads(value);
+    } else if (strcmp(section, "program") == 0 && strcmp(key, "numa") == 0) {
+        return parse_numa_policy(value, &params->numa);
+    } else if (strcmp(section, "program") == 0 &&
+               strcmp(key, "partition") == 0) {
+        return parse_partition(value, &params->partition);
+    } else if (strcmp(section, "world") == 0) {
+        if (strcmp(key, "particle_count") == 0) {
+            params->particle_count = atoi(value);
+        } else if (strcmp(key, "gravity") == 0) {
+            params->gravity = atof(value);
+        } else if (strcmp(key, "width") == 0) {
+            params->width = atof(value);
+        } else if (strcmp(key, "height") == 0) {
+            params->height = atof(value);
+        } else if (strcmp(key, "seed") == 0) {
+            params->seed = strtoul(value, NULL, 10);
+        } else {
+            return -1;
+        }
+    } else if (strcmp(section, "particle") == 0) {
+        if (strcmp(key, "radius") == 0) {
+            params->particle_radius = atof(value);
+        } else if (strcmp(key, "mass") == 0) {
+            params->particle_mass = atof(value);
+        } else if (strcmp(key, "damping") == 0) {
+            params->damping = atof(value);
+        } else {
+            return -1;
+        }
+    } else if (strcmp(section, "pressure") == 0 && strcmp(key, "type") == 0) {
+        return parse_pressure_type(value, &params->pressure_type);
+    } else if (strcmp(section, "pressure.cole") == 0 ||
+               strcmp(section, "pressure.gas") == 0) {
+        if (strcmp(key, "rest_density") == 0) {
+            params->rest_density = atof(value);
+        } else if (strcmp(key, "adiabatic_index") == 0) {
+            params->adiabatic_index = atof(value);
+        } else if (strcmp(key, "speed_of_sound") == 0) {
+            params->speed_of_sound = atof(value);
+        } else if (strcmp(key, "background_pressure") == 0) {
+            params->background_pressure = atof(value);
+        } else if (strcmp(key, "pressure_multiplier") == 0) {
+            params->pressure_multiplier = atof(value);
+        } else {
+            return -1;
+        }
+    } else if (strcmp(section, "kernel") == 0) {
+        if (strcmp(key, "type") == 0) {
+            return parse_kernel_type(value, &params->kernel_type);
+        } else if (strcmp(key, "h") == 0) {
+            params->h = atof(value);
+        } else {
+            return -1;
+        }
+    } else if (strcmp(section, "headless") == 0) {
+        if (strcmp(key, "steps") == 0) {
+            params->steps = atoi(value);
+        } else if (strcmp(key, "dt") == 0) {
+            params->dt = atof(value);
+        } else {
+            return -1;
+        }
+    } else if (strcmp(section, "checkpoint") == 0 &&
+               strcmp(key, "every") == 0) {
+        params->checkpoint_every = atoi(value);
+    } else if (strcmp(section, "export") == 0 && strcmp(key, "format") == 0) {
+        return parse_export_format(value, &params->export_format);
+    } else {
+        return -1;
+    }
+
+    return 0;
+}
+
+// Fills the parameters of the selected equation of state
+//
+// Returns a pointer to the storage, ready to be passed to pressure_value
+void *simulation_pressure_params(const struct simulation_parameters *params,
+                                 union pressure_params *storage) {
+    switch (params->pressure_type) {
+    case COLE_PRESSURE:
+        storage->cole = (struct pressure_cole_params){
+            .rest_density = params->rest_density,
+            .speed_of_sound = params->speed_of_sound,
+            .adiabatic_index = params->adiabatic_index,
+            .background_pressure = params->background_pressure,
+        };
+        break;
+    case GAS_PRESSURE:
+        storage->gas = (struct pressure_gas_params){
+            .rest_density = params->rest_density,
+            .pressure_multiplier = params->pressure_multiplier,
+        };
+        break;
+    }
+
+    return storage;
+}
+
+// Starts profiling the first phase of a thread
+//
+// Returns the current time for the timing laps
+double profile_start(struct perf_table *perf, int slot) {
+    perf_sample(perf, slot);
+    return timing_now();
+}
+
+// Closes a phase of a thread in every profiler
+//
+// Returns the current time so that the next phase can be chained
+double profile_lap(struct timing_table *timing, struct perf_table *perf,
+                   int slot, enum timing_phase phase, double since) {
+    perf_lap(perf, slot, phase);
+    return timing_lap(timing, slot, phase, since);
+}
+
+// Publishes the parameters to the workers if they changed since the last
+// step
+//
+// The next snapshot is filled while the workers are parked and swapped in
+// with a release store, a worker loads the pointer once per task. Edits
+// made between two steps thus reach the workers all at once and the derived
+// constants are computed once per edit instead of once per particle. The
+// tasks run outside of a step publish the parameters first too.
+//
+// Returns the published snapshot
+const struct simulation_snapshot *simulation_publish(struct simulation *sim) {
+    const struct simulation_snapshot *current =
+        atomic_load_explicit(&sim->snapshot, memory_order_relaxed);
+    if (current != NULL &&
+        memcmp(&current->params, &sim->params, sizeof(sim->params)) == 0) {
+        return current;
+    }
+
+    struct simulation_snapshot *next = current == &sim->snapshots[0]
+                                           ? &sim->snapshots[1]
+                                           : &sim->snapshots[0];
+
+    // Copied with the padding so that the comparison above holds
+    memcpy(&next->params, &sim->params, sizeof(sim->params));
+    kernel_coefficients_init(&next->kernel, next->params.h,
+                             next->params.kernel_type);
+    union pressure_params storage;
+    pressure_coefficients_init(
+        &next->pressure, simulation_pressure_params(&next->params, &storage),
+        next->params.pressure_type);
+    next->gravity = (Vector2){0.0f, next->params.gravity};
+
+    atomic_store_explicit(&sim->snapshot, next, memory_order_release);
+
+    return next;
+}
+
+static void resolve_collisions(struct particle *particle, Vector2 position,
+                               const struct simulation_parameters *params) {
+    if (position.x < 0) {
+        position.x = 0;
+        particle->velocity.x *= -1.0f * params->damping;
+    } else if (position.x > params->width) {
+        position.x = params->width;
+        particle->velocity.x *= -1.0f * params->damping;
+    }
+
+    if (position.y < 0) {
+        position.y = 0;
+        particle->velocity.y *= -1.0f * params->damping;
+    } else if (position.y > params->height) {
+        position.y = params->height;
+        particle->velocity.y *= -1.0f * params->damping;
+    }
+
+    particle->position = position;
+}
+
+// Waits until count workers reached the barrier
+//
+// The phases of a step are short, so the workers spin for a while before
+// giving up their core.
+static void simulation_barrier_wait(struct simulation_barrier *barrier,
+                                    int count) {
+    int generation =
+        atomic_load_explicit(&barrier->generation, memory_order_acquire);
+    if (atomic_fetch_add_explicit(&barrier->arrived, 1, memory_order_acq_rel) ==
+        count - 1) {
+        atomic_store_explicit(&barrier->arrived, 0, memory_order_relaxed);
+        atomic_fetch_add_explicit(&barrier->generation, 1,
+                                  memory_order_release);
+        return;
+    }
+
+    for (int spins = 0;
+         atomic_load_explicit(&barrier->generation, memory_order_acquire) ==
+         generation;
+         spins++) {
+        if (spins >= SIMULATION_BARRIER_SPINS) {
+            sched_yield();
+        }
+    }
+}
+
+// Splits the particles evenly between the active workers, one chunk each
+static void simulation_split(struct simulation *sim) {
+    int count = sim->particles.count;
+    sim->chunk = (count + sim->active - 1) / sim->active;
+    sim->chunk = sim->chunk > 0 ? sim->chunk : 1;
+}
+
+// Claims the next chunk of particles of a phase
+//
+// The first claim of a worker is the chunk at its index, so that a worker
+// keeps the same particles from one step to the next while the split does
+// not change, and only the rest is shared. It is the range the worker
+// touched first only with the static split of the initial particles, a
+// calibration or a change of the count moves it. With slabs a worker only
+// claims its slab.
+//
+// Arguments:
+// - sim: the simulation
+// - phase: the phase the particles are claimed for
+// - index: the index of the worker
+// - claimed: the number of chunks the worker claimed in the phase so far
+// - start, end: the range of the claimed particles
+//
+// Returns 1 and sets the range if particles are left, 0 otherwise
+static int simulation_claim(struct simulation *sim, enum simulation_phase phase,
+                            int index, int *claimed, int *start, int *end) {
+    int count = sim->limit;
+    ASSERT(sim->chunk > 0, "Invalid chunk of %d particles", sim->chunk);
+    if (sim->slabbed) {
+        *start = sim->slabs.first[index];
+        *end = sim->slabs.first[index + 1];
+        return (*claimed)++ == 0 && *start < *end;
+    }
+    if ((*claimed)++ == 0) {
+        *start = index * sim->chunk;
+    } else {
+        *start = atomic_fetch_add_explicit(&sim->next[phase], sim->chunk,
+                                           memory_order_relaxed);
+    }
+    if (*start >= count) {
+        return 0;
+    }
+    *end = *start + sim->chunk < count ? *start + sim->chunk : count;
+
+    return 1;
+}
+
+// Waits for the other workers and accounts the wait to the barrier phase
+static double worker_barrier_wait(struct simulation *sim, int index,
+                                  double t) {
+    SPH_TRACE_BEGIN(index, "barrier");
+    simulation_barrier_wait(&sim->barrier, sim->active);
+    SPH_TRACE_END(index, "barrier");
+    return profile_lap(sim->timing, sim->perf, index, TIMING_BARRIER, t);
+}
+
+// One step of the simulation on the chunks of particles claimed by a worker
+static void simulation_step_task(struct simulation *sim, int index,
+                                 void *user) {
+    if (index >= sim->active) {
+        return;
+    }
+
+    struct particle_array *particles = &sim->particles;
+    const struct simulation_snapshot *snapshot =
+        atomic_load_explicit(&sim->snapshot, memory_order_acquire);
+    const struct simulation_parameters *params = &snapshot->params;
+    float dt = sim->dt;
+    int start, end, claimed;
+
+    int keep_accelerations = sim->pressure_acceleration_count == particles->count;
+
+    // The neighbours of a slab are the particles of its halo, index `i` of
+    // the particles is `i - offset` among them
+    struct particle_array neighbours = *particles;
+    int offset = 0;
+    if (sim->slabbed) {
+        offset = sim->slabs.halo_start[index];
+        neighbours.items += offset;
+        neighbours.count = sim->slabs.halo_end[index] - offset;
+    }
+
+    double t = profile_start(sim->perf, index);
+    double begin = t;
+    double busy = 0.0;
+
+    SPH_TRACE_BEGIN(index, "density");
+    claimed = 0;
+    while (simulation_claim(sim, SIMULATION_PHASE_DENSITY, index, &claimed,
+                            &start, &end)) {
+        for (int i = start; i < end; i++) {
+            particles->items[i].density = particle_density_kernel(
+                &neighbours, i - offset, &snapshot->kernel,
+                params->particle_mass);
+            particles->items[i].pressure = pressure_evaluate(
+                &snapshot->pressure, particles->items[i].density);
+        }
+    }
+    SPH_TRACE_END(index, "density");
+
+    t = profile_lap(sim->timing, sim->perf, index, TIMING_DENSITY, t);
+    busy += t - begin;
+    t = worker_barrier_wait(sim, index, t);
+
+    SPH_TRACE_BEGIN(index, "gradient");
+    begin = t;
+    claimed = 0;
+    while (simulation_claim(sim, SIMULATION_PHASE_GRADIENT, index, &claimed,
+                            &start, &end)) {
+        for (int i = start; i < end; i++) {
+            Vector2 pressure_gradient = particle_pressure_gradient_kernel(
+                &neighbours, i - offset, &snapshot->kernel,
+                params->particle_mass);
+
+            Vector2 pressure_acceleration = Vector2Scale(
+                pressure_gradient, 1.0f / particles->items[i].density);
+            if (keep_accelerations) {
+                sim->pressure_accelerations[i] = pressure_acceleration;
+            }
+
+            Vector2 acceleration =
+                Vector2Add(pressure_acceleration, snapshot->gravity);
+
+            particles->items[i].velocity = Vector2Add(
+                particles->items[i].velocity, Vector2Scale(acceleration, dt));
+        }
+    }
+    SPH_TRACE_END(index, "gradient");
+
+    t = profile_lap(sim->timing, sim->perf, index, TIMING_GRADIENT, t);
+    busy += t - begin;
+    t = worker_barrier_wait(sim, index, t);
+
+    SPH_TRACE_BEGIN(index, "integrate");
+    begin = t;
+    claimed = 0;
+    while (simulation_claim(sim, SIMULATION_PHASE_INTEGRATE, index, &claimed,
+                            &start, &end)) {
+        for (int i = start; i < end; i++) {
+            Vector2 position =
+                Vector2Add(particles->items[i].position,
+                           Vector2Scale(particles->items[i].velocity, dt));
+
+            resolve_collisions(&particles->items[i], position, params);
+        }
+    }
+    SPH_TRACE_END(index, "integrate");
+
+    t = profile_lap(sim->timing, sim->perf, index, TIMING_INTEGRATE, t);
+    busy += t - begin;
+    if (sim->slabbed) {
+        sim->slabs.busy[index] = busy;
+    }
+    worker_barrier_wait(sim, index, t);
+}
+
+static void *simulation_worker_thread(void *args) {
+    struct simulation_worker *w = (struct simulation_worker *)args;
+    struct simulation *sim = w->sim;
+
+    // Pinned before anything is allocated, so the first touch of the worker
+    // places its pages on its node
+    int cpu = sim->cpus[w->index];
+    if (cpu >= 0 && affinity_pin(cpu) != 0) {
+        SPH_LOG_WARN("Could not pin worker %d to CPU %d", w->index, cpu);
+    }
+    if (sim->params.numa == NUMA_LOCAL && numa_prefer_local() != 0) {
+        SPH_LOG_WARN("Could not prefer the local node of worker %d", w->index);
+    }
+
+    for (;;) {
+        pthread_barrier_wait(&sim->start_barrier);
+        if (sim->quit) {
+            break;
+        }
+
+        // The counters count the calling thread, so they are opened here
+        if (sim->perf != NULL && !w->perf_open) {
+            perf_thread_open(sim->perf, w->index);
+            w->perf_open = 1;
+        }
+
+        SPH_TRACE_BEGIN(w->index, "task");
+        sim->task(sim, w->index, sim->task_user);
+        SPH_TRACE_END(w->index, "task");
+
+        pthread_barrier_wait(&sim->done_barrier);
+    }
+
+    return NULL;
+}
+
+// Touches the static range of the particles of a worker first, so that on
+// NUMA machines their pages are placed on the node of the worker that owns
+// them during the steps
+static void simulation_first_touch_task(struct simulation *sim, int index,
+                                        void *user) {
+    (void)user;
+    int count = sim->particles.count;
+    int chunk = (count + sim->threads - 1) / sim->threads;
+    int start = index * chunk < count ? index * chunk : count;
+    int end = start + chunk < count ? start + chunk : count;
+    if (end <= start) {
+        return;
+    }
+
+    struct particle *items = &sim->particles.items[start];
+    size_t size = (size_t)(end - start) * sizeof(struct particle);
+    memset(items, 0, size);
+    if (sim->params.numa == NUMA_LOCAL && numa_bind_local(items, size) != 0) {
+        SPH_LOG_WARN("Could not bind the particles of worker %d", index);
+    }
+}
+
+// Allocates the particles, initializes them at random positions and starts
+// the worker pool
+//
+// The workers are pinned to the CPUs of the affinity and touch their range
+// of the particles before they are filled. The caller seeds the random
+// generator, and may set the timing and perf tables before the first step.
+//
+// Returns 0 on success or -1 on failure
+int simulation_init(struct simulation *sim,
+                    const struct simulation_parameters *params) {
+    memset(sim, 0, sizeof(*sim));
+    sim->params = *params;
+    if (params->threads == SIMULATION_THREADS_AUTO) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        sim->threads = cores > 0 ? (int)cores : 1;
+        sim->auto_tune = 1;
+    } else {
+        sim->threads = params->threads > 0 ? params->threads : 1;
+    }
+    sim->active = sim->threads;
+    atomic_init(&sim->barrier.arrived, 0);
+    atomic_init(&sim->barrier.generation, 0);
+
+    if (particle_pool_init(&sim->pool, &sim->particles,
+                           PARTICLE_POOL_DEFAULT_MAX) != 0) {
+        return -1;
+    }
+    if (params->numa == NUMA_INTERLEAVE &&
+        numa_interleave(sim->particles.items, sim->pool.reserved) != 0) {
+        SPH_LOG_WARN("Could not interleave the particles over the nodes");
+    }
+
+    sim->cpus = calloc(sim->threads, sizeof(int));
+    sim->workers = calloc(sim->threads, sizeof(pthread_t));
+    sim->worker_args = calloc(sim->threads, sizeof(struct simulation_worker));
+    if (sim->cpus == NULL || sim->workers == NULL || sim->worker_args == NULL) {
+        SPH_LOG_ERROR("Could not allocate %d workers", sim->threads);
+        free(sim->cpus);
+        free(sim->workers);
+        free(sim->worker_args);
+        particle_pool_free(&sim->pool);
+        return -1;
+    }
+    if (affinity_plan(params->affinity, sim->threads, sim->cpus) != 0 ||
+        (params->partition == SIMULATION_PARTITION_SLABS &&
+         slab_partition_init(&sim->slabs, sim->threads) != 0)) {
+        free(sim->cpus);
+        free(sim->workers);
+        free(sim->worker_args);
+        particle_pool_free(&sim->pool);
+        return -1;
+    }
+
+    pthread_barrier_init(&sim->start_barrier, NULL, sim->threads + 1);
+    pthread_barrier_init(&sim->done_barrier, NULL, sim->threads + 1);
+
+    for (int i = 0; i < sim->threads; i++) {
+        sim->worker_args[i].sim = sim;
+        sim->worker_args[i].index = i;
+        pthread_create(&sim->workers[i], NULL, simulation_worker_thread,
+                       &sim->worker_args[i]);
+    }
+
+    if (params->initial != NULL) {
+        // The loader grows its own array, the particles are copied once
+        // they are placed
+        struct particle_array loaded = {0};
+        long count = particles_load(&loaded, params->initial, sim->threads);
+        if (count < 0 || particle_pool_resize(&sim->pool, count) != 0) {
+            free(loaded.items);
+            simulation_free(sim);
+            return -1;
+        }
+        simulation_run(sim, simulation_first_touch_task, NULL);
+        memcpy(sim->particles.items, loaded.items,
+               count * sizeof(struct particle));
+        free(loaded.items);
+        sim->params.particle_count = count;
+    } else {
+        if (particle_pool_resize(&sim->pool, params->particle_count) != 0) {
+            simulation_free(sim);
+            return -1;
+        }
+        simulation_run(sim, simulation_first_touch_task, NULL);
+        particles_init_rand(&sim->particles, params->width, params->height);
+    }
+    simulation_split(sim);
+
+    return 0;
+}
+
+// Runs a task on every worker and waits for all of them to finish
+//
+// Must be called from the thread that owns the simulation
+void simulation_run(struct simulation *sim, simulation_task task, void *user) {
+    sim->task = task;
+    sim->task_user = user;
+    pthread_barrier_wait(&sim->start_barrier);
+    pthread_barrier_wait(&sim->done_barrier);
+}
+
+// Runs one step with the current partition of the workers, over the first
+// `limit` particles
+static void simulation_run_step(struct simulation *sim, int limit) {
+    sim->limit = limit;
+    // The chunks before are the first claims of the active workers
+    for (int p = 0; p < SIMULATION_PHASE_COUNT; p++) {
+        atomic_store_explicit(&sim->next[p], sim->active * sim->chunk,
+                              memory_order_relaxed);
+    }
+    simulation_run(sim, simulation_step_task, NULL);
+}
+
+// Times the fastest of a few probe steps over the first `limit` particles
+//
+// Returns the time of the fastest probe (in seconds)
+static double simulation_probe(struct simulation *sim, int active, int chunk,
+                               int limit) {
+    sim->active = active;
+    sim->chunk = chunk;
+    double best = INFINITY;
+    for (int r = 0; r < SIMULATION_PROBE_REPEATS; r++) {
+        double start = timing_now();
+        simulation_run_step(sim, limit);
+        double elapsed = timing_now() - start;
+        best = elapsed < best ? elapsed : best;
+    }
+
+    return best;
+}
+
+// Calibrates the number of active workers and the chunk size of the step
+//
+// A candidate is probed with a zero time step over only as many of the first
+// particles as SIMULATION_PROBE_INTERACTIONS allows, and an empty probe
+// measures the cost of its barriers. The time of a whole step is projected
+// from the two, so a probe stays short however many particles there are.
+// The candidates go from every worker down to one and stop once fewer
+// workers are clearly slower or the budget is spent. The probed particles
+// are restored afterwards. Must be called while the workers are parked.
+void simulation_tune(struct simulation *sim) {
+    struct particle_array *particles = &sim->particles;
+    int count = particles->count;
+    sim->tuned_count = count;
+
+    // Kept if the probes cannot run
+    simulation_split(sim);
+    if (count == 0) {
+        return;
+    }
+
+    long limit = SIMULATION_PROBE_INTERACTIONS / count;
+    limit = limit > sim->threads ? limit : sim->threads;
+    limit = limit < count ? limit : count;
+
+    struct particle *saved = malloc(limit * sizeof(struct particle));
+    if (saved == NULL) {
+        SPH_LOG_WARN("Could not save %ld particles to tune the step", limit);
+        return;
+    }
+    memcpy(saved, particles->items, limit * sizeof(struct particle));
+
+    // The probes are not accounted to the profilers
+    struct timing_table *timing = sim->timing;
+    struct perf_table *perf = sim->perf;
+    sim->timing = NULL;
+    sim->perf = NULL;
+
+    simulation_publish(sim);
+    sim->dt = 0.0f;
+
+    static const int chunks_per_worker[] = {1, 4, 16};
+    double begin = timing_now();
+    double best = INFINITY;
+    int best_active = sim->active;
+    int best_chunk = sim->chunk;
+    int spent = 0;
+    for (int active = sim->threads; active >= 1 && !spent; active /= 2) {
+        double barriers = simulation_probe(sim, active, 1, 0);
+        double fastest = INFINITY;
+        int previous = 0;
+        for (size_t c = 0;
+             c < sizeof(chunks_per_worker) / sizeof(chunks_per_worker[0]); c++) {
+            int chunk = count / (active * chunks_per_worker[c]);
+            chunk = chunk > SIMULATION_MIN_CHUNK ? chunk : SIMULATION_MIN_CHUNK;
+            if (chunk == previous) {
+                continue;
+            }
+            previous = chunk;
+
+            // A shorter probe claims chunks in the same proportion
+            int probe_chunk = chunk;
+            if (limit < count) {
+                probe_chunk = (int)(limit / (active * chunks_per_worker[c]));
+                probe_chunk = probe_chunk > 0 ? probe_chunk : 1;
+            }
+            double elapsed =
+                simulation_probe(sim, active, probe_chunk, (int)limit);
+            double work = elapsed > barriers ? elapsed - barriers : 0.0;
+            double projected = barriers + work * count / limit;
+            fastest = projected < fastest ? projected : fastest;
+            if (projected < best) {
+                best = projected;
+                best_active = active;
+                best_chunk = chunk;
+            }
+            spent = timing_now() - begin > SIMULATION_TUNE_BUDGET;
+            if (spent) {
+                break;
+            }
+        }
+        if (fastest > SIMULATION_TUNE_PRUNE * best) {
+            break;
+        }
+    }
+
+    memcpy(particles->items, saved, limit * sizeof(struct particle));
+    free(saved);
+    sim->timing = timing;
+    sim->perf = perf;
+    sim->active = best_active;
+    sim->chunk = best_chunk;
+
+    SPH_LOG_INFO("Tuned the step of %d particles in %.3f ms: %d of %d "
+                 "workers, chunks of %d particles (%.3f ms projected)",
+                 count, (timing_now() - begin) * 1000.0, best_active,
+                 sim->threads, best_chunk, best * 1000.0);
+}
+
+// Advances the simulation by one step
+void simulation_step(struct simulation *sim, float dt) {
+    int count = sim->particles.count;
+    int slabs = sim->params.partition == SIMULATION_PARTITION_SLABS;
+
+    // The probes, and the step if the slabs cannot be planned, claim chunks
+    // of indices, so the chunk stays valid in both partitions. With slabs
+    // only the number of workers of the calibration is used.
+    sim->slabbed = 0;
+    if (sim->auto_tune && count > 0 &&
+        (sim->tuned_count == 0 ||
+         count > sim->tuned_count * SIMULATION_TUNE_RATIO ||
+         count * SIMULATION_TUNE_RATIO < sim->tuned_count)) {
+        simulation_tune(sim);
+    }
+    if (!sim->auto_tune) {
+        // The same ranges as a static split between the workers
+        simulation_split(sim);
+    }
+
+    if (count > sim->pressure_acceleration_capacity) {
+        Vector2 *accelerations =
+            realloc(sim->pressure_accelerations, count * sizeof(Vector2));
+        if (accelerations != NULL) {
+            sim->pressure_accelerations = accelerations;
+            sim->pressure_acceleration_capacity = count;
+        }
+    }
+    // The accelerations are skipped rather than failing the step
+    sim->pressure_acceleration_count =
+        count <= sim->pressure_acceleration_capacity ? count : 0;
+
+    const struct simulation_snapshot *snapshot = simulation_publish(sim);
+    if (slabs) {
+        // On failure the step falls back to the chunks of indices
+        int migrated = slab_partition_plan(
+            &sim->slabs, &sim->particles, sim->active, sim->params.width,
+            kernel_support(&snapshot->kernel));
+        sim->slabbed = migrated >= 0;
+        sim->reorders += migrated > 0;
+    }
+    sim->dt = dt;
+    simulation_run_step(sim, count);
+    sim->step++;
+    sim->time += dt;
+}
+
+void simulation_compute_stats(struct simulation *sim,
+                              struct simulation_stats *stats) {
+    memset(stats, 0, sizeof(*stats));
+    int n = sim->particles.count;
+    if (n == 0) {
+        return;
+    }
+
+    for (int i = 0; i < n; i++) {
+        struct particle *p = &sim->particles.items[i];
+        float speed2 = Vector2LengthSqr(p->velocity);
+        stats->mean_density += p->density;
+        stats->max_density = fmaxf(stats->max_density, p->density);
+        stats->mean_pressure += p->pressure;
+        stats->kinetic_energy += 0.5f * sim->params.particle_mass * speed2;
+        stats->max_speed = fmaxf(stats->max_speed, speed2);
+    }
+
+    stats->mean_density /= n;
+    stats->mean_pressure /= n;
+    stats->max_speed = sqrtf(stats->max_speed);
+}
+
+// Stops the worker pool and releases the particles
+void simulation_free(struct simulation *sim) {
+    sim->quit = 1;
+    pthread_barrier_wait(&sim->start_barrier);
+    for (int i = 0; i < sim->threads; i++) {
+        pthread_join(sim->workers[i], NULL);
+    }
+
+    pthread_barrier_destroy(&sim->start_barrier);
+    pthread_barrier_destroy(&sim->done_barrier);
+
+    free(sim->cpus);
+    free(sim->workers);
+    free(sim->worker_args);
+    slab_partition_free(&sim->slabs);
+    particle_pool_free(&sim->pool);
+    free(sim->pressure_accelerations);
+    sim->pressure_accelerations = NULL;
+    sim->pressure_acceleration_count = 0;
+    sim->pressure_acceleration_capacity = 0;
+    sim->cpus = NULL;
+    sim->workers = NULL;
+    sim->worker_args = NULL;
+}
@@ -0,0 +1,313 @@
+#ifndef SIMULATION_H
+#define SIMULATION_H
+
+#include "affinity.h"
+#include "particle_pool.h"
+#include "perf_counters.h"
+#include "slab_partition.h"
+#include "sph.h"
+#include "timing.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Default size of the world when params.ini does not specify one, it matches
+// the 800x600 window of the main executable
+#define SIMULATION_DEFAULT_WIDTH 8.0f
+#define SIMULATION_DEFAULT_HEIGHT 6.0f
+
+// Value of params.threads for "auto": one worker per core, of which the
+// step uses as many as a calibration finds fastest
+#define SIMULATION_THREADS_AUTO 0
+
+// How the particles of a step are split between the workers
+enum simulation_partition {
+    SIMULATION_PARTITION_INDEX, // Chunks of indices claimed in turn
+    SIMULATION_PARTITION_SLABS, // Spatial slabs owned by each worker
+};
+
+struct simulation_parameters {
+        // Program
+        int threads;        // Number of threads, SIMULATION_THREADS_AUTO
+                            // to calibrate them
+        char *affinity;     // CPUs of the workers: none, compact, scatter
+                            // or a list such as 0,2,4-7
+        enum numa_policy numa; // Placement of the particles on NUMA nodes
+        enum simulation_partition partition; // Split of the particles
+
+        // World
+        int particle_count; // Number of particles
+        float gravity;      // Gravity (in m/s^2)
+        float width;        // Width of the world (in meters)
+        float height;       // Height of the world (in meters)
+        unsigned int seed;  // Random seed, 0 means seeded from the clock
+        char *initial;      // File with the initial particles, random if NULL
+
+        // Particle
+        float particle_radius; // Particle radius (in meters)
+        float particle_mass;   // Particle mass (in units of mass)
+        float damping;         // Collision with boundaries damping
+
+        // Fluid
+        float rest_density;               // Rest density (in kg/m^3)
+        float adiabatic_index;            // Adiabatic index
+        float speed_of_sound;             // Speed of sound (in m/s)
+        float background_pressure;        // Background pressure (in Pa)
+        float pressure_multiplier;        // Pressure multiplier
+        enum pressure_type pressure_type; // Pressure type
+
+        // Kernel function
+        enum kernel_type kernel_type; // Kernel function type
+        float h;                      // Smoothing length (in meters)
+
+        // Headless
+        int steps; // Number of steps of a headless run
+        float dt;  // Time step of a headless run (in seconds)
+
+        // Profiling
+        int timing_overlay; // Show the per phase timings (toggle with F2)
+        char *timing_csv;   // File in which the timings are streamed
+        char *trace;        // File in which the trace events are dumped
+        int perf_counters;  // Collect hardware counters per phase
+
+        // Checkpoint
+        char *checkpoint_restart; // Checkpoint to restart from
+        char *checkpoint_file;    // File in which checkpoints are written
+        int checkpoint_every;     // Steps between two checkpoints, 0 disables
+
+        // Trajectory
+        char *trajectory_file;   // File in which the frames are streamed
+        int trajectory_every;    // Steps between two frames
+        int trajectory_keyframe; // Frames between two keyframes
+        int trajectory_compress; // Compress the frames with DEFLATE
+        int trajectory_buffers;  // Frames that can be queued for the writer
+
+        // Export
+        char *export_prefix;              // Prefix of the exported frames
+        enum export_format export_format; // Format of the exported frames
+        int export_every; // Steps between two frames, 0 exports the last one
+
+        // Render
+        char *render_output; // PNG file pattern of the frames, "-" for stdout
+        int render_every;    // Steps between two frames
+        int render_width;    // Width of the frames (in pixels)
+        int render_height;   // Height of the frames (in pixels)
+        int render_pressure; // Draw the pressure field under the particles
+};
+
+// Storage for the parameters of any equation of state
+union pressure_params {
+        struct pressure_cole_params cole;
+        struct pressure_gas_params gas;
+};
+
+// Parameters of a step and the constants derived from them
+//
+// A snapshot is filled once per change of the parameters and never modified
+// once published, the workers read the published one for a whole step.
+struct simulation_snapshot {
+        struct simulation_parameters params;
+        struct kernel_coefficients kernel; // Kernel for params.h
+        struct pressure_coefficients pressure; // Equation of state of params
+        Vector2 gravity;                   // (in m/s^2)
+};
+
+// Phases of a step, the particles of each are claimed in chunks
+enum simulation_phase {
+    SIMULATION_PHASE_DENSITY,
+    SIMULATION_PHASE_GRADIENT,
+    SIMULATION_PHASE_INTEGRATE,
+    SIMULATION_PHASE_COUNT,
+};
+
+// Barrier between the phases of a step, for a number of workers that can
+// change from one step to the next
+struct simulation_barrier {
+        atomic_int arrived;    // Workers waiting in the current round
+        atomic_int generation; // Rounds completed
+};
+
+struct simulation;
+
+// A task that runs on every worker of the pool
+typedef void (*simulation_task)(struct simulation *sim, int worker,
+                                void *user);
+
+struct simulation_worker {
+        struct simulation *sim;
+        int index;
+        int perf_open; // Whether the worker opened its perf counters
+};
+
+// A simulation and the pool of workers that advances it
+//
+// The workers are parked between two calls to simulation_run, the main
+// thread is free to read and modify the particles and the parameters while
+// they are parked.
+struct simulation {
+        struct particle_array particles; // Owned by the pool
+        struct particle_pool pool;
+        struct simulation_parameters params; // Published at the next step
+
+        // The snapshot of the parameters read by the workers and the one
+        // filled when they change, swapped before a step
+        struct simulation_snapshot snapshots[2];
+        _Atomic(const struct simulation_snapshot *) snapshot;
+        long step;   // Number of steps done
+        double time; // Simulated time (in seconds)
+        float dt;    // Time step of the current step (in seconds)
+
+        // Worker pool
+        int threads;
+        pthread_t *workers;
+        struct simulation_worker *worker_args;
+        int *cpus; // CPU each worker is pinned to, -1 for none
+        pthread_barrier_t start_barrier; // Releases the workers
+        pthread_barrier_t done_barrier;  // Waits for the workers
+        simulation_task task;
+        void *task_user;
+        int quit;
+
+        // Step partitioning, the first `active` workers claim `chunk`
+        // particles at a time and the others skip the step
+        int active;
+        int chunk;
+        int auto_tune;   // Calibrate active and chunk as the count changes
+        int tuned_count; // Particles at the last calibration, 0 if none
+        int limit;       // Particles claimed by the step, the first ones
+        atomic_int next[SIMULATION_PHASE_COUNT]; // Next particle to claim
+        struct simulation_barrier barrier;       // Between the phases
+
+        // Slabs of the workers with SIMULATION_PARTITION_SLABS, each worker
+        // only claims its own slab when `slabbed` is set for the step
+        struct slab_partition slabs;
+        int slabbed;
+        long reorders; // Times the particles moved to other indices
+
+        // Pressure acceleration of every particle at the last step, kept for
+        // the debug overlay
+        Vector2 *pressure_accelerations;
+        int pressure_acceleration_count; // Particles at the last step
+        int pressure_acceleration_capacity;
+
+        // Profiling, slot `threads` is the main thread
+        struct timing_table *timing;
+        struct perf_table *perf;
+};
+
+// Aggregated state of a simulation, used to summarize headless runs
+struct simulation_stats {
+        float mean_density;
+        float max_density;
+        float mean_pressure;
+        float kinetic_energy;
+        float max_speed;
+};
+
+// Checkpoint file format
+//
+// A fixed size header followed by one float column per particle attribute,
+// each aligned to CHECKPOINT_ALIGNMENT bytes so a mapped file is usable in
+// place. The version is bumped whenever the layout changes.
+#define CHECKPOINT_VERSION 1
+#define CHECKPOINT_ALIGNMENT 64
+#define CHECKPOINT_BYTE_ORDER 0x01020304u
+#define CHECKPOINT_DEFAULT_FILE "checkpoint.sph"
+
+enum checkpoint_column {
+    CHECKPOINT_POSITION_X,
+    CHECKPOINT_POSITION_Y,
+    CHECKPOINT_VELOCITY_X,
+    CHECKPOINT_VELOCITY_Y,
+    CHECKPOINT_DENSITY,
+    CHECKPOINT_PRESSURE,
+    CHECKPOINT_COLUMN_COUNT,
+};
+
+// Physical parameters stored with fixed width types
+struct checkpoint_params {
+        int32_t particle_count;
+        int32_t pressure_type;
+        int32_t kernel_type;
+        float gravity;
+        float width;
+        float height;
+        float particle_radius;
+        float particle_mass;
+        float damping;
+        float rest_density;
+        float adiabatic_index;
+        float speed_of_sound;
+        float background_pressure;
+        float pressure_multiplier;
+        float h;
+};
+
+struct checkpoint_header {
+        char magic[8];          // "SPHCKPT"
+        uint32_t version;       // CHECKPOINT_VERSION
+        uint32_t byte_order;    // CHECKPOINT_BYTE_ORDER as written
+        uint32_t header_size;   // sizeof(struct checkpoint_header)
+        uint32_t reserved;
+        uint64_t step;          // Number of steps done
+        double time;            // Simulated time (in seconds)
+        uint64_t count;         // Number of particles
+        uint64_t file_size;     // Size of the whole file (in bytes)
+        uint64_t columns[CHECKPOINT_COLUMN_COUNT]; // Offsets of the columns
+        struct checkpoint_params params;
+};
+
+// A checkpoint mapped in memory, the columns point into the mapping
+struct checkpoint_view {
+        const struct checkpoint_header *header;
+        const float *columns[CHECKPOINT_COLUMN_COUNT];
+        void *map;
+        size_t size;
+};
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+// Parameters
+void simulation_parameters_parse(const char *filename,
+                                 struct simulation_parameters *params);
+int simulation_parameters_set(struct simulation_parameters *params,
+                              const char *section, const char *key,
+                              const char *value);
+void *simulation_pressure_params(const struct simulation_parameters *params,
+                                 union pressure_params *storage);
+int parse_bool(const char *value);
+
+// Profiling
+double profile_start(struct perf_table *perf, int slot);
+double profile_lap(struct timing_table *timing, struct perf_table *perf,
+                   int slot, enum timing_phase phase, double since);
+
+// Simulation
+int simulation_init(struct simulation *sim,
+                    const struct simulation_parameters *params);
+void simulation_run(struct simulation *sim, simulation_task task, void *user);
+void simulation_step(struct simulation *sim, float dt);
+void simulation_tune(struct simulation *sim);
+const struct simulation_snapshot *
+simulation_publish(struct simulation *sim);
+void simulation_compute_stats(struct simulation *sim,
+                              struct simulation_stats *stats);
+void simulation_free(struct simulation *sim);
+
+// Checkpoints
+int checkpoint_write(const char *filename, const struct simulation *sim);
+int checkpoint_map(const char *filename, struct checkpoint_view *view);
+void checkpoint_unmap(struct checkpoint_view *view);
+int checkpoint_restore(const struct checkpoint_view *view,
+                       struct simulation *sim);
+int simulation_restore(struct simulation *sim, const char *filename);
+int simulation_checkpoint(struct simulation *sim);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif // SIMULATION_H
@@ -0,0 +1,272 @@
+#include "slab_partition.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Margin added to the support when looking for the slabs within reach, so
+// that rounding in the distances never drops a neighbour
+#define SLAB_PARTITION_SUPPORT_MARGIN 1.01f
+
+static int slab_partition_tile(const struct slab_partition *partition,
+                               float x) {
+    float tile = x / partition->width * SLAB_PARTITION_TILES;
+    if (!(tile >= 0.0f)) {
+        return 0;
+    }
+    return tile < SLAB_PARTITION_TILES ? (int)tile : SLAB_PARTITION_TILES - 1;
+}
+
+// Allocates the slabs of at most `max_workers` workers
+//
+// Returns 0 on success or -1 on failure
+int slab_partition_init(struct slab_partition *partition, int max_workers) {
+    memset(partition, 0, sizeof(*partition));
+    partition->max_workers = max_workers;
+    partition->first = calloc(max_workers + 1, sizeof(int));
+    partition->halo_start = calloc(max_workers, sizeof(int));
+    partition->halo_end = calloc(max_workers, sizeof(int));
+    partition->busy = calloc(max_workers, sizeof(double));
+    if (partition->first == NULL || partition->halo_start == NULL ||
+        partition->halo_end == NULL || partition->busy == NULL) {
+        SPH_LOG_ERROR("Could not allocate the slabs of %d workers",
+                      max_workers);
+        slab_partition_free(partition);
+        return -1;
+    }
+
+    return 0;
+}
+
+// Folds the time the workers spent on the last step into the cost of the
+// tiles they own
+static void slab_partition_measure(struct slab_partition *partition) {
+    for (int w = 0; w < partition->workers; w++) {
+        int count = partition->first[w + 1] - partition->first[w];
+        if (count == 0 || partition->busy[w] <= 0.0) {
+            continue;
+        }
+
+        float rate = (float)(partition->busy[w] / count);
+        for (int t = 0; t < SLAB_PARTITION_TILES; t++) {
+            if (partition->owner[t] == w) {
+                partition->rate[t] = partition->rate[t] > 0.0f
+                                         ? 0.5f * (partition->rate[t] + rate)
+                                         : rate;
+            }
+        }
+    }
+}
+
+// Moves the slab boundaries so that every worker gets the same share of the
+// cost, if the current ones are too far from it
+//
+// Returns 1 if the boundaries moved, 0 otherwise
+static int slab_partition_balance(struct slab_partition *partition,
+                                  int workers, int force) {
+    // Tiles never measured cost as much as the average measured one
+    double measured = 0.0;
+    int measured_tiles = 0;
+    for (int t = 0; t < SLAB_PARTITION_TILES; t++) {
+        if (partition->rate[t] > 0.0f) {
+            measured += partition->rate[t];
+            measured_tiles++;
+        }
+    }
+    float fallback = measured_tiles > 0 ? measured / measured_tiles : 1.0f;
+
+    float cost[SLAB_PARTITION_TILES];
+    double total = 0.0;
+    for (int t = 0; t < SLAB_PARTITION_TILES; t++) {
+        float rate = partition->rate[t] > 0.0f ? partition->rate[t] : fallback;
+        cost[t] = partition->tiles[t] * rate;
+        total += cost[t];
+    }
+
+    if (!force) {
+        double load[workers];
+        memset(load, 0, sizeof(load));
+        for (int t = 0; t < SLAB_PARTITION_TILES; t++) {
+            load[partition->owner[t]] += cost[t];
+        }
+        double heaviest = 0.0;
+        for (int w = 0; w < workers; w++) {
+            heaviest = load[w] > heaviest ? load[w] : heaviest;
+        }
+        if (heaviest <= SLAB_PARTITION_IMBALANCE * total / workers) {
+            return 0;
+        }
+    }
+
+    // Each worker takes tiles until the running cost reaches its share
+    int w = 0;
+    double sum = 0.0;
+    for (int t = 0; t < SLAB_PARTITION_TILES; t++) {
+        partition->owner[t] = w;
+        sum += cost[t];
+        if (w < workers - 1 && sum >= total * (w + 1) / workers) {
+            w++;
+        }
+    }
+
+    return 1;
+}
+
+// Sorts the particles by the slab of their tile, keeping their order within
+// a slab
+//
+// Returns 0 on success or -1 on failure
+static int slab_partition_migrate(struct slab_partition *partition,
+                                  struct particle_array *particles,
+                                  int workers) {
+    if (particles->count > partition->scratch_capacity) {
+        struct particle *scratch = realloc(
+            partition->scratch, particles->count * sizeof(struct particle));
+        if (scratch == NULL) {
+            SPH_LOG_ERROR("Could not allocate the migration of %d particles",
+                          particles->count);
+            return -1;
+        }
+        partition->scratch = scratch;
+        partition->scratch_capacity = particles->count;
+    }
+
+    int next[workers + 1];
+    memset(next, 0, sizeof(next));
+    for (int t = 0; t < SLAB_PARTITION_TILES; t++) {
+        next[partition->owner[t] + 1] += partition->tiles[t];
+    }
+    for (int w = 0; w < workers; w++) {
+        next[w + 1] += next[w];
+    }
+    memcpy(partition->first, next, sizeof(next));
+
+    for (int i = 0; i < particles->count; i++) {
+        int tile =
+            slab_partition_tile(partition, particles->items[i].position.x);
+        partition->scratch[next[partition->owner[tile]]++] =
+            particles->items[i];
+    }
+    memcpy(particles->items, partition->scratch,
+           particles->count * sizeof(struct particle));
+
+    return 0;
+}
+
+// Finds the range of particles each slab has to read: the slabs whose
+// particles lie within the support of one of its own
+static void slab_partition_halos(struct slab_partition *partition,
+                                 const struct particle_array *particles,
+                                 int workers, float support) {
+    float min_x[workers];
+    float max_x[workers];
+    for (int w = 0; w < workers; w++) {
+        min_x[w] = INFINITY;
+        max_x[w] = -INFINITY;
+        for (int i = partition->first[w]; i < partition->first[w + 1]; i++) {
+            min_x[w] = fminf(min_x[w], particles->items[i].position.x);
+            max_x[w] = fmaxf(max_x[w], particles->items[i].position.x);
+        }
+    }
+
+    float reach = support * SLAB_PARTITION_SUPPORT_MARGIN;
+    for (int w = 0; w < workers; w++) {
+        int start = partition->first[w];
+        int end = partition->first[w + 1];
+        if (!isfinite(reach) || !(min_x[w] <= max_x[w])) {
+            // Every particle is within reach, or the slab has none
+            partition->halo_start[w] = start < end ? 0 : start;
+            partition->halo_end[w] = start < end ? particles->count : end;
+            continue;
+        }
+
+        // The slabs in between are read too, their particles add nothing
+        for (int v = 0; v < workers; v++) {
+            if (partition->first[v] == partition->first[v + 1] ||
+                max_x[v] < min_x[w] - reach || min_x[v] > max_x[w] + reach) {
+                continue;
+            }
+            start = partition->first[v] < start ? partition->first[v] : start;
+            end = partition->first[v + 1] > end ? partition->first[v + 1] : end;
+        }
+        partition->halo_start[w] = start;
+        partition->halo_end[w] = end;
+    }
+}
+
+// Plans the slabs of the next step
+//
+// Must be called while the workers are parked, after they wrote the time
+// they spent on the previous step.
+//
+// Arguments:
+// - partition: the partition to update
+// - particles: the particles, reordered when they are migrated
+// - workers: the number of workers taking part in the step
+// - width: the width of the world (in meters)
+// - support: the distance past which the kernel is zero (in meters),
+//   INFINITY if it never is
+//
+// Returns 1 if the particles were migrated, 0 if they kept their indices
+// or -1 on failure
+int slab_partition_plan(struct slab_partition *partition,
+                        struct particle_array *particles, int workers,
+                        float width, float support) {
+    workers = workers < partition->max_workers ? workers
+                                               : partition->max_workers;
+    width = width > 0.0f ? width : 1.0f;
+    int replan = workers != partition->workers ||
+                 particles->count != partition->count ||
+                 width != partition->width;
+    if (!replan) {
+        slab_partition_measure(partition);
+    }
+    partition->width = width;
+
+    memset(partition->tiles, 0, sizeof(partition->tiles));
+    int strays = 0;
+    for (int w = 0; w < partition->workers && !replan; w++) {
+        for (int i = partition->first[w]; i < partition->first[w + 1]; i++) {
+            int tile =
+                slab_partition_tile(partition, particles->items[i].position.x);
+            partition->tiles[tile]++;
+            strays += partition->owner[tile] != w;
+        }
+    }
+    if (replan) {
+        for (int i = 0; i < particles->count; i++) {
+            partition->tiles[slab_partition_tile(
+                partition, particles->items[i].position.x)]++;
+        }
+    }
+
+    int moved = slab_partition_balance(partition, workers, replan);
+    int migrate =
+        moved || strays * SLAB_PARTITION_STRAY_RATIO > particles->count;
+    if (migrate &&
+        slab_partition_migrate(partition, particles, workers) != 0) {
+        partition->workers = 0;
+        return -1;
+    }
+
+    partition->workers = workers;
+    partition->count = particles->count;
+    slab_partition_halos(partition, particles, workers, support);
+    memset(partition->busy, 0, partition->max_workers * sizeof(double));
+
+    return migrate;
+}
+
+void slab_partition_free(struct slab_partition *partition) {
+    free(partition->first);
+    free(partition->halo_start);
+    free(partition->halo_end);
+    free(partition->busy);
+    free(partition->scratch);
+    partition->first = NULL;
+    partition->halo_start = NULL;
+    partition->halo_end = NULL;
+    partition->busy = NULL;
+    partition->scratch = NULL;
+    partition->scratch_capacity = 0;
+    partition->workers = 0;
+}
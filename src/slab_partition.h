@@ -0,0 +1,59 @@
+#ifndef SLAB_PARTITION_H
+#define SLAB_PARTITION_H
+
+#include "sph.h"
+
+// Number of tiles the world is cut into along x
+#define SLAB_PARTITION_TILES 256
+
+// The slabs are moved once the most loaded worker has this much more than
+// its share of the cost
+#define SLAB_PARTITION_IMBALANCE 1.1f
+
+// The particles are migrated once one in this many left its slab
+#define SLAB_PARTITION_STRAY_RATIO 32
+
+// Spatial partition of the particles between the workers
+//
+// The world is cut into tiles along x and every worker owns a slab of
+// consecutive tiles, whose particles are kept contiguous in the array so a
+// worker only writes its own cache lines. The cost of a particle is measured
+// per tile from the time its owner spent on the previous step, and the slab
+// boundaries are moved when the costs drift apart. Particles that crossed
+// into another slab stay with their owner until enough of them did, and are
+// then migrated all at once with a counting sort. The halo of a slab is the
+// range of particles whose slabs lie within the support of the kernel of its
+// particles, the only ones its neighbour loops have to read.
+struct slab_partition {
+        int max_workers;
+        int workers;     // Workers of the last plan, 0 if none
+        int count;       // Particles of the last plan
+        float width;     // Width of the world at the last plan (in meters)
+        int owner[SLAB_PARTITION_TILES];   // Worker owning each tile
+        int tiles[SLAB_PARTITION_TILES];   // Particles in each tile
+        float rate[SLAB_PARTITION_TILES];  // Seconds per particle, 0 if
+                                           // not measured yet
+        int *first;      // First particle of each slab, workers + 1 entries
+        int *halo_start; // First particle within reach of each slab
+        int *halo_end;   // One past the last one
+        double *busy;    // Time each worker computed in the last step,
+                         // written by the workers (in seconds)
+        struct particle *scratch; // Destination of the migrations
+        int scratch_capacity;
+};
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+int slab_partition_init(struct slab_partition *partition, int max_workers);
+int slab_partition_plan(struct slab_partition *partition,
+                        struct particle_array *particles, int workers,
+                        float width, float support);
+void slab_partition_free(struct slab_partition *partition);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif // SLAB_PARTITION_H
@@ -78,6 +78,16 @@ enum kernel_type {
     LINEAR_KERNEL,
 };
 
+// Constants of a kernel function for one smoothing length, computed once
+// rather than for every pair of particles
+struct kernel_coefficients {
+        enum kernel_type type;
+        float h;      // Smoothing length (in meters)
+        float h2;     // h^2
+        float volume; // Normalization of the kernel
+        float slope;  // Normalization of its derivative
+};
+
 // Pressure types
 enum pressure_type {
     COLE_PRESSURE,
@@ -96,6 +106,34 @@ struct pressure_gas_params {
         float pressure_multiplier;
 };
 
+// Constants of an equation of state, computed once per edit rather than for
+// every particle
+struct pressure_coefficients {
+        enum pressure_type type;
+        float rest_density;         // (in kg/m^3)
+        float inverse_rest_density; // 1 / rest_density
+        float adiabatic_index;      // Cole exponent
+        float bulk_modulus;         // Cole B = rest_density * c^2 / index
+        float background_pressure;  // (in Pa)
+        float multiplier;           // Gas pressure multiplier
+};
+
+// Export formats
+enum export_format {
+    EXPORT_VTU, // VTK unstructured grid with binary appended data
+    EXPORT_CSV, // One particle per line
+};
+
+// A time series of exported frames
+struct export_series {
+        char *prefix;              // Frames are named <prefix>_<frame>.<ext>
+        enum export_format format; // Format of the frames
+        int threads;               // Threads used to write a frame
+        double *times;             // Simulated time of each frame
+        int frame_count;
+        int capacity;
+};
+
 #if defined(__cplusplus)
 extern "C" { // Prevents name mangling of functions
 #endif
@@ -105,6 +143,8 @@ SPH_EXPORT void particles_init_grid(struct particle_array *particles,
                                     float width, float height, float spacing);
 SPH_EXPORT void particles_init_rand(struct particle_array *particles,
                                     float width, float height);
+SPH_EXPORT long particles_load(struct particle_array *particles,
+                               const char *filename, int threads);
 SPH_EXPORT float particle_density(struct particle_array *particles, int i,
                                   float h, float particle_mass,
                                   enum kernel_type type);
@@ -115,6 +155,26 @@ SPH_EXPORT Vector2 particle_pressure_gradient(struct particle_array *particles,
                                               int i, float h,
                                               float particle_mass,
                                               enum kernel_type kernel_type);
+SPH_EXPORT float
+particle_density_kernel(struct particle_array *particles, int i,
+                        const struct kernel_coefficients *kernel,
+                        float particle_mass);
+SPH_EXPORT Vector2
+particle_pressure_gradient_kernel(struct particle_array *particles, int i,
+                                  const struct kernel_coefficients *kernel,
+                                  float particle_mass);
+
+// Exporters
+SPH_EXPORT int particles_export(const struct particle_array *particles,
+                                const char *filename,
+                                enum export_format format, int threads);
+SPH_EXPORT int export_series_init(struct export_series *series,
+                                  const char *prefix,
+                                  enum export_format format, int threads);
+SPH_EXPORT int export_series_write(struct export_series *series,
+                                   const struct particle_array *particles,
+                                   double time);
+SPH_EXPORT void export_series_free(struct export_series *series);
 
 // Kernel functions
 SPH_EXPORT float kernel_gaussian(float x, float h);
@@ -126,6 +186,13 @@ SPH_EXPORT float kernel_linear_derivative(float x, float h);
 SPH_EXPORT float kernel_function(float x, float h, enum kernel_type type);
 SPH_EXPORT float kernel_function_derivative(float x, float h,
                                             enum kernel_type type);
+SPH_EXPORT void kernel_coefficients_init(struct kernel_coefficients *kernel,
+                                         float h, enum kernel_type type);
+SPH_EXPORT float kernel_evaluate(const struct kernel_coefficients *kernel,
+                                 float x);
+SPH_EXPORT float
+kernel_evaluate_derivative(const struct kernel_coefficients *kernel, float x);
+SPH_EXPORT float kernel_support(const struct kernel_coefficients *kernel);
 
 // Pressure computation
 SPH_EXPORT float pressure_cole(float density, float rest_density,
@@ -135,6 +202,11 @@ SPH_EXPORT float pressure_gas(float density, float rest_density,
                               float pressure_multiplier);
 SPH_EXPORT float pressure_value(float density, void *params,
                                 enum pressure_type type);
+SPH_EXPORT void
+pressure_coefficients_init(struct pressure_coefficients *pressure,
+                           const void *params, enum pressure_type type);
+SPH_EXPORT float pressure_evaluate(const struct pressure_coefficients *pressure,
+                                   float density);
 
 #if defined(__cplusplus)
 } // extern "C"
@@ -0,0 +1,431 @@
+#include "surface.h"
+#include "pressure_field.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Edges of a cell, numbered from the corner at (x, y) counterclockwise:
+// 0 is (x, y)-(x+1, y), 1 is (x+1, y)-(x+1, y+1), 2 is (x+1, y+1)-(x, y+1)
+// and 3 is (x, y+1)-(x, y)
+//
+// Pairs of edges crossed by the contour for each case, the bits of a case
+// are the corners above the iso value in the same order. The two saddles
+// (5 and 10) cut off the inside corners, a saddle whose center is inside
+// uses the pairs of the other one to cut off the outside corners instead.
+static const signed char surface_cases[16][4] = {
+    {-1, -1, -1, -1}, {3, 0, -1, -1}, {0, 1, -1, -1}, {3, 1, -1, -1},
+    {1, 2, -1, -1},   {3, 0, 1, 2},   {0, 2, -1, -1}, {3, 2, -1, -1},
+    {2, 3, -1, -1},   {0, 2, -1, -1}, {0, 1, 2, 3},   {1, 2, -1, -1},
+    {1, 3, -1, -1},   {0, 1, -1, -1}, {3, 0, -1, -1}, {-1, -1, -1, -1},
+};
+
+// Allocates the tiles of a surface covering the world
+//
+// Arguments:
+// - surface: the surface to initialize
+// - width: the width of the world (in meters)
+// - height: the height of the world (in meters)
+// - cell_size: the size of a cell of the grid (in meters)
+// - iso: the density of the surface (in kg/m^3)
+// - threshold: the distance a particle moves before the tiles around it are
+//   extracted again (in meters)
+//
+// Returns 0 on success and -1 if the tiles could not be allocated
+int surface_init(struct surface *surface, float width, float height,
+                 float cell_size, float iso, float threshold) {
+    memset(surface, 0, sizeof(*surface));
+    surface->columns = (int)ceilf(width / cell_size);
+    surface->rows = (int)ceilf(height / cell_size);
+    surface->cell_size = cell_size;
+    surface->iso = iso;
+    surface->threshold = threshold;
+    surface->tiles_x =
+        (surface->columns + SURFACE_TILE_CELLS - 1) / SURFACE_TILE_CELLS;
+    surface->tiles_y =
+        (surface->rows + SURFACE_TILE_CELLS - 1) / SURFACE_TILE_CELLS;
+
+    int tile_count = surface->tiles_x * surface->tiles_y;
+    surface->tiles = calloc(tile_count, sizeof(struct surface_tile));
+    surface->dirty = calloc(tile_count, sizeof(atomic_int));
+    surface->dirty_tiles = malloc(tile_count * sizeof(int));
+    surface->tile_start = malloc((tile_count + 1) * sizeof(int));
+    if (surface->tiles == NULL || surface->dirty == NULL ||
+        surface->dirty_tiles == NULL || surface->tile_start == NULL) {
+        SPH_LOG_ERROR("Could not allocate the surface");
+        surface_free(surface);
+        return -1;
+    }
+
+    int nodes = (SURFACE_TILE_CELLS + 1) * (SURFACE_TILE_CELLS + 1);
+    for (int t = 0; t < tile_count; t++) {
+        surface->tiles[t].nodes = malloc(nodes * sizeof(float));
+        if (surface->tiles[t].nodes == NULL) {
+            SPH_LOG_ERROR("Could not allocate the surface");
+            surface_free(surface);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static float surface_support(const struct simulation_parameters *params) {
+    return params->kernel_type == GAUSSIAN_KERNEL
+               ? PRESSURE_FIELD_GAUSSIAN_SUPPORT * params->h
+               : params->h;
+}
+
+// Returns the range of tiles whose nodes are within a distance of a point,
+// false if none
+static int surface_point_tiles(const struct surface *surface, Vector2 point,
+                               float distance, int *x0, int *y0, int *x1,
+                               int *y1) {
+    float tile_size = SURFACE_TILE_CELLS * surface->cell_size;
+    *x0 = (int)floorf((point.x - distance) / tile_size);
+    *y0 = (int)floorf((point.y - distance) / tile_size);
+    *x1 = (int)floorf((point.x + distance) / tile_size);
+    *y1 = (int)floorf((point.y + distance) / tile_size);
+    if (*x1 < 0 || *y1 < 0 || *x0 >= surface->tiles_x ||
+        *y0 >= surface->tiles_y) {
+        return 0;
+    }
+    *x0 = *x0 > 0 ? *x0 : 0;
+    *y0 = *y0 > 0 ? *y0 : 0;
+    *x1 = *x1 < surface->tiles_x - 1 ? *x1 : surface->tiles_x - 1;
+    *y1 = *y1 < surface->tiles_y - 1 ? *y1 : surface->tiles_y - 1;
+    return 1;
+}
+
+static void surface_mark(struct surface *surface, Vector2 point,
+                         float distance) {
+    int x0, y0, x1, y1;
+    if (!surface_point_tiles(surface, point, distance, &x0, &y0, &x1, &y1)) {
+        return;
+    }
+    for (int ty = y0; ty <= y1; ty++) {
+        for (int tx = x0; tx <= x1; tx++) {
+            atomic_store_explicit(&surface->dirty[ty * surface->tiles_x + tx],
+                                  1, memory_order_relaxed);
+        }
+    }
+}
+
+// Dirties the tiles around the particles of the range of a worker that moved
+// further than the threshold, both where they were and where they are
+static void surface_mark_task(struct simulation *sim, int worker, void *user) {
+    struct surface *surface = (struct surface *)user;
+    struct particle_array *particles = &sim->particles;
+    int start = (int)((long)worker * particles->count / sim->threads);
+    int end = (int)((long)(worker + 1) * particles->count / sim->threads);
+
+    float support = surface_support(&sim->params);
+    float threshold2 = surface->threshold * surface->threshold;
+    for (int i = start; i < end; i++) {
+        Vector2 position = particles->items[i].position;
+        Vector2 reference = surface->reference[i];
+        float dx = position.x - reference.x;
+        float dy = position.y - reference.y;
+        if (dx * dx + dy * dy <= threshold2) {
+            continue;
+        }
+        surface_mark(surface, reference, support);
+        surface_mark(surface, position, support);
+        surface->reference[i] = position;
+    }
+}
+
+// Groups the particles within the support of each dirty tile with a
+// counting sort, like the tiles of the rasterizer
+static int surface_bin(struct surface *surface, struct simulation *sim) {
+    struct particle_array *particles = &sim->particles;
+    float support = surface_support(&sim->params);
+    int tile_count = surface->tiles_x * surface->tiles_y;
+    int *start = surface->tile_start;
+
+    // Clean tiles get no slot, the dirty ones are numbered in order
+    int *slot = surface->dirty_tiles;
+    surface->dirty_count = 0;
+    int *order = malloc(tile_count * sizeof(int));
+    if (order == NULL) {
+        SPH_LOG_ERROR("Could not allocate the surface tiles");
+        return -1;
+    }
+    for (int t = 0; t < tile_count; t++) {
+        order[t] = -1;
+        if (atomic_load_explicit(&surface->dirty[t], memory_order_relaxed)) {
+            order[t] = surface->dirty_count;
+            slot[surface->dirty_count++] = t;
+        }
+    }
+    memset(start, 0, (surface->dirty_count + 1) * sizeof(int));
+
+    int x0, y0, x1, y1;
+    for (int i = 0; i < particles->count; i++) {
+        Vector2 position = particles->items[i].position;
+        if (!surface_point_tiles(surface, position, support, &x0, &y0, &x1,
+                                 &y1)) {
+            continue;
+        }
+        for (int ty = y0; ty <= y1; ty++) {
+            for (int tx = x0; tx <= x1; tx++) {
+                int s = order[ty * surface->tiles_x + tx];
+                if (s >= 0) {
+                    start[s + 1]++;
+                }
+            }
+        }
+    }
+    for (int s = 0; s < surface->dirty_count; s++) {
+        start[s + 1] += start[s];
+    }
+
+    int items = start[surface->dirty_count];
+    if (items > surface->item_capacity) {
+        int *tile_items = realloc(surface->tile_items, items * sizeof(int));
+        if (tile_items == NULL) {
+            SPH_LOG_ERROR("Could not allocate the surface tiles");
+            free(order);
+            return -1;
+        }
+        surface->tile_items = tile_items;
+        surface->item_capacity = items;
+    }
+
+    // The start offsets are used as cursors and restored afterwards
+    for (int i = 0; i < particles->count; i++) {
+        Vector2 position = particles->items[i].position;
+        if (!surface_point_tiles(surface, position, support, &x0, &y0, &x1,
+                                 &y1)) {
+            continue;
+        }
+        for (int ty = y0; ty <= y1; ty++) {
+            for (int tx = x0; tx <= x1; tx++) {
+                int s = order[ty * surface->tiles_x + tx];
+                if (s >= 0) {
+                    surface->tile_items[start[s]++] = i;
+                }
+            }
+        }
+    }
+    for (int s = surface->dirty_count; s > 0; s--) {
+        start[s] = start[s - 1];
+    }
+    start[0] = 0;
+
+    free(order);
+    return 0;
+}
+
+static int surface_emit(struct surface_tile *tile, Vector2 a, Vector2 b) {
+    if (tile->count + 2 > tile->capacity) {
+        int capacity = tile->capacity > 0 ? tile->capacity * 2 : 64;
+        Vector2 *points = realloc(tile->points, capacity * sizeof(Vector2));
+        if (points == NULL) {
+            return -1;
+        }
+        tile->points = points;
+        tile->capacity = capacity;
+    }
+    tile->points[tile->count++] = a;
+    tile->points[tile->count++] = b;
+    return 0;
+}
+
+// Point where the contour crosses an edge of a cell, interpolated linearly
+// between the densities of its corners
+static Vector2 surface_crossing(Vector2 p0, float v0, Vector2 p1, float v1,
+                                float iso) {
+    float t = v1 != v0 ? (iso - v0) / (v1 - v0) : 0.5f;
+    return (Vector2){p0.x + (p1.x - p0.x) * t, p0.y + (p1.y - p0.y) * t};
+}
+
+// Evaluates the density at the nodes of a dirty tile from its particles and
+// replaces its contours
+static void surface_extract_tile(struct surface *surface,
+                                 struct simulation *sim, int slot) {
+    const struct simulation_snapshot *snapshot =
+        atomic_load_explicit(&sim->snapshot, memory_order_acquire);
+    const struct simulation_parameters *params = &snapshot->params;
+    int t = surface->dirty_tiles[slot];
+    struct surface_tile *tile = &surface->tiles[t];
+    int cx0 = (t % surface->tiles_x) * SURFACE_TILE_CELLS;
+    int cy0 = (t / surface->tiles_x) * SURFACE_TILE_CELLS;
+    int cells_x = surface->columns - cx0 < SURFACE_TILE_CELLS
+                      ? surface->columns - cx0
+                      : SURFACE_TILE_CELLS;
+    int cells_y = surface->rows - cy0 < SURFACE_TILE_CELLS
+                      ? surface->rows - cy0
+                      : SURFACE_TILE_CELLS;
+    int stride = cells_x + 1;
+    float cell = surface->cell_size;
+
+    float support = surface_support(params);
+    float inverse_cell = 1.0f / cell;
+    float *nodes = tile->nodes;
+    memset(nodes, 0, stride * (cells_y + 1) * sizeof(float));
+    for (int k = surface->tile_start[slot]; k < surface->tile_start[slot + 1];
+         k++) {
+        Vector2 position =
+            sim->particles.items[surface->tile_items[k]].position;
+        int x0 = (int)ceilf((position.x - support) * inverse_cell) - cx0;
+        int x1 = (int)floorf((position.x + support) * inverse_cell) - cx0;
+        int y0 = (int)ceilf((position.y - support) * inverse_cell) - cy0;
+        int y1 = (int)floorf((position.y + support) * inverse_cell) - cy0;
+        x0 = x0 > 0 ? x0 : 0;
+        y0 = y0 > 0 ? y0 : 0;
+        x1 = x1 < cells_x ? x1 : cells_x;
+        y1 = y1 < cells_y ? y1 : cells_y;
+
+        for (int y = y0; y <= y1; y++) {
+            float dy = (cy0 + y) * cell - position.y;
+            for (int x = x0; x <= x1; x++) {
+                float dx = (cx0 + x) * cell - position.x;
+                float distance = sqrtf(dx * dx + dy * dy);
+                if (distance < support) {
+                    nodes[y * stride + x] +=
+                        kernel_evaluate(&snapshot->kernel, distance) *
+                        params->particle_mass;
+                }
+            }
+        }
+    }
+
+    float iso = surface->iso;
+    tile->count = 0;
+    for (int y = 0; y < cells_y; y++) {
+        for (int x = 0; x < cells_x; x++) {
+            float v[4] = {
+                nodes[y * stride + x],
+                nodes[y * stride + x + 1],
+                nodes[(y + 1) * stride + x + 1],
+                nodes[(y + 1) * stride + x],
+            };
+            int index = (v[0] >= iso) | (v[1] >= iso) << 1 |
+                        (v[2] >= iso) << 2 | (v[3] >= iso) << 3;
+            if (index == 0 || index == 15) {
+                continue;
+            }
+            if ((index == 5 || index == 10) &&
+                (v[0] + v[1] + v[2] + v[3]) * 0.25f >= iso) {
+                index = 15 - index;
+            }
+
+            float px = (cx0 + x) * cell;
+            float py = (cy0 + y) * cell;
+            Vector2 corners[4] = {
+                {px, py},
+                {px + cell, py},
+                {px + cell, py + cell},
+                {px, py + cell},
+            };
+            Vector2 crossings[4];
+            for (int e = 0; e < 4; e++) {
+                int n = (e + 1) % 4;
+                crossings[e] =
+                    surface_crossing(corners[e], v[e], corners[n], v[n], iso);
+            }
+
+            const signed char *edges = surface_cases[index];
+            for (int s = 0; s < 4 && edges[s] >= 0; s += 2) {
+                if (surface_emit(tile, crossings[edges[s]],
+                                 crossings[edges[s + 1]]) != 0) {
+                    SPH_LOG_ERROR("Could not allocate the surface contours");
+                    return;
+                }
+            }
+        }
+    }
+}
+
+static void surface_extract_task(struct simulation *sim, int worker,
+                                 void *user) {
+    struct surface *surface = (struct surface *)user;
+
+    for (;;) {
+        int slot = atomic_fetch_add_explicit(&surface->next_tile, 1,
+                                             memory_order_relaxed);
+        if (slot >= surface->dirty_count) {
+            break;
+        }
+        surface_extract_tile(surface, sim, slot);
+    }
+}
+
+// Extracts the contours of the tiles near the particles that moved since
+// the last update, or of every tile when the number of particles, the
+// kernel or the iso value changed or the particles were reordered
+//
+// Must be called while the workers are parked
+//
+// Returns the number of tiles extracted or -1 on failure
+int surface_update(struct surface *surface, struct simulation *sim) {
+    struct particle_array *particles = &sim->particles;
+    struct simulation_parameters *params = &sim->params;
+    int tile_count = surface->tiles_x * surface->tiles_y;
+
+    // The tiles are extracted with the coefficients of these parameters
+    simulation_publish(sim);
+
+    int rebuild = particles->count != surface->reference_count ||
+                  params->h != surface->h ||
+                  params->particle_mass != surface->particle_mass ||
+                  params->kernel_type != surface->kernel_type ||
+                  surface->iso != surface->built_iso ||
+                  sim->reorders != surface->reorders;
+    if (rebuild) {
+        if (particles->count > surface->reference_capacity) {
+            Vector2 *reference =
+                realloc(surface->reference, particles->count * sizeof(Vector2));
+            if (reference == NULL) {
+                SPH_LOG_ERROR("Could not allocate %d surface references",
+                              particles->count);
+                return -1;
+            }
+            surface->reference = reference;
+            surface->reference_capacity = particles->count;
+        }
+        for (int i = 0; i < particles->count; i++) {
+            surface->reference[i] = particles->items[i].position;
+        }
+        surface->reference_count = particles->count;
+        surface->h = params->h;
+        surface->particle_mass = params->particle_mass;
+        surface->kernel_type = params->kernel_type;
+        surface->built_iso = surface->iso;
+        surface->reorders = sim->reorders;
+        for (int t = 0; t < tile_count; t++) {
+            atomic_store(&surface->dirty[t], 1);
+        }
+    } else {
+        simulation_run(sim, surface_mark_task, surface);
+    }
+
+    if (surface_bin(surface, sim) != 0) {
+        return -1;
+    }
+
+    atomic_store(&surface->next_tile, 0);
+    simulation_run(sim, surface_extract_task, surface);
+
+    for (int t = 0; t < tile_count; t++) {
+        atomic_store_explicit(&surface->dirty[t], 0, memory_order_relaxed);
+    }
+
+    return surface->dirty_count;
+}
+
+void surface_free(struct surface *surface) {
+    if (surface->tiles != NULL) {
+        for (int t = 0; t < surface->tiles_x * surface->tiles_y; t++) {
+            free(surface->tiles[t].points);
+            free(surface->tiles[t].nodes);
+        }
+    }
+    free(surface->tiles);
+    free(surface->dirty);
+    free(surface->dirty_tiles);
+    free(surface->tile_start);
+    free(surface->tile_items);
+    free(surface->reference);
+    memset(surface, 0, sizeof(*surface));
+}
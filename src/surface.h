@@ -0,0 +1,73 @@
+#ifndef SURFACE_H
+#define SURFACE_H
+
+#include "simulation.h"
+#include <stdatomic.h>
+
+// Number of cells along each side of a tile
+#define SURFACE_TILE_CELLS 16
+
+// Contours of one tile, kept until a particle near the tile moves
+struct surface_tile {
+        Vector2 *points; // Segment end points, two per segment (in meters)
+        int count;       // Number of points
+        int capacity;
+        float *nodes;    // Density at the grid nodes of the tile, scratch
+};
+
+// Fluid surface extracted with marching squares
+//
+// The density is evaluated at the nodes of a regular grid with the kernel of
+// the simulation and the iso-contour is extracted in tiles on the worker
+// pool. A particle only dirties the tiles within the support of the kernel
+// around it, and only once it moved further than the threshold since it last
+// did, so a fluid at rest costs almost nothing. The contours of the clean
+// tiles are kept from the previous update.
+struct surface {
+        int columns;     // Number of cells along x
+        int rows;        // Number of cells along y
+        float cell_size; // Size of a cell (in meters)
+        float iso;       // Density of the surface (in kg/m^3)
+        float threshold; // Distance a particle moves before its tiles are
+                         // extracted again (in meters)
+
+        // Tiles
+        int tiles_x;
+        int tiles_y;
+        struct surface_tile *tiles;
+        atomic_int *dirty;  // Whether each tile must be extracted again
+        int *dirty_tiles;   // Indices of the dirty tiles of an update
+        int dirty_count;
+        int *tile_start;    // Offset of the particles of each dirty tile
+        int *tile_items;    // Particle indices grouped by dirty tile
+        int item_capacity;
+        atomic_int next_tile;
+
+        // Positions of the particles when they last dirtied their tiles
+        Vector2 *reference;
+        int reference_count;
+        int reference_capacity;
+
+        // Parameters of the last update, any change extracts every tile
+        float h;
+        float particle_mass;
+        enum kernel_type kernel_type;
+        float built_iso;
+        long reorders; // Reorders of the particles, the references follow
+                       // the indices
+};
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+int surface_init(struct surface *surface, float width, float height,
+                 float cell_size, float iso, float threshold);
+int surface_update(struct surface *surface, struct simulation *sim);
+void surface_free(struct surface *surface);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif // SURFACE_H
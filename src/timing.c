@@ -0,0 +1,175 @@
+#include "timing.h"
+#include "sph.h"
+#include <math.h>
+#include <stdlib.h>
+#include <time.h>
+
+static const char *timing_phase_names[TIMING_PHASE_COUNT] = {
+    [TIMING_DENSITY] = "density",
+    [TIMING_GRADIENT] = "gradient",
+    [TIMING_INTEGRATE] = "integrate",
+    [TIMING_BARRIER] = "barrier",
+    [TIMING_STEP] = "step",
+    [TIMING_PRESSURE_TEXTURE] = "pressure_texture",
+    [TIMING_DRAW] = "draw",
+};
+
+// Returns the value of the monotonic clock (in seconds)
+double timing_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+const char *timing_phase_name(enum timing_phase phase) {
+    if (phase < 0 || phase >= TIMING_PHASE_COUNT) {
+        return "unknown";
+    }
+
+    return timing_phase_names[phase];
+}
+
+// Initializes a timing table
+//
+// Arguments:
+// - table: the table to initialize
+// - count: the number of thread slots
+// - csv_filename: the file in which every frame is streamed, or NULL
+void timing_init(struct timing_table *table, int count,
+                 const char *csv_filename) {
+    table->threads = calloc(count, sizeof(struct timing_thread));
+    table->count = table->threads != NULL ? count : 0;
+    table->frame = 0;
+    table->csv = NULL;
+
+    if (table->threads == NULL) {
+        SPH_LOG_ERROR("Could not allocate memory for the timing table");
+        return;
+    }
+
+    if (csv_filename != NULL) {
+        table->csv = fopen(csv_filename, "w");
+        if (table->csv == NULL) {
+            SPH_LOG_WARN("Could not open timing file %s", csv_filename);
+        } else {
+            fprintf(table->csv, "frame,thread,phase,ms\n");
+        }
+    }
+}
+
+void timing_free(struct timing_table *table) {
+    if (table->csv != NULL) {
+        fclose(table->csv);
+    }
+    free(table->threads);
+    table->threads = NULL;
+    table->count = 0;
+    table->csv = NULL;
+}
+
+// Adds time to the current frame of a phase
+//
+// Only the thread that owns the slot is allowed to call this function
+void timing_add(struct timing_table *table, int thread,
+                enum timing_phase phase, double seconds) {
+    if (thread < 0 || thread >= table->count) {
+        return;
+    }
+
+    struct timing_stat *stat = &table->threads[thread].phases[phase];
+    stat->current += seconds;
+    stat->touched = 1;
+}
+
+// Adds the time elapsed since `since` to a phase
+//
+// Returns the current time so that consecutive phases can be chained
+double timing_lap(struct timing_table *table, int thread,
+                  enum timing_phase phase, double since) {
+    double now = timing_now();
+    if (table != NULL) {
+        timing_add(table, thread, phase, now - since);
+    }
+    return now;
+}
+
+// Closes the current frame: pushes the accumulated time of every phase that
+// ran into the rolling window and streams it to the CSV file
+//
+// Must be called while no other thread writes to the table
+void timing_commit(struct timing_table *table) {
+    for (int t = 0; t < table->count; t++) {
+        for (int p = 0; p < TIMING_PHASE_COUNT; p++) {
+            struct timing_stat *stat = &table->threads[t].phases[p];
+            if (!stat->touched) {
+                continue;
+            }
+
+            if (stat->count == TIMING_WINDOW) {
+                stat->sum -= stat->samples[stat->head];
+            } else {
+                stat->count++;
+            }
+            stat->samples[stat->head] = stat->current;
+            stat->sum += stat->current;
+            stat->head = (stat->head + 1) % TIMING_WINDOW;
+
+            if (table->csv != NULL) {
+                fprintf(table->csv, "%ld,%d,%s,%.6f\n", table->frame, t,
+                        timing_phase_names[p], stat->current * 1000.0);
+            }
+
+            stat->current = 0.0;
+            stat->touched = 0;
+        }
+    }
+
+    table->frame++;
+}
+
+// Returns the rolling mean of a phase on a thread (in seconds)
+double timing_mean(struct timing_table *table, int thread,
+                   enum timing_phase phase) {
+    struct timing_stat *stat = &table->threads[thread].phases[phase];
+    if (stat->count == 0) {
+        return 0.0;
+    }
+
+    return stat->sum / stat->count;
+}
+
+// Returns the rolling maximum of a phase on a thread (in seconds)
+double timing_max(struct timing_table *table, int thread,
+                  enum timing_phase phase) {
+    struct timing_stat *stat = &table->threads[thread].phases[phase];
+    double max = 0.0;
+    for (int i = 0; i < stat->count; i++) {
+        if (stat->samples[i] > max) {
+            max = stat->samples[i];
+        }
+    }
+
+    return max;
+}
+
+// Aggregates a phase over the thread slots [first, last)
+//
+// The mean is the average of the per thread means and the max is the largest
+// sample of any thread in the window
+void timing_summary(struct timing_table *table, int first, int last,
+                    enum timing_phase phase, double *mean, double *max) {
+    double sum = 0.0;
+    int count = 0;
+    *max = 0.0;
+    for (int t = first; t < last && t < table->count; t++) {
+        if (table->threads[t].phases[phase].count == 0) {
+            continue;
+        }
+
+        sum += timing_mean(table, t, phase);
+        *max = fmax(*max, timing_max(table, t, phase));
+        count++;
+    }
+
+    *mean = count > 0 ? sum / count : 0.0;
+}
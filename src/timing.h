@@ -0,0 +1,70 @@
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <stdio.h>
+
+// Number of frames kept for the rolling statistics
+#define TIMING_WINDOW 120
+
+// The phases of a frame that are timed
+enum timing_phase {
+    TIMING_DENSITY,          // Density and pressure pass
+    TIMING_GRADIENT,         // Pressure gradient and velocity update pass
+    TIMING_INTEGRATE,        // Position integration and collisions
+    TIMING_BARRIER,          // Time spent waiting on the worker barrier
+    TIMING_STEP,             // Whole step as seen by the main thread
+    TIMING_PRESSURE_TEXTURE, // DrawPressureTexture
+    TIMING_DRAW,             // Drawing the particles
+    TIMING_PHASE_COUNT,
+};
+
+// Rolling statistics of a single phase on a single thread
+struct timing_stat {
+        double samples[TIMING_WINDOW]; // Last samples (in seconds)
+        int head;                      // Index of the next sample
+        int count;                     // Number of valid samples
+        double sum;                    // Sum of the valid samples
+        double current; // Time accumulated during the current frame
+        int touched;    // Whether the phase ran during the current frame
+};
+
+// The statistics of all the phases of a thread
+struct timing_thread {
+        struct timing_stat phases[TIMING_PHASE_COUNT];
+};
+
+// The timing table holds one slot per thread, each slot is written only by
+// its own thread and read by the main thread while the workers are parked
+struct timing_table {
+        struct timing_thread *threads;
+        int count;
+        long frame;
+        FILE *csv;
+};
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+double timing_now(void);
+const char *timing_phase_name(enum timing_phase phase);
+void timing_init(struct timing_table *table, int count,
+                 const char *csv_filename);
+void timing_free(struct timing_table *table);
+void timing_add(struct timing_table *table, int thread,
+                enum timing_phase phase, double seconds);
+double timing_lap(struct timing_table *table, int thread,
+                  enum timing_phase phase, double since);
+void timing_commit(struct timing_table *table);
+double timing_mean(struct timing_table *table, int thread,
+                   enum timing_phase phase);
+double timing_max(struct timing_table *table, int thread,
+                  enum timing_phase phase);
+void timing_summary(struct timing_table *table, int first, int last,
+                    enum timing_phase phase, double *mean, double *max);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif // TIMING_H
@@ -0,0 +1,164 @@
+#include "trace.h"
+
+#ifdef SPH_TRACE
+
+#include "sph.h"
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+struct trace_record {
+        uint64_t timestamp; // Monotonic clock (in nanoseconds)
+        const char *name;   // Static string naming the span
+        enum trace_event_type type;
+};
+
+// Single producer ring buffer, only the owning thread writes to it
+struct trace_buffer {
+        struct trace_record *records;
+        _Atomic uint64_t head; // Number of records ever written
+        char padding[64 - sizeof(uint64_t)];
+};
+
+static struct trace_buffer *trace_buffers = NULL;
+static int trace_thread_count = 0;
+static uint64_t trace_mask = 0;
+static uint64_t trace_epoch = 0;
+
+static uint64_t trace_clock(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// Allocates one ring buffer per thread
+//
+// Arguments:
+// - threads: the number of thread slots
+// - capacity: the number of events per thread, rounded up to a power of two
+//
+// Returns 0 on success and -1 if the buffers could not be allocated
+int trace_init(int threads, int capacity) {
+    uint64_t size = 1;
+    while (size < (uint64_t)capacity) {
+        size <<= 1;
+    }
+
+    trace_buffers = calloc(threads, sizeof(struct trace_buffer));
+    if (trace_buffers == NULL) {
+        SPH_LOG_ERROR("Could not allocate memory for the tracer");
+        return -1;
+    }
+
+    for (int i = 0; i < threads; i++) {
+        trace_buffers[i].records = calloc(size, sizeof(struct trace_record));
+        if (trace_buffers[i].records == NULL) {
+            SPH_LOG_ERROR("Could not allocate memory for the tracer");
+            trace_thread_count = i;
+            trace_free();
+            return -1;
+        }
+        atomic_init(&trace_buffers[i].head, 0);
+    }
+
+    trace_thread_count = threads;
+    trace_mask = size - 1;
+    trace_epoch = trace_clock();
+
+    return 0;
+}
+
+// Records an event on the ring buffer of a thread
+//
+// When the buffer is full the oldest events are overwritten
+void trace_event(int thread, const char *name, enum trace_event_type type) {
+    if (thread < 0 || thread >= trace_thread_count) {
+        return;
+    }
+
+    struct trace_buffer *buffer = &trace_buffers[thread];
+    uint64_t head = atomic_load_explicit(&buffer->head, memory_order_relaxed);
+    struct trace_record *record = &buffer->records[head & trace_mask];
+    record->timestamp = trace_clock();
+    record->name = name;
+    record->type = type;
+    atomic_store_explicit(&buffer->head, head + 1, memory_order_release);
+}
+
+// Writes the recorded events as Chrome trace-event JSON
+//
+// Must be called after the traced threads stopped recording
+//
+// Returns 0 on success and -1 if the file could not be written
+int trace_dump(const char *filename) {
+    if (trace_buffers == NULL) {
+        return 0;
+    }
+
+    FILE *file = fopen(filename, "w");
+    if (file == NULL) {
+        SPH_LOG_ERROR("Could not open trace file %s", filename);
+        return -1;
+    }
+
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    int first = 1;
+    for (int t = 0; t < trace_thread_count; t++) {
+        const char *label = t == trace_thread_count - 1 ? "main" : "worker";
+        fprintf(file,
+                "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+                "\"tid\":%d,\"args\":{\"name\":\"%s %d\"}}",
+                first ? "" : ",\n", t, label, t);
+        first = 0;
+
+        struct trace_buffer *buffer = &trace_buffers[t];
+        uint64_t head =
+            atomic_load_explicit(&buffer->head, memory_order_acquire);
+        uint64_t start = head > trace_mask + 1 ? head - (trace_mask + 1) : 0;
+
+        // The begin events of the oldest spans may have been overwritten,
+        // their end events are dropped to keep the spans balanced
+        int depth = 0;
+        for (uint64_t i = start; i < head; i++) {
+            struct trace_record *record = &buffer->records[i & trace_mask];
+            if (record->type == TRACE_END) {
+                if (depth == 0) {
+                    continue;
+                }
+                depth--;
+            } else {
+                depth++;
+            }
+
+            double ts = (double)(record->timestamp - trace_epoch) / 1000.0;
+            fprintf(file,
+                    ",\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,"
+                    "\"pid\":1,\"tid\":%d}",
+                    record->name, record->type == TRACE_BEGIN ? 'B' : 'E', ts,
+                    t);
+        }
+    }
+    fprintf(file, "\n]}\n");
+
+    int ok = ferror(file) == 0;
+    fclose(file);
+    if (!ok) {
+        SPH_LOG_ERROR("Could not write trace file %s", filename);
+        return -1;
+    }
+
+    SPH_LOG_INFO("Trace written to %s", filename);
+    return 0;
+}
+
+void trace_free(void) {
+    for (int i = 0; i < trace_thread_count; i++) {
+        free(trace_buffers[i].records);
+    }
+    free(trace_buffers);
+    trace_buffers = NULL;
+    trace_thread_count = 0;
+}
+
+#endif // SPH_TRACE
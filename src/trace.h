@@ -0,0 +1,55 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+// Chrome trace-event tracer
+//
+// Every thread records begin/end events into its own ring buffer, which is
+// dumped as Chrome trace-event JSON that can be opened in Perfetto or
+// chrome://tracing. The tracer is only compiled when SPH_TRACE is defined,
+// otherwise all the macros and functions compile to nothing.
+
+// Default number of events kept per thread (must be a power of two)
+#define TRACE_DEFAULT_CAPACITY (1 << 16)
+
+enum trace_event_type {
+    TRACE_BEGIN,
+    TRACE_END,
+};
+
+#ifdef SPH_TRACE
+
+#define SPH_TRACE_BEGIN(thread, name) trace_event((thread), (name), TRACE_BEGIN)
+#define SPH_TRACE_END(thread, name) trace_event((thread), (name), TRACE_END)
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+int trace_init(int threads, int capacity);
+void trace_event(int thread, const char *name, enum trace_event_type type);
+int trace_dump(const char *filename);
+void trace_free(void);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#else
+
+#define SPH_TRACE_BEGIN(thread, name) ((void)0)
+#define SPH_TRACE_END(thread, name) ((void)0)
+
+static inline int trace_init(int threads, int capacity) {
+    (void)threads;
+    (void)capacity;
+    return 0;
+}
+static inline int trace_dump(const char *filename) {
+    (void)filename;
+    return 0;
+}
+static inline void trace_free(void) {}
+
+#endif // SPH_TRACE
+
+#endif // TRACE_H
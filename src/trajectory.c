@@ -0,0 +1,702 @@
+#include "trajectory.h"
+#include "raylib.h"
+#include "sph.h"
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char trajectory_magic[8] = "SPHTRAJ";
+static const char trajectory_index_magic[8] = "SPHTIDX";
+
+// Largest quantization code of a column
+#define TRAJECTORY_MAX_CODE 65535.0f
+
+// Copies the range of particles of a worker into the captured buffer
+static void trajectory_copy_task(struct simulation *sim, int worker,
+                                 void *user) {
+    struct trajectory_buffer *buffer = (struct trajectory_buffer *)user;
+    int start = (int)((long)worker * buffer->count / sim->threads);
+    int end = (int)((long)(worker + 1) * buffer->count / sim->threads);
+
+    for (int i = start; i < end; i++) {
+        const struct particle *p = &sim->particles.items[i];
+        buffer->columns[CHECKPOINT_POSITION_X][i] = p->position.x;
+        buffer->columns[CHECKPOINT_POSITION_Y][i] = p->position.y;
+        buffer->columns[CHECKPOINT_VELOCITY_X][i] = p->velocity.x;
+        buffer->columns[CHECKPOINT_VELOCITY_Y][i] = p->velocity.y;
+        buffer->columns[CHECKPOINT_DENSITY][i] = p->density;
+        buffer->columns[CHECKPOINT_PRESSURE][i] = p->pressure;
+    }
+}
+
+static int trajectory_buffer_reserve(struct trajectory_buffer *buffer,
+                                     int count) {
+    if (count <= buffer->capacity) {
+        return 0;
+    }
+
+    for (int c = 0; c < TRAJECTORY_COLUMN_COUNT; c++) {
+        float *column = realloc(buffer->columns[c], count * sizeof(float));
+        if (column == NULL) {
+            return -1;
+        }
+        buffer->columns[c] = column;
+    }
+    buffer->capacity = count;
+
+    return 0;
+}
+
+void trajectory_buffer_free(struct trajectory_buffer *buffer) {
+    for (int c = 0; c < TRAJECTORY_COLUMN_COUNT; c++) {
+        free(buffer->columns[c]);
+        buffer->columns[c] = NULL;
+    }
+    buffer->capacity = 0;
+    buffer->count = 0;
+}
+
+// Quantizes the columns of a buffer and encodes them against the codes of
+// the previous frame
+static void trajectory_encode(struct trajectory_writer *writer,
+                              const struct trajectory_buffer *buffer,
+                              struct trajectory_frame_header *frame) {
+    int count = buffer->count;
+    int keyframe = frame->flags & TRAJECTORY_KEYFRAME;
+
+    for (int c = 0; c < TRAJECTORY_COLUMN_COUNT; c++) {
+        const float *values = buffer->columns[c];
+        float min = INFINITY;
+        float max = -INFINITY;
+        for (int i = 0; i < count; i++) {
+            if (isfinite(values[i])) {
+                min = fminf(min, values[i]);
+                max = fmaxf(max, values[i]);
+            }
+        }
+        if (min > max) {
+            min = max = 0.0f;
+        }
+
+        float scale = (max - min) / TRAJECTORY_MAX_CODE;
+        float inverse = scale > 0.0f ? 1.0f / scale : 0.0f;
+        frame->min[c] = min;
+        frame->scale[c] = scale;
+
+        uint16_t *codes = &writer->codes[c * count];
+        uint16_t *out = &writer->scratch[c * count];
+        for (int i = 0; i < count; i++) {
+            float q = isfinite(values[i]) ? (values[i] - min) * inverse : 0.0f;
+            uint16_t code =
+                (uint16_t)fminf(fmaxf(q + 0.5f, 0.0f), TRAJECTORY_MAX_CODE);
+            out[i] = keyframe ? code : (uint16_t)(code - codes[i]);
+            codes[i] = code;
+        }
+    }
+}
+
+static int trajectory_index_append(struct trajectory_writer *writer,
+                                   const struct trajectory_frame_header *frame) {
+    if (writer->frames_written == writer->index_capacity) {
+        long capacity = writer->index_capacity > 0 ? writer->index_capacity * 2 : 256;
+        struct trajectory_index_entry *index =
+            realloc(writer->index, capacity * sizeof(*index));
+        if (index == NULL) {
+            return -1;
+        }
+        writer->index = index;
+        writer->index_capacity = capacity;
+    }
+
+    writer->index[writer->frames_written] = (struct trajectory_index_entry){
+        .offset = writer->offset,
+        .step = frame->step,
+        .time = frame->time,
+        .flags = frame->flags,
+        .count = frame->count,
+    };
+
+    return 0;
+}
+
+// Encodes and writes one frame, runs on the writer thread
+static void trajectory_write_frame(struct trajectory_writer *writer,
+                                   const struct trajectory_buffer *buffer) {
+    if (writer->error) {
+        return;
+    }
+
+    int count = buffer->count;
+    int values = count * TRAJECTORY_COLUMN_COUNT;
+    if (values > writer->code_capacity) {
+        uint16_t *codes = realloc(writer->codes, values * sizeof(uint16_t));
+        uint16_t *scratch = realloc(writer->scratch, values * sizeof(uint16_t));
+        if (codes != NULL) {
+            writer->codes = codes;
+        }
+        if (scratch != NULL) {
+            writer->scratch = scratch;
+        }
+        if (codes == NULL || scratch == NULL) {
+            SPH_LOG_ERROR("Could not allocate memory for the trajectory");
+            writer->error = 1;
+            return;
+        }
+        writer->code_capacity = values;
+    }
+
+    struct trajectory_frame_header frame = {
+        .flags = 0,
+        .count = count,
+        .step = buffer->step,
+        .time = buffer->time,
+        .raw_size = values * sizeof(uint16_t),
+    };
+
+    // A change in the number of particles breaks the delta chain
+    if (count != writer->previous_count ||
+        writer->frames_written % writer->keyframe == 0) {
+        frame.flags |= TRAJECTORY_KEYFRAME;
+    }
+
+    trajectory_encode(writer, buffer, &frame);
+    writer->previous_count = count;
+
+    const unsigned char *payload = (const unsigned char *)writer->scratch;
+    unsigned char *compressed = NULL;
+    frame.size = frame.raw_size;
+    if (writer->compress && frame.raw_size > 0) {
+        int size = 0;
+        compressed = CompressData(payload, frame.raw_size, &size);
+        if (compressed != NULL && size > 0 && (uint32_t)size < frame.raw_size) {
+            payload = compressed;
+            frame.size = size;
+            frame.flags |= TRAJECTORY_COMPRESSED;
+        }
+    }
+
+    int ok = trajectory_index_append(writer, &frame) == 0 &&
+             fwrite(&frame, sizeof(frame), 1, writer->file) == 1 &&
+             fwrite(payload, 1, frame.size, writer->file) == frame.size;
+    if (compressed != NULL) {
+        MemFree(compressed);
+    }
+
+    if (!ok) {
+        SPH_LOG_ERROR("Could not write trajectory frame of step %ld",
+                      buffer->step);
+        writer->error = 1;
+        return;
+    }
+
+    writer->offset += sizeof(frame) + frame.size;
+    writer->frames_written++;
+}
+
+static void *trajectory_writer_thread(void *args) {
+    struct trajectory_writer *writer = (struct trajectory_writer *)args;
+
+    for (;;) {
+        pthread_mutex_lock(&writer->lock);
+        while (writer->ready_count == 0 && !writer->quit) {
+            pthread_cond_wait(&writer->cond, &writer->lock);
+        }
+        if (writer->ready_count == 0) {
+            pthread_mutex_unlock(&writer->lock);
+            break;
+        }
+        int index = writer->ready[writer->ready_head];
+        writer->ready_head = (writer->ready_head + 1) % writer->buffer_count;
+        writer->ready_count--;
+        pthread_mutex_unlock(&writer->lock);
+
+        trajectory_write_frame(writer, &writer->buffers[index]);
+
+        pthread_mutex_lock(&writer->lock);
+        writer->free_list[writer->free_count++] = index;
+        pthread_mutex_unlock(&writer->lock);
+    }
+
+    return NULL;
+}
+
+// Opens a trajectory file and starts its writer thread
+//
+// Arguments:
+// - writer: the writer to initialize
+// - filename: the trajectory file, truncated if it exists
+// - params: the parameters, [trajectory] every, keyframe, compress and
+//   buffers configure the writer
+//
+// Returns 0 on success and -1 on failure
+int trajectory_writer_open(struct trajectory_writer *writer,
+                           const char *filename,
+                           const struct simulation_parameters *params) {
+    memset(writer, 0, sizeof(*writer));
+    writer->every = params->trajectory_every > 0 ? params->trajectory_every : 1;
+    writer->keyframe = params->trajectory_keyframe > 0
+                           ? params->trajectory_keyframe
+                           : TRAJECTORY_DEFAULT_KEYFRAME;
+    writer->compress = params->trajectory_compress;
+    writer->buffer_count = params->trajectory_buffers > 0
+                               ? params->trajectory_buffers
+                               : TRAJECTORY_DEFAULT_BUFFERS;
+    writer->previous_count = -1;
+
+    writer->file = fopen(filename, "wb");
+    if (writer->file == NULL) {
+        SPH_LOG_ERROR("Could not open trajectory %s", filename);
+        return -1;
+    }
+
+    struct trajectory_header header = {
+        .version = TRAJECTORY_VERSION,
+        .byte_order = CHECKPOINT_BYTE_ORDER,
+        .header_size = sizeof(header),
+        .particle_radius = params->particle_radius,
+        .width = params->width,
+        .height = params->height,
+    };
+    memcpy(header.magic, trajectory_magic, sizeof(header.magic));
+    if (fwrite(&header, sizeof(header), 1, writer->file) != 1) {
+        SPH_LOG_ERROR("Could not write trajectory %s", filename);
+        fclose(writer->file);
+        return -1;
+    }
+    writer->offset = sizeof(header);
+
+    writer->buffers = calloc(writer->buffer_count, sizeof(*writer->buffers));
+    writer->free_list = calloc(writer->buffer_count, sizeof(int));
+    writer->ready = calloc(writer->buffer_count, sizeof(int));
+    if (writer->buffers == NULL || writer->free_list == NULL ||
+        writer->ready == NULL) {
+        SPH_LOG_ERROR("Could not allocate memory for the trajectory");
+        free(writer->buffers);
+        free(writer->free_list);
+        free(writer->ready);
+        fclose(writer->file);
+        return -1;
+    }
+    for (int i = 0; i < writer->buffer_count; i++) {
+        writer->free_list[i] = i;
+    }
+    writer->free_count = writer->buffer_count;
+
+    pthread_mutex_init(&writer->lock, NULL);
+    pthread_cond_init(&writer->cond, NULL);
+    pthread_create(&writer->thread, NULL, trajectory_writer_thread, writer);
+
+    return 0;
+}
+
+// Captures the current state of the simulation when the step is a multiple
+// of the capture period
+//
+// Must be called while the workers are parked, the workers copy the
+// particles into a free buffer and the writer thread takes it from there.
+//
+// Returns 0 on success or when no frame is due and -1 if the frame was
+// dropped
+int trajectory_capture(struct trajectory_writer *writer,
+                       struct simulation *sim) {
+    if (sim->step % writer->every != 0) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&writer->lock);
+    if (writer->free_count == 0) {
+        if (writer->dropped++ == 0) {
+            SPH_LOG_WARN("The trajectory writer cannot keep up, dropping "
+                         "frames");
+        }
+        pthread_mutex_unlock(&writer->lock);
+        return -1;
+    }
+    int index = writer->free_list[--writer->free_count];
+    pthread_mutex_unlock(&writer->lock);
+
+    struct trajectory_buffer *buffer = &writer->buffers[index];
+    int count = sim->particles.count;
+    if (trajectory_buffer_reserve(buffer, count) != 0) {
+        SPH_LOG_ERROR("Could not allocate memory for the trajectory");
+        pthread_mutex_lock(&writer->lock);
+        writer->free_list[writer->free_count++] = index;
+        writer->dropped++;
+        pthread_mutex_unlock(&writer->lock);
+        return -1;
+    }
+    buffer->count = count;
+    buffer->step = sim->step;
+    buffer->time = sim->time;
+    simulation_run(sim, trajectory_copy_task, buffer);
+
+    pthread_mutex_lock(&writer->lock);
+    int tail = (writer->ready_head + writer->ready_count) % writer->buffer_count;
+    writer->ready[tail] = index;
+    writer->ready_count++;
+    pthread_cond_signal(&writer->cond);
+    pthread_mutex_unlock(&writer->lock);
+
+    return 0;
+}
+
+// Drains the queued frames, writes the seek index and closes the file
+void trajectory_writer_close(struct trajectory_writer *writer) {
+    if (writer->file == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&writer->lock);
+    writer->quit = 1;
+    pthread_cond_signal(&writer->cond);
+    pthread_mutex_unlock(&writer->lock);
+    pthread_join(writer->thread, NULL);
+
+    struct trajectory_footer footer = {
+        .index_offset = writer->offset,
+        .frame_count = writer->frames_written,
+    };
+    memcpy(footer.magic, trajectory_index_magic, sizeof(footer.magic));
+    if (!writer->error &&
+        (fwrite(writer->index, sizeof(*writer->index), writer->frames_written,
+                writer->file) != (size_t)writer->frames_written ||
+         fwrite(&footer, sizeof(footer), 1, writer->file) != 1)) {
+        SPH_LOG_ERROR("Could not write the trajectory index");
+    }
+    fclose(writer->file);
+
+    SPH_LOG_INFO("Wrote %ld trajectory frames, dropped %ld",
+                 writer->frames_written, writer->dropped);
+
+    for (int i = 0; i < writer->buffer_count; i++) {
+        trajectory_buffer_free(&writer->buffers[i]);
+    }
+    free(writer->buffers);
+    free(writer->free_list);
+    free(writer->ready);
+    free(writer->codes);
+    free(writer->scratch);
+    free(writer->index);
+    pthread_mutex_destroy(&writer->lock);
+    pthread_cond_destroy(&writer->cond);
+    writer->file = NULL;
+}
+
+// Reads the header of the frame at an offset, checking that its payload
+// ends before `end` and holds the codes of its particles
+//
+// Written so that no sum can wrap around on a corrupted file.
+//
+// Returns 0 if the frame is valid, -1 otherwise
+static int trajectory_frame_read(const struct trajectory_reader *reader,
+                                 uint64_t offset, uint64_t end,
+                                 struct trajectory_frame_header *frame) {
+    if (offset < reader->header.header_size || offset > end ||
+        end - offset < sizeof(*frame)) {
+        return -1;
+    }
+
+    memcpy(frame, reader->map + offset, sizeof(*frame));
+    if (frame->size > end - offset - sizeof(*frame) ||
+        frame->count > INT_MAX / (TRAJECTORY_COLUMN_COUNT * sizeof(uint16_t)) ||
+        frame->raw_size !=
+            frame->count * TRAJECTORY_COLUMN_COUNT * sizeof(uint16_t)) {
+        return -1;
+    }
+
+    return 0;
+}
+
+// Rebuilds the seek index of a trajectory whose writer did not close it, the
+// frames are walked from the header up to the first truncated one
+static long trajectory_scan(struct trajectory_reader *reader) {
+    long capacity = 0;
+    long count = 0;
+    uint64_t offset = reader->header.header_size;
+
+    free(reader->index);
+    reader->index = NULL;
+    reader->frames_end = reader->size;
+    for (;;) {
+        struct trajectory_frame_header frame;
+        if (trajectory_frame_read(reader, offset, reader->size, &frame) != 0) {
+            break;
+        }
+        uint64_t end = offset + sizeof(frame) + frame.size;
+
+        if (count == capacity) {
+            capacity = capacity > 0 ? capacity * 2 : 256;
+            struct trajectory_index_entry *index =
+                realloc(reader->index, capacity * sizeof(*index));
+            if (index == NULL) {
+                return -1;
+            }
+            reader->index = index;
+        }
+        reader->index[count++] = (struct trajectory_index_entry){
+            .offset = offset,
+            .step = frame.step,
+            .time = frame.time,
+            .flags = frame.flags,
+            .count = frame.count,
+        };
+        offset = end;
+    }
+
+    return count;
+}
+
+// Loads the seek index written by the writer, every entry must point to a
+// valid frame that ends before the index
+//
+// Returns 1 if the index was loaded, 0 if it is invalid or -1 on failure
+static int trajectory_index_load(struct trajectory_reader *reader,
+                                 const struct trajectory_footer *footer) {
+    size_t entry_size = sizeof(struct trajectory_index_entry);
+    uint64_t end = reader->size - sizeof(*footer);
+    if (footer->index_offset < reader->header.header_size ||
+        footer->index_offset > end ||
+        (end - footer->index_offset) % entry_size != 0 ||
+        footer->frame_count != (end - footer->index_offset) / entry_size) {
+        return 0;
+    }
+
+    size_t index_size = footer->frame_count * entry_size;
+    reader->index = malloc(index_size > 0 ? index_size : 1);
+    if (reader->index == NULL) {
+        return -1;
+    }
+    memcpy(reader->index, reader->map + footer->index_offset, index_size);
+    reader->frame_count = footer->frame_count;
+    reader->frames_end = footer->index_offset;
+
+    for (long f = 0; f < reader->frame_count; f++) {
+        const struct trajectory_index_entry *entry = &reader->index[f];
+        struct trajectory_frame_header frame;
+        if (trajectory_frame_read(reader, entry->offset, reader->frames_end,
+                                  &frame) != 0 ||
+            frame.count != entry->count || frame.flags != entry->flags) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+// Maps a trajectory file in memory and loads its seek index
+//
+// The index is rebuilt by walking the frames when the file was not closed
+// properly (e.g. the run was killed).
+//
+// Returns 0 on success and -1 if the file is missing or invalid
+int trajectory_reader_open(struct trajectory_reader *reader,
+                           const char *filename) {
+    memset(reader, 0, sizeof(*reader));
+
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        SPH_LOG_ERROR("Could not open trajectory %s", filename);
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 ||
+        (size_t)st.st_size < sizeof(struct trajectory_header)) {
+        SPH_LOG_ERROR("Trajectory %s is truncated", filename);
+        close(fd);
+        return -1;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        SPH_LOG_ERROR("Could not map trajectory %s", filename);
+        return -1;
+    }
+    reader->map = map;
+    reader->size = st.st_size;
+    memcpy(&reader->header, map, sizeof(reader->header));
+
+    if (memcmp(reader->header.magic, trajectory_magic,
+               sizeof(trajectory_magic)) != 0 ||
+        reader->header.byte_order != CHECKPOINT_BYTE_ORDER ||
+        reader->header.version != TRAJECTORY_VERSION ||
+        reader->header.header_size != sizeof(struct trajectory_header)) {
+        SPH_LOG_ERROR("Trajectory %s is invalid or from another version",
+                      filename);
+        trajectory_reader_close(reader);
+        return -1;
+    }
+
+    struct trajectory_footer footer = {0};
+    if (reader->size >= sizeof(struct trajectory_header) + sizeof(footer)) {
+        memcpy(&footer, reader->map + reader->size - sizeof(footer),
+               sizeof(footer));
+    }
+
+    int indexed = memcmp(footer.magic, trajectory_index_magic,
+                         sizeof(trajectory_index_magic)) == 0;
+    if (indexed) {
+        indexed = trajectory_index_load(reader, &footer);
+        if (indexed < 0) {
+            SPH_LOG_ERROR("Could not allocate memory for the trajectory index");
+            trajectory_reader_close(reader);
+            return -1;
+        }
+    }
+
+    if (!indexed) {
+        reader->frame_count = trajectory_scan(reader);
+        if (reader->frame_count < 0) {
+            SPH_LOG_ERROR("Could not allocate memory for the trajectory index");
+            trajectory_reader_close(reader);
+            return -1;
+        }
+        SPH_LOG_WARN("Trajectory %s has no valid index, recovered %ld frames",
+                     filename, reader->frame_count);
+    }
+
+    return 0;
+}
+
+void trajectory_reader_close(struct trajectory_reader *reader) {
+    if (reader->map != NULL) {
+        munmap((void *)reader->map, reader->size);
+    }
+    free(reader->index);
+    memset(reader, 0, sizeof(*reader));
+}
+
+void trajectory_cursor_free(struct trajectory_cursor *cursor) {
+    free(cursor->codes);
+    free(cursor->payload);
+    memset(cursor, 0, sizeof(*cursor));
+    cursor->frame = -1;
+}
+
+// Applies the payload of a frame to the codes of the cursor
+static int trajectory_apply_frame(const struct trajectory_reader *reader,
+                                  struct trajectory_cursor *cursor,
+                                  long frame) {
+    const struct trajectory_index_entry *entry = &reader->index[frame];
+    struct trajectory_frame_header header;
+    if (trajectory_frame_read(reader, entry->offset, reader->frames_end,
+                              &header) != 0) {
+        return -1;
+    }
+    const unsigned char *stored = reader->map + entry->offset + sizeof(header);
+
+    // A delta only applies on top of the previous frame of the same size
+    if (!(header.flags & TRAJECTORY_KEYFRAME) &&
+        (cursor->frame < 0 || cursor->frame != frame - 1 ||
+         (int)header.count != cursor->count)) {
+        return -1;
+    }
+
+    int values = header.count * TRAJECTORY_COLUMN_COUNT;
+    if (values > cursor->capacity) {
+        uint16_t *codes = realloc(cursor->codes, values * sizeof(uint16_t));
+        if (codes != NULL) {
+            cursor->codes = codes;
+        }
+        uint16_t *payload = realloc(cursor->payload, values * sizeof(uint16_t));
+        if (payload != NULL) {
+            cursor->payload = payload;
+        }
+        if (codes == NULL || payload == NULL) {
+            return -1;
+        }
+        cursor->capacity = values;
+    }
+
+    // The payload is copied out of the mapping since frames are not aligned
+    if (header.flags & TRAJECTORY_COMPRESSED) {
+        int size = 0;
+        unsigned char *raw = DecompressData(stored, header.size, &size);
+        if (raw == NULL || (uint32_t)size != header.raw_size) {
+            MemFree(raw);
+            return -1;
+        }
+        memcpy(cursor->payload, raw, size);
+        MemFree(raw);
+    } else if (header.size == header.raw_size) {
+        memcpy(cursor->payload, stored, header.raw_size);
+    } else {
+        return -1;
+    }
+
+    if (header.flags & TRAJECTORY_KEYFRAME) {
+        memcpy(cursor->codes, cursor->payload, values * sizeof(uint16_t));
+    } else {
+        for (int i = 0; i < values; i++) {
+            cursor->codes[i] += cursor->payload[i];
+        }
+    }
+    cursor->count = header.count;
+    cursor->frame = frame;
+
+    return 0;
+}
+
+// Decodes a frame of a trajectory
+//
+// Seeks to the closest keyframe at or before the frame and applies the
+// deltas up to it, unless the cursor already holds a frame of the same delta
+// chain, in which case only the missing deltas are applied.
+//
+// Arguments:
+// - reader: the opened trajectory
+// - cursor: the decoder state, zero initialized with frame -1 at first
+// - frame: the index of the frame in the seek index
+// - out: the buffer in which the columns are dequantized
+//
+// Returns 0 on success and -1 on failure
+int trajectory_read_frame(const struct trajectory_reader *reader,
+                          struct trajectory_cursor *cursor, long frame,
+                          struct trajectory_buffer *out) {
+    if (frame < 0 || frame >= reader->frame_count) {
+        return -1;
+    }
+
+    long start = frame;
+    while (start > 0 && !(reader->index[start].flags & TRAJECTORY_KEYFRAME)) {
+        start--;
+    }
+    if (cursor->frame >= start && cursor->frame <= frame) {
+        start = cursor->frame + 1;
+    }
+
+    for (long f = start; f <= frame; f++) {
+        if (trajectory_apply_frame(reader, cursor, f) != 0) {
+            SPH_LOG_ERROR("Could not decode trajectory frame %ld", f);
+            cursor->frame = -1;
+            return -1;
+        }
+    }
+
+    struct trajectory_frame_header header;
+    memcpy(&header, reader->map + reader->index[frame].offset, sizeof(header));
+    int count = header.count;
+    if (trajectory_buffer_reserve(out, count) != 0) {
+        return -1;
+    }
+
+    for (int c = 0; c < TRAJECTORY_COLUMN_COUNT; c++) {
+        const uint16_t *codes = &cursor->codes[c * count];
+        float min = header.min[c];
+        float scale = header.scale[c];
+        for (int i = 0; i < count; i++) {
+            out->columns[c][i] = min + codes[i] * scale;
+        }
+    }
+    out->count = count;
+    out->step = header.step;
+    out->time = header.time;
+
+    return 0;
+}
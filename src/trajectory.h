@@ -0,0 +1,154 @@
+#ifndef TRAJECTORY_H
+#define TRAJECTORY_H
+
+#include "simulation.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Trajectory file format
+//
+// A small header followed by a sequence of frames and, once the writer is
+// closed, a seek index and a footer. Every frame stores the same columns as
+// the checkpoints quantized to 16 bits with a per frame range per column. A
+// delta frame stores the difference between its codes and the codes of the
+// previous frame, a keyframe stores the codes themselves. The payload of a
+// frame is optionally compressed with DEFLATE.
+#define TRAJECTORY_VERSION 1
+#define TRAJECTORY_COLUMN_COUNT CHECKPOINT_COLUMN_COUNT
+#define TRAJECTORY_DEFAULT_KEYFRAME 30
+#define TRAJECTORY_DEFAULT_BUFFERS 4
+
+// Frame flags
+#define TRAJECTORY_KEYFRAME 0x1
+#define TRAJECTORY_COMPRESSED 0x2
+
+struct trajectory_header {
+        char magic[8];         // "SPHTRAJ"
+        uint32_t version;      // TRAJECTORY_VERSION
+        uint32_t byte_order;   // CHECKPOINT_BYTE_ORDER as written
+        uint32_t header_size;  // sizeof(struct trajectory_header)
+        float particle_radius; // Particle radius (in meters)
+        float width;           // Width of the world (in meters)
+        float height;          // Height of the world (in meters)
+};
+
+struct trajectory_frame_header {
+        uint32_t flags;    // TRAJECTORY_KEYFRAME and TRAJECTORY_COMPRESSED
+        uint32_t count;    // Number of particles
+        uint64_t step;     // Step of the simulation
+        double time;       // Simulated time (in seconds)
+        uint32_t size;     // Size of the stored payload (in bytes)
+        uint32_t raw_size; // Size of the uncompressed payload (in bytes)
+        float min[TRAJECTORY_COLUMN_COUNT];   // Lowest value of each column
+        float scale[TRAJECTORY_COLUMN_COUNT]; // Value of one quantization step
+};
+
+struct trajectory_index_entry {
+        uint64_t offset; // Offset of the frame header in the file
+        uint64_t step;
+        double time;
+        uint32_t flags;
+        uint32_t count;
+};
+
+struct trajectory_footer {
+        uint64_t index_offset; // Offset of the first index entry
+        uint64_t frame_count;  // Number of index entries
+        char magic[8];         // "SPHTIDX"
+};
+
+// The decoded columns of a frame, in the writer it is owned either by the
+// free list, by the ready queue or by the writer thread
+struct trajectory_buffer {
+        float *columns[TRAJECTORY_COLUMN_COUNT];
+        int capacity;
+        int count;
+        long step;
+        double time;
+};
+
+// Streams frames to disk from a dedicated thread
+//
+// The main thread captures a frame into a free buffer with the help of the
+// workers and queues it, the writer thread encodes and writes the queued
+// frames in order. When the disk cannot keep up and no buffer is free, the
+// frame is dropped instead of stalling the simulation.
+struct trajectory_writer {
+        FILE *file;
+        int every;       // Steps between two captured frames
+        int keyframe;    // Frames between two keyframes
+        int compress;    // Whether the payloads are compressed
+
+        // Buffer pool, the free list and the ready queue are rings of indices
+        struct trajectory_buffer *buffers;
+        int buffer_count;
+        int *free_list;
+        int free_count;
+        int *ready;
+        int ready_head;
+        int ready_count;
+        pthread_mutex_t lock;
+        pthread_cond_t cond;
+        pthread_t thread;
+        int quit;
+
+        // Owned by the writer thread
+        uint16_t *codes;      // Codes of the last written frame
+        uint16_t *scratch;    // Payload of the frame being encoded
+        int code_capacity;
+        int previous_count;   // Particles in the last written frame, -1 if none
+        long frames_written;
+        struct trajectory_index_entry *index;
+        long index_capacity;
+        uint64_t offset;
+        int error;
+
+        long dropped; // Frames dropped because no buffer was free
+};
+
+// A trajectory file mapped in memory with its seek index
+struct trajectory_reader {
+        const unsigned char *map;
+        size_t size;
+        struct trajectory_header header;
+        struct trajectory_index_entry *index; // Copy of the seek index
+        long frame_count;
+        uint64_t frames_end; // End of the frames, where the index starts
+};
+
+// Decoder state, holds the codes of the last decoded frame so that playing
+// forward only applies one delta per frame
+struct trajectory_cursor {
+        uint16_t *codes;
+        uint16_t *payload;
+        int capacity;
+        int count;
+        long frame; // Frame held by the codes, -1 if none
+};
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+int trajectory_writer_open(struct trajectory_writer *writer,
+                           const char *filename,
+                           const struct simulation_parameters *params);
+int trajectory_capture(struct trajectory_writer *writer,
+                       struct simulation *sim);
+void trajectory_writer_close(struct trajectory_writer *writer);
+
+int trajectory_reader_open(struct trajectory_reader *reader,
+                           const char *filename);
+void trajectory_reader_close(struct trajectory_reader *reader);
+int trajectory_read_frame(const struct trajectory_reader *reader,
+                          struct trajectory_cursor *cursor, long frame,
+                          struct trajectory_buffer *out);
+void trajectory_cursor_free(struct trajectory_cursor *cursor);
+void trajectory_buffer_free(struct trajectory_buffer *buffer);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif // TRAJECTORY_H
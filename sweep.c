@@ -0,0 +1,420 @@
+#include "raylib.h"
+#include "simulation.h"
+#include "sph.h"
+#include "timing.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Runs the Cartesian product of parameter ranges as headless simulations
+//
+// Usage: sweep [-j jobs] [-t threads] [-s steps] [-o summary.csv]
+//              template.ini section.key=values...
+//
+// Values are either a list (gaussian,cubic) or an inclusive range
+// (start:stop:step). Section and key use the names of params.ini, the key is
+// after the last dot (e.g. pressure.gas.rest_density=0.6:1.0:0.2).
+
+#define MAX_AXES 8
+#define MAX_VALUES 64
+#define MAX_VALUE_LENGTH 32
+
+// Below this many particles per thread the barriers cost more than the work
+#define MIN_PARTICLES_PER_THREAD 32
+
+struct sweep_axis {
+        char section[64];
+        char key[64];
+        char values[MAX_VALUES][MAX_VALUE_LENGTH];
+        int count;
+};
+
+struct sweep_result {
+        int threads;
+        double wall;           // Wall time of the run (in seconds)
+        double ns_per_step;    // Wall time per particle per step
+        struct simulation_stats stats;
+        int particles;
+        int error;
+};
+
+struct sweep {
+        struct simulation_parameters base;
+        struct sweep_axis axes[MAX_AXES];
+        int axis_count;
+        int variant_count;
+        int jobs;
+        int threads_per_run;
+        struct sweep_result *results;
+
+        pthread_mutex_t lock; // Protects next and the random generator
+        int next;
+};
+
+// A runner of variants, the concurrent runs are pinned to distinct CPUs
+struct sweep_job {
+        struct sweep *sweep;
+        char *affinity; // CPUs of the workers of this job, NULL for none
+};
+
+static int sweep_parse_axis(struct sweep_axis *axis, const char *spec) {
+    const char *eq = strchr(spec, '=');
+    if (eq == NULL) {
+        return -1;
+    }
+
+    // The key is after the last dot of the name, the section before it
+    const char *dot = NULL;
+    for (const char *c = spec; c < eq; c++) {
+        if (*c == '.') {
+            dot = c;
+        }
+    }
+    if (dot == NULL || dot - spec >= (long)sizeof(axis->section) ||
+        eq - dot - 1 >= (long)sizeof(axis->key)) {
+        return -1;
+    }
+    snprintf(axis->section, sizeof(axis->section), "%.*s", (int)(dot - spec),
+             spec);
+    snprintf(axis->key, sizeof(axis->key), "%.*s", (int)(eq - dot - 1),
+             dot + 1);
+
+    const char *values = eq + 1;
+    axis->count = 0;
+
+    float start, stop, step;
+    if (strchr(values, ':') != NULL) {
+        if (sscanf(values, "%f:%f:%f", &start, &stop, &step) != 3 ||
+            step <= 0.0f) {
+            return -1;
+        }
+        for (int i = 0; axis->count < MAX_VALUES; i++) {
+            float v = start + i * step;
+            if (v > stop + step * 1e-3f) {
+                break;
+            }
+            snprintf(axis->values[axis->count++], MAX_VALUE_LENGTH, "%g", v);
+        }
+        return axis->count > 0 ? 0 : -1;
+    }
+
+    char copy[MAX_VALUES * MAX_VALUE_LENGTH];
+    snprintf(copy, sizeof(copy), "%s", values);
+    for (char *token = strtok(copy, ","); token != NULL;
+         token = strtok(NULL, ",")) {
+        if (axis->count == MAX_VALUES) {
+            return -1;
+        }
+        snprintf(axis->values[axis->count++], MAX_VALUE_LENGTH, "%s", token);
+    }
+
+    return axis->count > 0 ? 0 : -1;
+}
+
+// Decodes a variant index into one value per axis, the first axis changes
+// the slowest
+static void sweep_variant_indices(struct sweep *sweep, int variant,
+                                  int *indices) {
+    for (int a = sweep->axis_count - 1; a >= 0; a--) {
+        indices[a] = variant % sweep->axes[a].count;
+        variant /= sweep->axes[a].count;
+    }
+}
+
+static int sweep_variant_params(const struct sweep_job *job, int variant,
+                                struct simulation_parameters *params) {
+    struct sweep *sweep = job->sweep;
+    int indices[MAX_AXES];
+    sweep_variant_indices(sweep, variant, indices);
+
+    *params = sweep->base;
+    params->affinity = job->affinity;
+    for (int a = 0; a < sweep->axis_count; a++) {
+        struct sweep_axis *axis = &sweep->axes[a];
+        if (simulation_parameters_set(params, axis->section, axis->key,
+                                      axis->values[indices[a]]) != 0) {
+            SPH_LOG_ERROR("Invalid override %s.%s=%s", axis->section,
+                          axis->key, axis->values[indices[a]]);
+            return -1;
+        }
+    }
+
+    // Small runs get fewer threads, otherwise the barriers dominate the step
+    int threads = sweep->threads_per_run;
+    int useful = params->particle_count / MIN_PARTICLES_PER_THREAD;
+    if (useful < threads) {
+        threads = useful > 1 ? useful : 1;
+    }
+    params->threads = threads;
+
+    return 0;
+}
+
+static void sweep_run(const struct sweep_job *job, int variant) {
+    struct sweep *sweep = job->sweep;
+    struct sweep_result *result = &sweep->results[variant];
+    struct simulation_parameters params;
+    if (sweep_variant_params(job, variant, &params) != 0) {
+        result->error = 1;
+        return;
+    }
+
+    // Every variant starts from the same particles, the random generator of
+    // raylib is global so the initialization is serialized
+    struct simulation sim;
+    pthread_mutex_lock(&sweep->lock);
+    SetRandomSeed(params.seed != 0 ? params.seed : 42);
+    int error = simulation_init(&sim, &params);
+    pthread_mutex_unlock(&sweep->lock);
+    if (error != 0) {
+        result->error = 1;
+        return;
+    }
+
+    double start = timing_now();
+    for (int i = 0; i < params.steps; i++) {
+        simulation_step(&sim, params.dt);
+    }
+    result->wall = timing_now() - start;
+
+    double work = (double)(params.steps > 0 ? params.steps : 1) *
+                  (sim.particles.count > 0 ? sim.particles.count : 1);
+    result->ns_per_step = result->wall * 1e9 / work;
+    result->threads = sim.threads;
+    result->particles = sim.particles.count;
+    simulation_compute_stats(&sim, &result->stats);
+
+    simulation_free(&sim);
+}
+
+static void *sweep_runner(void *args) {
+    const struct sweep_job *job = (const struct sweep_job *)args;
+    struct sweep *sweep = job->sweep;
+
+    for (;;) {
+        pthread_mutex_lock(&sweep->lock);
+        int variant = sweep->next++;
+        pthread_mutex_unlock(&sweep->lock);
+
+        if (variant >= sweep->variant_count) {
+            break;
+        }
+
+        sweep_run(job, variant);
+        SPH_LOG_INFO("variant %d/%d done", variant + 1, sweep->variant_count);
+    }
+
+    return NULL;
+}
+
+// Splits the CPUs of the affinity of the template between the jobs, each
+// job gets the next threads_per_run of them as an explicit list so that the
+// concurrent runs do not all pin their workers to the first CPUs
+//
+// Returns 0 on success or -1 if the affinity is invalid
+static int sweep_plan_jobs(struct sweep *sweep, struct sweep_job *jobs) {
+    int threads = sweep->threads_per_run;
+    int workers = sweep->jobs * threads;
+    for (int j = 0; j < sweep->jobs; j++) {
+        jobs[j] = (struct sweep_job){.sweep = sweep};
+    }
+
+    int *cpus = malloc(workers * sizeof(int));
+    if (cpus == NULL ||
+        affinity_plan(sweep->base.affinity, workers, cpus) != 0) {
+        free(cpus);
+        return -1;
+    }
+
+    // The plan wraps around when the budget is larger than the CPUs
+    int shared = 0;
+    for (int i = 1; i < workers && cpus[0] >= 0 && !shared; i++) {
+        for (int k = 0; k < i && !shared; k++) {
+            shared = cpus[i] == cpus[k];
+        }
+    }
+    if (shared) {
+        SPH_LOG_WARN("The affinity has fewer CPUs than the %d threads of the "
+                     "sweep, concurrent runs share some of them",
+                     workers);
+    }
+
+    for (int j = 0; j < sweep->jobs && cpus[0] >= 0; j++) {
+        // A CPU takes at most 11 characters with its comma
+        size_t size = (size_t)threads * 12 + 1;
+        jobs[j].affinity = malloc(size);
+        if (jobs[j].affinity == NULL) {
+            SPH_LOG_ERROR("Could not allocate the CPUs of %d jobs",
+                          sweep->jobs);
+            for (int k = 0; k < j; k++) {
+                free(jobs[k].affinity);
+            }
+            free(cpus);
+            return -1;
+        }
+
+        size_t length = 0;
+        for (int t = 0; t < threads; t++) {
+            length += snprintf(jobs[j].affinity + length, size - length,
+                               t > 0 ? ",%d" : "%d", cpus[j * threads + t]);
+        }
+        SPH_LOG_INFO("Job %d runs on CPUs %s", j, jobs[j].affinity);
+    }
+    free(cpus);
+
+    return 0;
+}
+
+static void sweep_print(struct sweep *sweep, FILE *file, int csv) {
+    const char *sep = csv ? "," : " ";
+
+    for (int a = 0; a < sweep->axis_count; a++) {
+        char name[160];
+        snprintf(name, sizeof(name), "%s.%s", sweep->axes[a].section,
+                 sweep->axes[a].key);
+        fprintf(file, csv ? "%s%s" : "%-24s%s", name, sep);
+    }
+    fprintf(file,
+            csv ? "threads,wall_s,ns_per_particle_step,mean_density,"
+                  "max_density,mean_pressure,kinetic_energy,max_speed\n"
+                : "%7s %8s %12s %12s %12s %12s %12s %10s\n",
+            "threads", "wall_s", "ns/p-step", "mean_rho", "max_rho",
+            "mean_p", "kinetic", "max_v");
+
+    for (int v = 0; v < sweep->variant_count; v++) {
+        int indices[MAX_AXES];
+        sweep_variant_indices(sweep, v, indices);
+        for (int a = 0; a < sweep->axis_count; a++) {
+            fprintf(file, csv ? "%s%s" : "%-24s%s",
+                    sweep->axes[a].values[indices[a]], sep);
+        }
+
+        struct sweep_result *r = &sweep->results[v];
+        if (r->error) {
+            fprintf(file, "error\n");
+            continue;
+        }
+        fprintf(file,
+                csv ? "%d,%.3f,%.3f,%.4f,%.4f,%.4f,%.4f,%.4f\n"
+                    : "%7d %8.3f %12.3f %12.4f %12.4f %12.4f %12.4f %10.4f\n",
+                r->threads, r->wall, r->ns_per_step, r->stats.mean_density,
+                r->stats.max_density, r->stats.mean_pressure,
+                r->stats.kinetic_energy, r->stats.max_speed);
+    }
+}
+
+static void usage(const char *program) {
+    fprintf(stderr,
+            "Usage: %s [-j jobs] [-t threads] [-s steps] [-o summary.csv] "
+            "template.ini section.key=a,b,c|start:stop:step...\n",
+            program);
+}
+
+int main(int argc, char **argv) {
+    struct sweep sweep = {0};
+    const char *template = NULL;
+    const char *output = NULL;
+    int jobs = 0;
+    int budget = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int steps = -1;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            jobs = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            budget = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            steps = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            output = argv[++i];
+        } else if (template == NULL && strchr(argv[i], '=') == NULL) {
+            template = argv[i];
+        } else if (sweep.axis_count < MAX_AXES &&
+                   sweep_parse_axis(&sweep.axes[sweep.axis_count], argv[i]) ==
+                       0) {
+            sweep.axis_count++;
+        } else {
+            SPH_LOG_ERROR("Invalid argument %s", argv[i]);
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    if (template == NULL) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    simulation_parameters_parse(template, &sweep.base);
+    if (steps >= 0) {
+        sweep.base.steps = steps;
+    }
+
+    sweep.variant_count = 1;
+    for (int a = 0; a < sweep.axis_count; a++) {
+        sweep.variant_count *= sweep.axes[a].count;
+    }
+
+    // Split the thread budget between the concurrent runs
+    if (budget < 1) {
+        budget = 1;
+    }
+    if (jobs < 1 || jobs > budget) {
+        jobs = budget;
+    }
+    if (jobs > sweep.variant_count) {
+        jobs = sweep.variant_count;
+    }
+    sweep.jobs = jobs;
+    sweep.threads_per_run = budget / jobs;
+
+    sweep.results = calloc(sweep.variant_count, sizeof(struct sweep_result));
+    if (sweep.results == NULL) {
+        SPH_LOG_ERROR("Could not allocate %d results", sweep.variant_count);
+        return 1;
+    }
+
+    SPH_LOG_INFO("Running %d variants, %d at a time with up to %d threads "
+                 "each",
+                 sweep.variant_count, sweep.jobs, sweep.threads_per_run);
+
+    struct sweep_job job_list[jobs];
+    if (sweep_plan_jobs(&sweep, job_list) != 0) {
+        free(sweep.results);
+        return 2;
+    }
+
+    pthread_mutex_init(&sweep.lock, NULL);
+    pthread_t runners[jobs];
+    for (int j = 0; j < jobs; j++) {
+        pthread_create(&runners[j], NULL, sweep_runner, &job_list[j]);
+    }
+    for (int j = 0; j < jobs; j++) {
+        pthread_join(runners[j], NULL);
+    }
+    pthread_mutex_destroy(&sweep.lock);
+    for (int j = 0; j < jobs; j++) {
+        free(job_list[j].affinity);
+    }
+
+    sweep_print(&sweep, stdout, 0);
+    if (output != NULL) {
+        FILE *file = fopen(output, "w");
+        if (file == NULL) {
+            SPH_LOG_ERROR("Could not open %s", output);
+        } else {
+            sweep_print(&sweep, file, 1);
+            fclose(file);
+        }
+    }
+
+    int errors = 0;
+    for (int v = 0; v < sweep.variant_count; v++) {
+        errors += sweep.results[v].error;
+    }
+    free(sweep.results);
+
+    return errors > 0 ? 1 : 0;
+}
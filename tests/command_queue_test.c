@@ -0,0 +1,85 @@
+#include "command.h"
+#include "test.h"
+
+#define QUEUE_CAPACITY 8
+
+static struct command adjust(int value) {
+    return (struct command){
+        .type = COMMAND_ADJUST,
+        .adjust = {COMMAND_PARAMETER_H, (float)value, 0.0f, 0.0f}};
+}
+
+// Fills the queue until a push fails, then drains it in order
+static void test_full_queue(void) {
+    struct command_queue queue;
+    CHECK(command_queue_init(&queue, QUEUE_CAPACITY) == 0);
+
+    struct command command = adjust(0);
+    CHECK(command_queue_pop(&queue, &command) == 0);
+
+    for (int i = 0; i < QUEUE_CAPACITY; i++) {
+        command = adjust(i);
+        CHECK(command_queue_push(&queue, &command) == 0);
+    }
+    command = adjust(QUEUE_CAPACITY);
+    CHECK(command_queue_push(&queue, &command) == -1);
+
+    for (int i = 0; i < QUEUE_CAPACITY; i++) {
+        CHECK(command_queue_pop(&queue, &command) == 1);
+        CHECK(command.type == COMMAND_ADJUST);
+        CHECK(command.adjust.delta == (float)i);
+    }
+    CHECK(command_queue_pop(&queue, &command) == 0);
+
+    // A slot freed by a pop can be pushed to again
+    command = adjust(-1);
+    CHECK(command_queue_push(&queue, &command) == 0);
+    CHECK(command_queue_pop(&queue, &command) == 1);
+    CHECK(command.adjust.delta == -1.0f);
+
+    command_queue_free(&queue);
+}
+
+// Runs the positions over many laps of the slots, with the queue partly
+// filled, so that every slot is reused and the order kept across the wrap
+static void test_wraparound(void) {
+    struct command_queue queue;
+    CHECK(command_queue_init(&queue, QUEUE_CAPACITY) == 0);
+
+    int pushed = 0;
+    int popped = 0;
+    for (int lap = 0; lap < 10 * QUEUE_CAPACITY; lap++) {
+        int batch = 1 + lap % QUEUE_CAPACITY;
+        for (int i = 0; i < batch; i++) {
+            struct command command = adjust(pushed);
+            if (command_queue_push(&queue, &command) == 0) {
+                pushed++;
+            }
+        }
+        CHECK(pushed - popped <= QUEUE_CAPACITY);
+
+        for (int i = 0; i < (batch + 1) / 2; i++) {
+            struct command command;
+            CHECK(command_queue_pop(&queue, &command) == 1);
+            CHECK(command.adjust.delta == (float)popped);
+            popped++;
+        }
+    }
+
+    struct command command;
+    while (command_queue_pop(&queue, &command)) {
+        CHECK(command.adjust.delta == (float)popped);
+        popped++;
+    }
+    CHECK(popped == pushed);
+    CHECK(queue.tail > 4 * QUEUE_CAPACITY);
+
+    command_queue_free(&queue);
+}
+
+int main(void) {
+    test_full_queue();
+    test_wraparound();
+
+    return test_failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,135 @@
+#include "particle_pool.h"
+#include "test.h"
+
+#define POOL_MAX (1 << 16)
+
+static struct particle particle(int id) {
+    return (struct particle){.position = {(float)id, 0.0f}};
+}
+
+static int id(const struct particle_array *particles, int index) {
+    return (int)particles->items[index].position.x;
+}
+
+// Removed particles keep the indices of the others until a compaction, and
+// the next particles added take their holes
+static void test_remove(void) {
+    struct particle_array particles;
+    struct particle_pool pool;
+    CHECK(particle_pool_init(&pool, &particles, POOL_MAX) == 0);
+
+    for (int i = 0; i < 10; i++) {
+        struct particle p = particle(i);
+        CHECK(particle_pool_add(&pool, &p) == i);
+    }
+
+    particle_pool_remove(&pool, 3);
+    particle_pool_remove(&pool, 7);
+    particle_pool_remove(&pool, 7);
+    particle_pool_remove(&pool, 10);
+    CHECK(pool.hole_count == 2);
+    CHECK(particles.count == 10);
+    CHECK(id(&particles, 5) == 5);
+
+    struct particle p = particle(100);
+    CHECK(particle_pool_add(&pool, &p) == 7);
+    CHECK(pool.hole_count == 1);
+
+    // Resizing drops the holes left
+    CHECK(particle_pool_resize(&pool, 4) == 0);
+    CHECK(pool.hole_count == 0);
+    p = particle(101);
+    CHECK(particle_pool_add(&pool, &p) == 4);
+
+    particle_pool_free(&pool);
+}
+
+// The holes are filled with the last particles, holes at the end are
+// dropped, and every particle alive is kept once
+static void test_compact(void) {
+    struct particle_array particles;
+    struct particle_pool pool;
+    CHECK(particle_pool_init(&pool, &particles, POOL_MAX) == 0);
+
+    int count = 100;
+    for (int i = 0; i < count; i++) {
+        struct particle p = particle(i);
+        particle_pool_add(&pool, &p);
+    }
+    int removed = 0;
+    for (int i = 0; i < count; i += 3) {
+        particle_pool_remove(&pool, i);
+        removed++;
+    }
+    particle_pool_remove(&pool, count - 2);
+    particle_pool_remove(&pool, count - 3);
+    removed += 2;
+
+    CHECK(particle_pool_compact(&pool) > 0);
+    CHECK(pool.hole_count == 0);
+    CHECK(particles.count == count - removed);
+
+    int seen[100] = {0};
+    for (int i = 0; i < particles.count; i++) {
+        int alive = id(&particles, i);
+        CHECK(alive >= 0 && alive < count - 3 && alive % 3 != 0);
+        CHECK(seen[alive]++ == 0);
+        CHECK(!pool.dead[i]);
+    }
+
+    // Nothing moves once there is no hole
+    CHECK(particle_pool_compact(&pool) == 0);
+
+    particle_pool_free(&pool);
+}
+
+// A compaction releases the pages past the particles once most of them are
+// unused, and they can be committed again
+static void test_release(void) {
+    struct particle_array particles;
+    struct particle_pool pool;
+    CHECK(particle_pool_init(&pool, &particles, POOL_MAX) == 0);
+
+    int count = 16 * PARTICLE_POOL_PAGE_SIZE / (int)sizeof(struct particle);
+    CHECK(particle_pool_resize(&pool, count) == 0);
+    for (int i = 0; i < count; i++) {
+        particles.items[i] = particle(i);
+    }
+    size_t committed = pool.committed;
+    CHECK(committed >= 16 * PARTICLE_POOL_PAGE_SIZE);
+    CHECK(particles.capacity >= count);
+
+    // Removing a few particles keeps the pages
+    particle_pool_remove(&pool, 0);
+    particle_pool_compact(&pool);
+    CHECK(pool.committed == committed);
+
+    for (int i = 10; i < particles.count; i++) {
+        particle_pool_remove(&pool, i);
+    }
+    particle_pool_compact(&pool);
+    CHECK(particles.count == 10);
+    CHECK(pool.committed == PARTICLE_POOL_PAGE_SIZE);
+    CHECK(particles.capacity ==
+          PARTICLE_POOL_PAGE_SIZE / (int)sizeof(struct particle));
+    CHECK(id(&particles, 0) == count - 1);
+    CHECK(id(&particles, 9) == 9);
+
+    CHECK(particle_pool_reserve(&pool, count) == 0);
+    CHECK(pool.committed == committed);
+    particles.items[count - 1] = particle(count);
+    CHECK(id(&particles, count - 1) == count);
+
+    // Logs an error, the address space is only reserved for POOL_MAX
+    CHECK(particle_pool_reserve(&pool, POOL_MAX + 1) == -1);
+
+    particle_pool_free(&pool);
+}
+
+int main(void) {
+    test_remove();
+    test_compact();
+    test_release();
+
+    return test_failures > 0 ? 1 : 0;
+}
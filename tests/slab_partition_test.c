@@ -0,0 +1,116 @@
+#include "slab_partition.h"
+#include "test.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define WORKERS 8
+#define PARTICLES 3000
+#define WIDTH 8.0f
+#define HEIGHT 6.0f
+#define ROUNDS 5
+
+// Scatters the particles over the world, half of them crowded on the left
+// so that the slabs get different widths
+static void scatter(struct particle_array *particles) {
+    srand(3);
+    for (int i = 0; i < particles->count; i++) {
+        float x = WIDTH * rand() / RAND_MAX;
+        particles->items[i].position =
+            (Vector2){i < particles->count / 2 ? 0.3f * x : x,
+                      HEIGHT * rand() / RAND_MAX};
+        particles->items[i].density = 1.0f + (float)rand() / RAND_MAX;
+        particles->items[i].pressure = (float)rand() / RAND_MAX;
+    }
+}
+
+// Whether a sum over the halo matches the sum over the whole array
+//
+// The scalar loops add the same terms in the same order, the particles out
+// of reach adding zeros, so both give the same bits. The 4-lane loops group
+// the particles from the start of the array they are given, which changes
+// the order of the additions, so they only agree to rounding.
+static int same_sum(float full, float near, float magnitude) {
+#ifdef SPH_SIMD
+    return fabsf(full - near) <= 1e-5f * magnitude;
+#else
+    (void)magnitude;
+    return memcmp(&full, &near, sizeof(full)) == 0;
+#endif
+}
+
+// The neighbour loops of a slab must give the same result whether they read
+// its halo or the whole array, over migrations and moving boundaries
+static void test_halo(enum kernel_type type) {
+    struct particle_array particles = {0};
+    particles.items = calloc(PARTICLES, sizeof(struct particle));
+    particles.count = PARTICLES;
+    particles.capacity = PARTICLES;
+    CHECK(particles.items != NULL);
+    scatter(&particles);
+
+    struct slab_partition partition;
+    CHECK(slab_partition_init(&partition, WORKERS) == 0);
+
+    struct kernel_coefficients kernel;
+    kernel_coefficients_init(&kernel, 0.3f, type);
+
+    int narrowed = 0;
+    for (int round = 0; round < ROUNDS; round++) {
+        CHECK(slab_partition_plan(&partition, &particles, WORKERS, WIDTH,
+                                  kernel_support(&kernel)) >= 0);
+        CHECK(partition.first[0] == 0);
+        CHECK(partition.first[WORKERS] == PARTICLES);
+
+        for (int w = 0; w < WORKERS; w++) {
+            int start = partition.halo_start[w];
+            CHECK(start <= partition.first[w]);
+            CHECK(partition.halo_end[w] >= partition.first[w + 1]);
+            narrowed += partition.halo_end[w] - start < PARTICLES;
+
+            struct particle_array halo = particles;
+            halo.items += start;
+            halo.count = partition.halo_end[w] - start;
+            for (int i = partition.first[w]; i < partition.first[w + 1]; i++) {
+                float full = particle_density_kernel(&particles, i, &kernel,
+                                                     0.1f);
+                float near =
+                    particle_density_kernel(&halo, i - start, &kernel, 0.1f);
+                CHECK(same_sum(full, near, full));
+
+                Vector2 full_gradient = particle_pressure_gradient_kernel(
+                    &particles, i, &kernel, 0.1f);
+                Vector2 near_gradient = particle_pressure_gradient_kernel(
+                    &halo, i - start, &kernel, 0.1f);
+                float magnitude = fmaxf(fabsf(full_gradient.x),
+                                        fabsf(full_gradient.y));
+                CHECK(same_sum(full_gradient.x, near_gradient.x, magnitude));
+                CHECK(same_sum(full_gradient.y, near_gradient.y, magnitude));
+            }
+
+            // The first worker is slower, so the boundaries move
+            partition.busy[w] = 0.001 *
+                                (partition.first[w + 1] - partition.first[w]) *
+                                (w == 0 ? 2 : 1);
+        }
+
+        for (int i = 0; i < PARTICLES; i++) {
+            particles.items[i].position.x +=
+                0.05f * ((float)rand() / RAND_MAX - 0.5f);
+        }
+    }
+
+    // A kernel with a finite support must leave some slabs a narrower halo
+    CHECK(narrowed > 0 || !isfinite(kernel_support(&kernel)));
+
+    slab_partition_free(&partition);
+    free(particles.items);
+}
+
+int main(void) {
+    test_halo(GAUSSIAN_KERNEL);
+    test_halo(CUBIC_KERNEL);
+    test_halo(LINEAR_KERNEL);
+
+    return test_failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,19 @@
+#ifndef TEST_H
+#define TEST_H
+
+#include <stdio.h>
+
+// Reports a failed condition and makes the test exit with 1, the run goes
+// on so that every failure of a test is listed
+#define CHECK(condition)                                                       \
+    do {                                                                       \
+        if (!(condition)) {                                                    \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__,   \
+                    #condition);                                               \
+            test_failures++;                                                   \
+        }                                                                      \
+    } while (0)
+
+static int test_failures = 0;
+
+#endif // TEST_H
@@ -0,0 +1,126 @@
+// Measures the web build under Node: the same particles are simulated on
+// the main thread alone and then with a pool of worker_threads, the time per
+// step of both runs is printed and the particles must come out identical.
+//
+// Usage: node bench.js [wasm] [workers] [particles] [steps] [reference]
+//
+// The defaults are ../dist/wasm/particle_simulator.wasm, one worker less
+// than the cores, 2000 particles and 20 steps. When a reference build is
+// given (e.g. the scalar particle_simulator_scalar.wasm), one step of both
+// builds is compared as well and must agree within REFERENCE_TOLERANCE, the
+// kernels of the SIMD build round differently so they cannot be identical.
+
+const fs = require("fs");
+const os = require("os");
+const path = require("path");
+const {
+    RaylibWorkerPool,
+    make_environment,
+    mathEnvironment,
+    MEMORY_INITIAL_PAGES,
+    MEMORY_MAXIMUM_PAGES,
+} = require("./raylib.js");
+
+// Floats in a struct particle: position, velocity, density and pressure
+const PARTICLE_FLOATS = 6;
+
+// Largest difference to the reference build, relative to the largest value
+const REFERENCE_TOLERANCE = 1e-4;
+
+async function run(module, workers, particles, steps) {
+    const memory = new WebAssembly.Memory({
+        initial: MEMORY_INITIAL_PAGES,
+        maximum: MEMORY_MAXIMUM_PAGES,
+        shared: true,
+    });
+
+    // Both runs start from the same particles
+    let seed = 1;
+    const instance = await WebAssembly.instantiate(module, {
+        env: make_environment({
+            ...mathEnvironment,
+            memory,
+            GetRandomValue(min, max) {
+                seed = (Math.imul(seed, 1103515245) + 12345) >>> 0;
+                return min + (seed >>> 16) % (max - min + 1);
+            },
+        }),
+    });
+    const exports = instance.exports;
+
+    const pool = new RaylibWorkerPool({
+        module,
+        memory,
+        exports,
+        workers,
+        workerPath: path.join(__dirname, "raylib_worker.js"),
+    });
+    while (exports.pool_ready() < pool.workers.length) {
+        await new Promise((resolve) => setTimeout(resolve, 10));
+    }
+
+    const items = exports.benchmark_init(particles);
+    const start = performance.now();
+    exports.benchmark_run(steps, 1.0 / 60.0);
+    const elapsed = performance.now() - start;
+
+    const state = new Float32Array(memory.buffer, items,
+                                   particles * PARTICLE_FLOATS).slice();
+    pool.terminate();
+
+    return { elapsed, state, workers: pool.workers.length };
+}
+
+async function main() {
+    const wasmPath = process.argv[2] ||
+        path.join(__dirname, "..", "dist", "wasm", "particle_simulator.wasm");
+    const workers = process.argv[3] !== undefined
+        ? parseInt(process.argv[3])
+        : Math.max(0, os.cpus().length - 1);
+    const particles = parseInt(process.argv[4] || "2000");
+    const steps = parseInt(process.argv[5] || "20");
+    const referencePath = process.argv[6];
+
+    const module = await WebAssembly.compile(fs.readFileSync(wasmPath));
+
+    const serial = await run(module, 0, particles, steps);
+    const pooled = await run(module, workers, particles, steps);
+
+    let difference = 0;
+    for (let i = 0; i < serial.state.length; i++) {
+        difference = Math.max(difference,
+                              Math.abs(serial.state[i] - pooled.state[i]));
+    }
+
+    for (const result of [serial, pooled]) {
+        const ms = result.elapsed / steps;
+        console.log(`${result.workers} workers: ${ms.toFixed(3)} ms/step, ` +
+                    `${(particles * 1000 / ms).toFixed(0)} particle-steps/s`);
+    }
+    console.log(`speedup: ${(serial.elapsed / pooled.elapsed).toFixed(2)}x, ` +
+                `max difference: ${difference}`);
+
+    let failed = difference !== 0;
+
+    if (referencePath !== undefined) {
+        const reference = await WebAssembly.compile(
+            fs.readFileSync(referencePath));
+        const expected = await run(reference, 0, particles, 1);
+        const actual = await run(module, 0, particles, 1);
+
+        let largest = 0;
+        let error = 0;
+        for (let i = 0; i < expected.state.length; i++) {
+            largest = Math.max(largest, Math.abs(expected.state[i]));
+            error = Math.max(error,
+                             Math.abs(actual.state[i] - expected.state[i]));
+        }
+        const relative = largest > 0 ? error / largest : error;
+        console.log(`reference: max relative difference ${relative}`);
+        failed = failed || !(relative <= REFERENCE_TOLERANCE);
+    }
+
+    process.exitCode = failed ? 1 : 0;
+}
+
+main();
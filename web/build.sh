@@ -1,12 +1,34 @@
 #!/bin/bash
 
+# The simulation runs on a pool of Web Workers sharing the memory of the
+# page, so every object is built with atomics and the memory is imported as
+# a shared memory. The memory limits must match MEMORY_INITIAL_PAGES and
+# MEMORY_MAXIMUM_PAGES in raylib.js.
+#
+# The page loads the SIMD128 build, whose kernels process 4 particles at a
+# time (see src/kernel_simd.h). The scalar build is kept as a reference for
+# bench.js.
+build() {
+    clang --target=wasm32 -O2 -matomics -mbulk-memory -mmutable-globals "$@" \
+        -I./include -I../src \
+        --no-standard-libraries -Wl,--export-table -Wl,--no-entry \
+        -Wl,--allow-undefined -Wl,--import-memory -Wl,--shared-memory \
+        -Wl,--export-memory -Wl,--initial-memory=16777216 \
+        -Wl,--max-memory=67108864 -Wl,--export=main \
+        -Wl,--export=pool_init -Wl,--export=pool_ready \
+        -Wl,--export=worker_main -Wl,--export=worker_stack_top \
+        -Wl,--export=__stack_pointer -Wl,--export=benchmark_init \
+        -Wl,--export=benchmark_run \
+        particle_simulator.c ../src/kernel.c ../src/particle.c \
+        ../src/pressure.c ../src/raylib_extensions.c -DSPH_NO_STDIO -DSPH_NO_RLGL
+}
+
 mkdir -p dist/wasm
-clang --target=wasm32 -I./include -I../src \
-    --no-standard-libraries -Wl,--export-table -Wl,--no-entry \
-    -Wl,--allow-undefined -Wl,--export=main -o dist/wasm/particle_simulator.wasm \
-    particle_simulator.c ../src/*.c -DSPH_NO_STDIO
+build -msimd128 -o dist/wasm/particle_simulator.wasm
+build -o dist/wasm/particle_simulator_scalar.wasm
 
 cp index.html dist/
 cp raylib.js dist/
+cp raylib_worker.js dist/
 rm -rf ../dist
 mv dist ../dist
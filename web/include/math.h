@@ -3,6 +3,7 @@
 #ifndef MATH_H_
 #define MATH_H_
 #define M_PI 3.14159265358979323846
+#define INFINITY __builtin_inff()
 float floorf(float);
 float fabsf(float);
 double fabs(double);
@@ -1,6 +1,8 @@
 #include "raylib.h"
+#include "raylib_extensions.h"
 #include "raymath.h"
 #include "sph.h"
+#include <stdatomic.h>
 
 #define SCREEN_WIDTH 1600
 #define SCREEN_HEIGHT 900
@@ -38,7 +40,16 @@ struct simulation_parameters {
 };
 
 #define PARTICLE_COUNT 100
-#define PARTICLE_CAPACITY 1000
+
+// Time a step may take, the number of particles is capped so that the
+// O(n^2) density and force loops stay within it
+#define STEP_BUDGET_SECONDS 0.010
+
+// Cap before the first step is measured
+#define PARTICLE_INITIAL_BUDGET 2000
+
+// Steps with fewer particles are too short to measure
+#define PARTICLE_MIN_MEASURED 64
 
 struct simulation_parameters params = {
     .seed = 0,
@@ -55,28 +66,169 @@ struct simulation_parameters params = {
     .kernel_type = GAUSSIAN_KERNEL,
     .h = 2.0f,
 };
-struct particle ps[PARTICLE_CAPACITY];
 struct particle_array particles;
 
-static void *get_pressure_params(struct simulation_parameters params) {
+// Constants of the kernel of params, computed again when h or the kernel
+// type is edited rather than for every particle
+struct kernel_coefficients kernel;
+
+// Screen positions of the particles, handed to raylib.js in one call
+Vector2 *screen_positions;
+
+// Number of particles the measured step time allows
+int particle_budget = PARTICLE_INITIAL_BUDGET;
+
+#define WASM_PAGE_SIZE 65536
+#define ARENA_ALIGNMENT 16
+
+// Start of the free memory, after the data and the stack
+extern unsigned char __heap_base;
+
+// The web build has no libc, so buffers are carved upwards from __heap_base
+// by a bump allocator that grows the memory with memory.grow. Nothing is
+// ever freed, but the last block can grow in place.
+struct arena {
+        unsigned long top; // First free byte, 0 until the first allocation
+        unsigned long last; // Start of the last block
+};
+
+struct arena arena;
+
+// Grows the memory so that it holds at least end bytes
+//
+// Returns 0 on success or -1 if the memory limit is reached
+static int arena_ensure(unsigned long end) {
+    unsigned long size = __builtin_wasm_memory_size(0) * WASM_PAGE_SIZE;
+    if (end <= size) {
+        return 0;
+    }
+
+    unsigned long pages = (end - size + WASM_PAGE_SIZE - 1) / WASM_PAGE_SIZE;
+    if (__builtin_wasm_memory_grow(0, pages) == (unsigned long)-1) {
+        return -1;
+    }
+
+    return 0;
+}
+
+// Returns a block of size bytes or NULL if the memory limit is reached
+static void *arena_alloc(unsigned long size) {
+    if (arena.top == 0) {
+        arena.top = (unsigned long)&__heap_base;
+    }
+
+    unsigned long start =
+        (arena.top + ARENA_ALIGNMENT - 1) & ~(unsigned long)(ARENA_ALIGNMENT - 1);
+    if (arena_ensure(start + size) != 0) {
+        return NULL;
+    }
+    arena.top = start + size;
+    arena.last = start;
+
+    return (void *)start;
+}
+
+// Resizes a block, in place if it is the last one and by copying it
+// otherwise
+//
+// Returns the block or NULL if the memory limit is reached, in which case
+// the old block is left as is
+static void *arena_realloc(void *block, unsigned long old_size,
+                           unsigned long size) {
+    if (block != NULL && (unsigned long)block == arena.last) {
+        if (arena_ensure(arena.last + size) != 0) {
+            return NULL;
+        }
+        arena.top = arena.last + size;
+        return block;
+    }
+
+    void *moved = arena_alloc(size);
+    if (moved != NULL && block != NULL) {
+        __builtin_memcpy(moved, block,
+                         old_size < size ? old_size : size);
+    }
+
+    return moved;
+}
+
+// Makes room for count particles, doubling the capacity
+//
+// The particles and their screen positions share one block, the particles
+// first. It is the only block of the arena, so it always grows in place and
+// the particles never move. The screen positions are filled again every
+// frame, so they are only pointed past the larger particle array.
+//
+// Must only be called while the workers are parked, as they read the
+// particles
+//
+// Returns 0 on success or -1 if the memory limit is reached
+static int particles_reserve(int count) {
+    if (count <= particles.capacity) {
+        return 0;
+    }
+
+    int capacity = particles.capacity > 0 ? particles.capacity : 256;
+    while (capacity < count) {
+        capacity *= 2;
+    }
+
+    unsigned long item_size = sizeof(struct particle) + sizeof(Vector2);
+    unsigned char *block =
+        arena_realloc(particles.items, particles.capacity * item_size,
+                      capacity * item_size);
+    if (block == NULL) {
+        return -1;
+    }
+    particles.items = (struct particle *)block;
+    particles.capacity = capacity;
+    screen_positions =
+        (Vector2 *)(block + capacity * sizeof(struct particle));
+
+    return 0;
+}
+
+// Updates the particle budget from the duration of a step, the density and
+// force loops go over every pair so the time grows with count^2
+static void particle_budget_update(double elapsed) {
+    int count = particles.count;
+    if (count < PARTICLE_MIN_MEASURED || elapsed <= 0.0) {
+        return;
+    }
+
+    double pair_time = elapsed / ((double)count * count);
+    double budget = __builtin_sqrt(STEP_BUDGET_SECONDS / pair_time);
+
+    // Smoothed, a single slow frame should not stop the clicks
+    particle_budget = (int)(0.9 * particle_budget + 0.1 * budget);
+}
+
+// Storage for the parameters of any equation of state
+union pressure_params {
+        struct pressure_cole_params cole;
+        struct pressure_gas_params gas;
+};
+
+static void *get_pressure_params(struct simulation_parameters params,
+                                 union pressure_params *storage) {
     void *pressure_params;
     switch (params.pressure_type) {
     case COLE_PRESSURE: {
-        struct pressure_cole_params p = {
+        storage->cole = (struct pressure_cole_params){
             .rest_density = params.rest_density,
             .speed_of_sound = params.speed_of_sound,
             .adiabatic_index = params.adiabatic_index,
             .background_pressure = params.background_pressure,
         };
-        pressure_params = &p;
+        pressure_params = &storage->cole;
         break;
     }
     case GAS_PRESSURE: {
-        struct pressure_gas_params p = {
+        storage->gas = (struct pressure_gas_params){
             .rest_density = params.rest_density,
             .pressure_multiplier = params.pressure_multiplier,
         };
-        pressure_params = &p;
+        pressure_params = &storage->gas;
         break;
     }
     }
@@ -105,40 +257,174 @@ static void resolve_collisions(struct particle *particle, Vector2 position,
     particle->position = position;
 }
 
-static void simulation_step(struct particle_array *particles,
-                     struct simulation_parameters params) {
-    float dt = GetFrameTime();
+// Thread pool
+//
+// raylib.js starts one Web Worker per pool thread on the same shared memory
+// and each one calls worker_main, which never returns: it waits for the
+// generation counter to change, runs its range of the current phase and
+// counts itself out. The page runs the last range itself and spins until
+// the workers are done, since the main thread of a page may not block.
+#define MAX_WORKERS 15
+#define WORKER_STACK_SIZE (64 * 1024)
+
+enum pool_phase {
+    POOL_DENSITY, // Density and pressure of every particle
+    POOL_FORCES,  // Pressure and gravity accelerations of every particle
+};
+
+struct pool {
+        atomic_int generation; // Bumped to start a phase
+        atomic_int remaining;  // Workers still running the current phase
+        atomic_int ready;      // Workers waiting for phases
+        int workers;           // Workers started by raylib.js
+        enum pool_phase phase; // Phase of the current generation
+        float dt;              // Time step of the current phase
+};
+
+struct pool pool;
+
+// Each worker instance has its own __stack_pointer, raylib.js points it at
+// the top of one of these
+static unsigned char worker_stacks[MAX_WORKERS][WORKER_STACK_SIZE]
+    __attribute__((aligned(16)));
+
+static void simulation_phase(enum pool_phase phase, int start, int end,
+                             float dt) {
+    switch (phase) {
+    case POOL_DENSITY: {
+        union pressure_params storage;
+        void *pressure_params = get_pressure_params(params, &storage);
+        for (int i = start; i < end; i++) {
+            particles.items[i].density = particle_density_kernel(
+                &particles, i, &kernel, params.particle_mass);
+            particles.items[i].pressure =
+                pressure_value(particles.items[i].density, pressure_params,
+                               params.pressure_type);
+        }
+        break;
+    }
+    case POOL_FORCES: {
+        for (int i = start; i < end; i++) {
+            Vector2 pressure_gradient = particle_pressure_gradient_kernel(
+                &particles, i, &kernel, params.particle_mass);
+
+            Vector2 pressure_acceleration = Vector2Scale(
+                pressure_gradient, 1.0f / particles.items[i].density);
+
+            Vector2 gravity_acceleration = {0.0f, params.gravity};
+
+            Vector2 acceleration =
+                Vector2Add(pressure_acceleration, gravity_acceleration);
+
+            particles.items[i].velocity = Vector2Add(
+                particles.items[i].velocity, Vector2Scale(acceleration, dt));
+        }
+        break;
+    }
+    }
+}
+
+static void pool_range(int index, int *start, int *end) {
+    int threads = pool.workers + 1;
+    *start = (int)((long)index * particles.count / threads);
+    *end = (int)((long)(index + 1) * particles.count / threads);
+}
+
+// Runs a phase over all the particles, on the page alone until every worker
+// is up
+static void pool_run(enum pool_phase phase, float dt) {
+    if (pool.workers == 0 || atomic_load(&pool.ready) < pool.workers) {
+        simulation_phase(phase, 0, particles.count, dt);
+        return;
+    }
+
+    pool.phase = phase;
+    pool.dt = dt;
+    atomic_store(&pool.remaining, pool.workers);
+    atomic_fetch_add(&pool.generation, 1);
+    __builtin_wasm_memory_atomic_notify((int *)&pool.generation, pool.workers);
+
+    int start, end;
+    pool_range(pool.workers, &start, &end);
+    simulation_phase(phase, start, end, dt);
 
-    for (int i = 0; i < particles->count; i++) {
-        particles->items[i].density = particle_density(
-            particles, i, params.h, params.particle_mass, params.kernel_type);
-        particles->items[i].pressure =
-            pressure_value(particles->items[i].density,
-                           get_pressure_params(params), params.pressure_type);
+    while (atomic_load(&pool.remaining) > 0) {
     }
+}
 
-    for (int i = 0; i < particles->count; i++) {
-        Vector2 pressure_gradient = particle_pressure_gradient(
-            particles, i, params.h, params.particle_mass, params.kernel_type);
+// Sets the number of workers raylib.js is about to start
+//
+// Returns the number of workers to start
+int pool_init(int workers) {
+    pool.workers = workers < 0             ? 0
+                   : workers > MAX_WORKERS ? MAX_WORKERS
+                                           : workers;
+    return pool.workers;
+}
 
-        Vector2 pressure_acceleration =
-            Vector2Scale(pressure_gradient, 1.0f / particles->items[i].density);
+// Returns the number of workers waiting for phases
+int pool_ready(void) { return atomic_load(&pool.ready); }
 
-        Vector2 gravity_acceleration = {0.0f, params.gravity};
+// Returns the initial stack pointer of a worker
+void *worker_stack_top(int index) {
+    return worker_stacks[index] + WORKER_STACK_SIZE;
+}
 
-        Vector2 acceleration =
-            Vector2Add(pressure_acceleration, gravity_acceleration);
+// Entry point of the Web Worker of a pool thread, never returns
+void worker_main(int index) {
+    int seen = atomic_load(&pool.generation);
+    atomic_fetch_add(&pool.ready, 1);
+
+    for (;;) {
+        int generation;
+        while ((generation = atomic_load(&pool.generation)) == seen) {
+            __builtin_wasm_memory_atomic_wait32((int *)&pool.generation, seen,
+                                                -1);
+        }
+        seen = generation;
+
+        int start, end;
+        pool_range(index, &start, &end);
+        simulation_phase(pool.phase, start, end, pool.dt);
+        atomic_fetch_sub(&pool.remaining, 1);
+    }
+}
 
-        particles->items[i].velocity = Vector2Add(
-            particles->items[i].velocity, Vector2Scale(acceleration, dt));
+static void simulation_step(float dt) {
+    // The workers are parked, they only read the kernel during the phases
+    if (kernel.h != params.h || kernel.type != params.kernel_type) {
+        kernel_coefficients_init(&kernel, params.h, params.kernel_type);
     }
 
-    for (int i = 0; i < particles->count; i++) {
+    pool_run(POOL_DENSITY, dt);
+    pool_run(POOL_FORCES, dt);
+
+    for (int i = 0; i < particles.count; i++) {
         Vector2 position =
-            Vector2Add(particles->items[i].position,
-                       Vector2Scale(particles->items[i].velocity, dt));
+            Vector2Add(particles.items[i].position,
+                       Vector2Scale(particles.items[i].velocity, dt));
 
-        resolve_collisions(&particles->items[i], position, params);
+        resolve_collisions(&particles.items[i], position, params);
+    }
+}
+
+// Entry points of bench.js, which runs the simulation under Node without a
+// canvas
+//
+// Returns the particles, laid out as struct particle
+struct particle *benchmark_init(int count) {
+    if (particles_reserve(count) != 0) {
+        return NULL;
+    }
+    particles.count = count;
+    particles_init_rand(&particles, params.width, params.height);
+
+    return particles.items;
+}
+
+void benchmark_run(int steps, float dt) {
+    for (int i = 0; i < steps; i++) {
+        simulation_step(dt);
     }
 }
 
@@ -156,7 +442,8 @@ void GameFrame(void)
             .density = 0.0f,
             .pressure = 0.0f,
         };
-        if (particles.count < particles.capacity) {
+        if (particles.count < particle_budget &&
+            particles_reserve(particles.count + 1) == 0) {
             particles.items[particles.count] = p;
             particles.count++;
         }
@@ -179,7 +466,9 @@ void GameFrame(void)
     }
 
     if (IsKeyDown(KEY_SPACE)) {
-        simulation_step(&particles, params);
+        double start = GetTime();
+        simulation_step(GetFrameTime());
+        particle_budget_update(GetTime() - start);
     }
 
     BeginDrawing();
@@ -187,12 +476,12 @@ void GameFrame(void)
 
     // Draw particles
     for (int i = 0; i < particles.count; i++) {
-        Vector2 screen_position =
+        screen_positions[i] =
             (Vector2){FROM_WORLD_TO_SCREEN(particles.items[i].position.x),
                       FROM_WORLD_TO_SCREEN(particles.items[i].position.y)};
-        float screen_radius = FROM_WORLD_TO_SCREEN(params.particle_radius);
-        DrawCircleV(screen_position, screen_radius, GREEN);
     }
+    float screen_radius = FROM_WORLD_TO_SCREEN(params.particle_radius);
+    DrawParticlesBatch(screen_positions, particles.count, screen_radius, GREEN);
 
     // Draw parameters
     DrawText(TextFormat("Hold space to simulate"), 10, 10, 20, WHITE);
@@ -207,9 +496,10 @@ void raylib_js_set_entry(void (*entry)(void));
 int main() {
     unsigned int debug = 0;
 
-    particles.items = ps;
+    if (particles_reserve(params.particle_count) != 0) {
+        return 1;
+    }
     particles.count = params.particle_count;
-    particles.capacity = PARTICLE_CAPACITY;
 
     particles_init_rand(&particles, params.width, params.height);
 
@@ -1,9 +1,12 @@
 function make_environment(env) {
     return new Proxy(env, {
         get(target, prop, receiver) {
-            if (env[prop] !== undefined) {
+            if (typeof env[prop] === "function") {
                 return env[prop].bind(env);
             }
+            if (env[prop] !== undefined) {
+                return env[prop];
+            }
             return (...args) => {
                 throw new Error(`NOT IMPLEMENTED: ${prop} ${args}`);
             }
@@ -11,6 +14,69 @@ function make_environment(env) {
     });
 }
 
+// The math imports of the wasm module, the pool workers have nothing else
+const mathEnvironment = {
+    expf: Math.exp,
+    powf: Math.pow,
+    sqrtf: Math.sqrt,
+    floorf: Math.floor,
+    fabsf: Math.abs,
+    fabs: Math.abs,
+    fmaxf: Math.max,
+    fminf: Math.min,
+    sinf: Math.sin,
+    cosf: Math.cos,
+    asinf: Math.asin,
+    acosf: Math.acos,
+    atan2f: Math.atan2,
+    tan: Math.tan,
+};
+
+// Limits of the shared memory, they must match --initial-memory and
+// --max-memory in build.sh (in 64 KiB pages)
+const MEMORY_INITIAL_PAGES = 256;
+const MEMORY_MAXIMUM_PAGES = 1024;
+
+function createWorker(path) {
+    if (typeof Worker !== "undefined") {
+        return new Worker(path);
+    }
+    const { Worker: NodeWorker } = require("worker_threads");
+    return new NodeWorker(path);
+}
+
+// Hosts the threads of the simulation pool (see worker_main in
+// particle_simulator.c), as Web Workers in the browser or as worker_threads
+// under Node. Every worker instantiates the same module on the same shared
+// memory with its own stack.
+class RaylibWorkerPool {
+    constructor({ module, memory, exports, workers, workerPath }) {
+        this.workers = [];
+        const count = exports.pool_init(workers);
+        for (let index = 0; index < count; index++) {
+            const worker = createWorker(workerPath);
+            worker.postMessage({
+                module,
+                memory,
+                index,
+                stackTop: exports.worker_stack_top(index),
+            });
+            this.workers.push(worker);
+        }
+    }
+
+    terminate() {
+        for (const worker of this.workers) {
+            worker.terminate();
+        }
+        this.workers = [];
+    }
+}
+
+// Below this many particles one Canvas2D path of arcs is cheaper than
+// clearing and uploading a whole frame of pixels
+const PARTICLE_IMAGE_THRESHOLD = 1000;
+
 let iota = 0;
 const LOG_ALL     = iota++; // Display all logs
 const LOG_TRACE   = iota++; // Trace logging, intended for internal use only
@@ -45,6 +111,12 @@ class RaylibJs {
         this.currentPressedMouseButtons = new Set();
         this.images = [];
         this.quit = false;
+        this.memory = undefined;
+        this.pool = undefined;
+        this.particleCanvas = undefined;
+        this.particleImage = undefined;
+        this.particlePixels = undefined;
+        this.particleSprite = undefined;
     }
 
     constructor() {
@@ -55,7 +127,7 @@ class RaylibJs {
         this.quit = true;
     }
 
-    async start({ wasmPath, canvasId }) {
+    async start({ wasmPath, canvasId, workers }) {
         if (this.wasm !== undefined) {
             console.error("The game is already running. Please stop() it first.");
             return;
@@ -67,9 +139,21 @@ class RaylibJs {
             throw new Error("Could not create 2d canvas context");
         }
 
-        this.wasm = await WebAssembly.instantiateStreaming(fetch(wasmPath), {
+        // The memory is shared with the pool workers, which browsers only
+        // allow on cross-origin isolated pages (see serve.py)
+        if (!globalThis.crossOriginIsolated) {
+            throw new Error("SharedArrayBuffer is not available, serve the page with the Cross-Origin-Opener-Policy and Cross-Origin-Embedder-Policy headers");
+        }
+        this.memory = new WebAssembly.Memory({
+            initial: MEMORY_INITIAL_PAGES,
+            maximum: MEMORY_MAXIMUM_PAGES,
+            shared: true,
+        });
+        const module = await WebAssembly.compileStreaming(fetch(wasmPath));
+        const instance = await WebAssembly.instantiate(module, {
             env: make_environment(this)
         });
+        this.wasm = { module, instance };
 
         const keyDown = (e) => {
             this.currentPressedKeyState.add(glfwKeyMapping[e.code]);
@@ -97,8 +181,23 @@ class RaylibJs {
         window.addEventListener("mouseup", mouseUp);
 
         this.wasm.instance.exports.main();
+
+        // The page runs its share of every phase, so it needs one worker
+        // less than there are cores
+        if (workers === undefined) {
+            workers = Math.max(0, (navigator.hardwareConcurrency || 1) - 1);
+        }
+        this.pool = new RaylibWorkerPool({
+            module,
+            memory: this.memory,
+            exports: this.wasm.instance.exports,
+            workers,
+            workerPath: "raylib_worker.js",
+        });
+
         const next = (timestamp) => {
             if (this.quit) {
+                this.pool.terminate();
                 this.ctx.clearRect(0, 0, this.ctx.canvas.width, this.ctx.canvas.height);
                 window.removeEventListener("keydown", keyDown);
                 this.#reset()
@@ -145,6 +244,10 @@ class RaylibJs {
         return Math.min(this.dt, 1.0/this.targetFPS);
     }
 
+    GetTime() {
+        return performance.now() / 1000.0;
+    }
+
     BeginDrawing() {}
 
     EndDrawing() {
@@ -164,6 +267,85 @@ class RaylibJs {
         this.ctx.fill();
     }
 
+    // void DrawParticlesBatch(const Vector2 *positions, int count, float radius, Color color);   // Draw discs of the same radius and color (raylib_extensions.h)
+    DrawParticlesBatch(positions_ptr, count, radius, color_ptr) {
+        const buffer = this.wasm.instance.exports.memory.buffer;
+        const positions = new Float32Array(buffer, positions_ptr, 2*count);
+        const [r, g, b, a] = new Uint8Array(buffer, color_ptr, 4);
+
+        if (count >= PARTICLE_IMAGE_THRESHOLD) {
+            this.#drawParticlesImage(positions, count, radius, r, g, b, a);
+            return;
+        }
+
+        this.ctx.beginPath();
+        for (let i = 0; i < count; i++) {
+            const x = positions[2*i];
+            const y = positions[2*i + 1];
+            this.ctx.moveTo(x + radius, y);
+            this.ctx.arc(x, y, radius, 0, 2*Math.PI, false);
+        }
+        this.ctx.fillStyle = color_hex_unpacked(r, g, b, a);
+        this.ctx.fill();
+    }
+
+    // Stamps the discs into a frame of pixels, which is then drawn over the
+    // canvas in one drawImage
+    #drawParticlesImage(positions, count, radius, r, g, b, a) {
+        const width = this.ctx.canvas.width;
+        const height = this.ctx.canvas.height;
+        if (this.particleImage === undefined ||
+            this.particleImage.width !== width ||
+            this.particleImage.height !== height) {
+            this.particleCanvas = new OffscreenCanvas(width, height);
+            this.particleImage = new ImageData(width, height);
+            this.particlePixels = new Uint32Array(this.particleImage.data.buffer);
+        }
+
+        // Coverage of a disc of this radius, one pixel of antialiasing on the
+        // edge
+        if (this.particleSprite === undefined ||
+            this.particleSprite.radius !== radius) {
+            const size = 2*Math.ceil(radius) + 1;
+            const coverage = new Uint8Array(size*size);
+            const center = size/2;
+            for (let y = 0; y < size; y++) {
+                for (let x = 0; x < size; x++) {
+                    const distance = Math.hypot(x + 0.5 - center, y + 0.5 - center);
+                    const c = Math.min(Math.max(radius - distance + 0.5, 0), 1);
+                    coverage[y*size + x] = Math.round(c*255);
+                }
+            }
+            this.particleSprite = { radius, size, coverage };
+        }
+
+        const pixels = this.particlePixels;
+        const { size, coverage } = this.particleSprite;
+        const rgb = r | (g << 8) | (b << 16);
+        pixels.fill(0);
+        for (let i = 0; i < count; i++) {
+            const left = Math.round(positions[2*i] - size/2);
+            const top = Math.round(positions[2*i + 1] - size/2);
+            const x0 = Math.max(0, -left);
+            const y0 = Math.max(0, -top);
+            const x1 = Math.min(size, width - left);
+            const y1 = Math.min(size, height - top);
+            for (let y = y0; y < y1; y++) {
+                const row = (top + y)*width + left;
+                for (let x = x0; x < x1; x++) {
+                    // The discs share a color, overlaps keep the most opaque
+                    const alpha = (coverage[y*size + x]*a/255) | 0;
+                    if (alpha > (pixels[row + x] >>> 24)) {
+                        pixels[row + x] = (rgb | (alpha << 24)) >>> 0;
+                    }
+                }
+            }
+        }
+
+        this.particleCanvas.getContext("2d").putImageData(this.particleImage, 0, 0);
+        this.ctx.drawImage(this.particleCanvas, 0, 0);
+    }
+
     ClearBackground(color_ptr) {
         this.ctx.fillStyle = getColorFromMemory(this.wasm.instance.exports.memory.buffer, color_ptr);
         this.ctx.fillRect(0, 0, this.ctx.canvas.width, this.ctx.canvas.height);
@@ -545,7 +727,8 @@ function cstrlen(mem, ptr) {
 function cstr_by_ptr(mem_buffer, ptr) {
     const mem = new Uint8Array(mem_buffer);
     const len = cstrlen(mem, ptr);
-    const bytes = new Uint8Array(mem_buffer, ptr, len);
+    // TextDecoder does not take views of a shared memory
+    const bytes = new Uint8Array(mem_buffer, ptr, len).slice();
     return new TextDecoder().decode(bytes);
 }
 
@@ -569,3 +752,14 @@ function getColorFromMemory(buffer, color_ptr) {
     const [r, g, b, a] = new Uint8Array(buffer, color_ptr, 4);
     return color_hex_unpacked(r, g, b, a);
 }
+
+if (typeof module !== "undefined") {
+    module.exports = {
+        RaylibJs,
+        RaylibWorkerPool,
+        make_environment,
+        mathEnvironment,
+        MEMORY_INITIAL_PAGES,
+        MEMORY_MAXIMUM_PAGES,
+    };
+}
@@ -0,0 +1,23 @@
+// One thread of the simulation pool, started by RaylibWorkerPool in
+// raylib.js as a Web Worker in the browser or as a worker_threads Worker
+// under Node. It instantiates the module on the shared memory, moves its
+// stack to the region reserved for it and runs worker_main, which never
+// returns.
+
+function run({ make_environment, mathEnvironment }, data) {
+    const { module, memory, index, stackTop } = data;
+    const instance = new WebAssembly.Instance(module, {
+        env: make_environment({ ...mathEnvironment, memory }),
+    });
+    instance.exports.__stack_pointer.value = stackTop;
+    instance.exports.worker_main(index);
+}
+
+if (typeof importScripts === "function") {
+    importScripts("raylib.js");
+    onmessage = (e) => run({ make_environment, mathEnvironment }, e.data);
+} else {
+    const { parentPort } = require("worker_threads");
+    const raylib = require("./raylib.js");
+    parentPort.once("message", (data) => run(raylib, data));
+}
@@ -0,0 +1,24 @@
+# Serves the web build with the headers that make the page cross-origin
+# isolated, which browsers require before they share memory with workers
+#
+# Usage: python serve.py [port] [directory]
+
+import http.server
+import sys
+
+
+class IsolatedHandler(http.server.SimpleHTTPRequestHandler):
+    def end_headers(self):
+        self.send_header("Cross-Origin-Opener-Policy", "same-origin")
+        self.send_header("Cross-Origin-Embedder-Policy", "require-corp")
+        super().end_headers()
+
+
+if __name__ == "__main__":
+    port = int(sys.argv[1]) if len(sys.argv) > 1 else 6969
+    directory = sys.argv[2] if len(sys.argv) > 2 else "../dist"
+
+    def handler(*args, **kwargs):
+        return IsolatedHandler(*args, directory=directory, **kwargs)
+
+    http.server.ThreadingHTTPServer(("", port), handler).serve_forever()